@@ -0,0 +1,19 @@
+// arena.cpp - Bump allocator for per-compilation data
+#include "arena.hpp"
+
+void* Arena::allocate_slow(size_t size, size_t align) {
+    // Oversized requests get a block of their own so the current block keeps
+    // serving small nodes.
+    size_t block_size = size + align > BlockSize ? size + align : BlockSize;
+    blocks.emplace_back(new char[block_size]);
+    char* block = blocks.back().get();
+
+    size_t offset = (align - reinterpret_cast<size_t>(block) % align) % align;
+    void* p = block + offset;
+    if (block_size == BlockSize) {
+        cur = block + offset + size;
+        end = block + block_size;
+    }
+    used += size;
+    return p;
+}
@@ -0,0 +1,100 @@
+// arena.hpp - Bump allocator for per-compilation data
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Fixed-size array living in an Arena.
+template <typename T>
+struct Span {
+    T* data = nullptr;
+    size_t count = 0;
+
+    T* begin() const { return data; }
+    T* end() const { return data + count; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    T& operator[](size_t i) const { return data[i]; }
+};
+
+// Hands out memory from large blocks and releases everything at once when it
+// is destroyed. Objects are never destructed individually, so only trivially
+// destructible types may be placed in it.
+class Arena {
+public:
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    Arena(Arena&& other) noexcept { *this = std::move(other); }
+    Arena& operator=(Arena&& other) noexcept {
+        blocks = std::move(other.blocks);
+        cur = std::exchange(other.cur, nullptr);
+        end = std::exchange(other.end, nullptr);
+        used = std::exchange(other.used, 0);
+        other.blocks.clear();
+        return *this;
+    }
+
+    void* allocate(size_t size, size_t align) {
+        size_t offset = (align - reinterpret_cast<size_t>(cur) % align) % align;
+        if (cur == nullptr || static_cast<size_t>(end - cur) < offset + size) {
+            return allocate_slow(size, align);
+        }
+        void* p = cur + offset;
+        cur += offset + size;
+        used += size;
+        return p;
+    }
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destructed");
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    template <typename T, typename Range>
+    Span<T> copy(const Range& items) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destructed");
+        Span<T> span;
+        span.count = items.size();
+        if (span.count == 0) return span;
+        span.data = static_cast<T*>(allocate(sizeof(T) * span.count, alignof(T)));
+        size_t i = 0;
+        for (const auto& item : items) new (span.data + i++) T(item);
+        return span;
+    }
+
+    // Copies `text` into the arena; the view stays valid as long as the arena.
+    std::string_view store(std::string_view text) {
+        if (text.empty()) return std::string_view();
+        char* p = static_cast<char*>(allocate(text.size(), 1));
+        std::memcpy(p, text.data(), text.size());
+        return std::string_view(p, text.size());
+    }
+
+    // Takes over `block`, whose first `size` bytes the caller has already
+    // filled with objects, such as an AST image read from disk. Later
+    // allocations come from other blocks.
+    void adopt(std::unique_ptr<char[]> block, size_t size) {
+        blocks.push_back(std::move(block));
+        used += size;
+    }
+
+    size_t bytes_used() const { return used; }
+    size_t block_count() const { return blocks.size(); }
+
+private:
+    static constexpr size_t BlockSize = 64 * 1024;
+
+    void* allocate_slow(size_t size, size_t align);
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    char* cur = nullptr;
+    char* end = nullptr;
+    size_t used = 0;
+};
@@ -1,56 +1,245 @@
 // ast.hpp - AST structure for MyLang
 #pragma once
 #include "lexer.hpp"
+#include "arena.hpp"
 #include <string>
+#include <string_view>
 #include <vector>
-#include <memory>
 
+enum class NodeKind : uint8_t {
+    Say,
+    Set,
+    Arithmetic,
+    FunctionCall,
+    FunctionDef,
+    StartBlock,
+    If,
+    Repeat,
+    Import
+};
+
+// Static type of a numeric value, inferred by analyze() in sema.cpp.
+enum class ValueType : uint8_t {
+    Unknown,
+    Int,
+    Float
+};
+
+enum class ExprKind : uint8_t {
+    Number,
+    Variable,
+    Binary
+};
+
+enum class BinaryOp : uint8_t {
+    Add,
+    Minus,
+    Multiply,
+    Divide,
+    // Comparisons only appear as if/elif conditions.
+    Less,
+    LessEqual,
+    Greater,
+    GreaterEqual,
+    Equal,
+    NotEqual
+};
+
+struct Expr {
+    ExprKind kind;
+    ValueType type = ValueType::Unknown;
+    explicit Expr(ExprKind k) : kind(k) {}
+};
+
+struct NumberLiteral : Expr {
+    static constexpr ExprKind Kind = ExprKind::Number;
+    std::string_view text;
+    NumberLiteral(std::string_view text) : Expr(Kind), text(text) {}
+};
+
+struct VariableRef : Expr {
+    static constexpr ExprKind Kind = ExprKind::Variable;
+    SymbolId name;
+    VariableRef(SymbolId name) : Expr(Kind), name(name) {}
+};
+
+struct BinaryExpr : Expr {
+    static constexpr ExprKind Kind = ExprKind::Binary;
+    BinaryOp op;
+    Expr* lhs;
+    Expr* rhs;
+    BinaryExpr(BinaryOp op, Expr* lhs, Expr* rhs) : Expr(Kind), op(op), lhs(lhs), rhs(rhs) {}
+};
+
+// Nodes are plain tagged structs allocated from the AST's arena; consumers
+// switch on `kind` and static_cast (or use node_cast). Identifiers are ids in
+// AST::symbols, resolved to text only when output is written. Literals are
+// views into the token buffer's source text, so the source must outlive the
+// AST.
 struct Statement {
-    virtual ~Statement() = default;
+    NodeKind kind;
+    int line = 0;
+    explicit Statement(NodeKind k) : kind(k) {}
 };
 
-class SayStatement : public Statement {
-public:
-    std::vector<std::string> args;
-    std::vector<bool> is_vars;
-    std::string end;
+// A say or call argument: a string literal, or the variable `var` when set.
+struct Argument {
+    std::string_view text;
+    SymbolId var = NoSymbol;
 
-    SayStatement(const std::vector<std::string>& args,
-        const std::vector<bool>& is_vars,
-        const std::string& end)
-        : args(args), is_vars(is_vars), end(end) {}
+    bool is_var() const { return var != NoSymbol; }
 };
 
+struct SayStatement : Statement {
+    static constexpr NodeKind Kind = NodeKind::Say;
+    Span<Argument> args;
+    std::string_view end;
+    bool flush_after = false;  // -O folded a default "\n" ending into args; it still flushes
+
+    SayStatement(Span<Argument> args, std::string_view end) : Statement(Kind), args(args), end(end) {}
+};
 
-struct SetStatement : public Statement {
-    std::string var;
-    SetStatement(const std::string& var) : var(var) {}
+// set x [= expr]; without a value the variable starts at integer 0.
+struct SetStatement : Statement {
+    static constexpr NodeKind Kind = NodeKind::Set;
+    SymbolId var;
+    Expr* value;
+    ValueType type = ValueType::Unknown;  // of the variable, after analyze()
+    bool declares = false;                // first set of `var` in its scope
+    SetStatement(SymbolId var, Expr* value = nullptr) : Statement(Kind), var(var), value(value) {}
+};
+
+// add/minus/multiply/divide x expr, i.e. x op= expr.
+struct ArithmeticStatement : Statement {
+    static constexpr NodeKind Kind = NodeKind::Arithmetic;
+    BinaryOp op;
+    SymbolId var;
+    Expr* operand;
+    ValueType type = ValueType::Unknown;  // of the variable, after analyze()
+    ArithmeticStatement(BinaryOp op, SymbolId var, Expr* operand)
+        : Statement(Kind), op(op), var(var), operand(operand) {}
 };
 
 struct FunctionCall : Statement {
-    std::string name;
-    std::string arg;
-    TokenType arg_type;
-    FunctionCall(const std::string& n, const std::string& a, TokenType t = TokenType::EOFToken)
-        : name(n), arg(a), arg_type(t) {}
+    static constexpr NodeKind Kind = NodeKind::FunctionCall;
+    SymbolId name;
+    Argument arg;
+    FunctionCall(SymbolId name, Argument arg = {}) : Statement(Kind), name(name), arg(arg) {}
+
+    // An empty string literal passes nothing, as it always has.
+    bool has_arg() const { return arg.is_var() || !arg.text.empty(); }
 };
 
+struct FunctionDef : Statement {
+    static constexpr NodeKind Kind = NodeKind::FunctionDef;
+    SymbolId name;
+    SymbolId param;  // NoSymbol without one
+    Span<Statement*> body;
+    FunctionDef(SymbolId name, SymbolId param, Span<Statement*> body)
+        : Statement(Kind), name(name), param(param), body(body) {}
+};
 
-struct FunctionDef : public Statement {
-    std::string name;
-    std::string param;
-    std::vector<std::shared_ptr<Statement>> body;
-    FunctionDef(const std::string& name, const std::string& param,
-        const std::vector<std::shared_ptr<Statement>>& body)
-        : name(name), param(param), body(body) {}
+struct StartBlock : Statement {
+    static constexpr NodeKind Kind = NodeKind::StartBlock;
+    Span<Statement*> body;
+    StartBlock(Span<Statement*> body) : Statement(Kind), body(body) {}
 };
 
-struct StartBlock : public Statement {
-    std::vector<std::shared_ptr<Statement>> body;
-    StartBlock(const std::vector<std::shared_ptr<Statement>>& body)
-        : body(body) {}
+// One `if`/`elif` arm.
+struct Branch {
+    Expr* condition;
+    Span<Statement*> body;
+};
+
+// if cond: ... [elif cond: ...]* [else: ...] end
+struct IfStatement : Statement {
+    static constexpr NodeKind Kind = NodeKind::If;
+    Span<Branch> branches;
+    Span<Statement*> else_body;
+    IfStatement(Span<Branch> branches, Span<Statement*> else_body)
+        : Statement(Kind), branches(branches), else_body(else_body) {}
+};
+
+// repeat [counter] count: ... end
+// Runs the body `count` times (evaluated once); the optional counter is an
+// integer going from 0 to count - 1.
+struct RepeatStatement : Statement {
+    static constexpr NodeKind Kind = NodeKind::Repeat;
+    SymbolId counter;  // NoSymbol without one
+    Expr* count;
+    Span<Statement*> body;
+    RepeatStatement(SymbolId counter, Expr* count, Span<Statement*> body)
+        : Statement(Kind), counter(counter), count(count), body(body) {}
+};
+
+// import name, or import "path": makes the functions of another file
+// callable, without copying them in. Top level only; see modules.hpp.
+struct ImportStatement : Statement {
+    static constexpr NodeKind Kind = NodeKind::Import;
+    std::string_view module;  // the name, or the path without its quotes
+    bool is_path;
+    ImportStatement(std::string_view module, bool is_path) : Statement(Kind), module(module), is_path(is_path) {}
+};
+
+// Checked downcast on the node tag; nullptr when the kind does not match.
+template <typename T>
+T* node_cast(Statement* stmt) {
+    return stmt && stmt->kind == T::Kind ? static_cast<T*>(stmt) : nullptr;
+}
+
+template <typename T>
+const T* node_cast(const Statement* stmt) {
+    return stmt && stmt->kind == T::Kind ? static_cast<const T*>(stmt) : nullptr;
+}
+
+template <typename T>
+T* expr_cast(Expr* expr) {
+    return expr && expr->kind == T::Kind ? static_cast<T*>(expr) : nullptr;
+}
+
+template <typename T>
+const T* expr_cast(const Expr* expr) {
+    return expr && expr->kind == T::Kind ? static_cast<const T*>(expr) : nullptr;
+}
+
+// Calls fn(Span<Statement*>) for each statement list nested directly in
+// `stmt` (function and start bodies, if arms, loop bodies).
+template <typename Fn>
+void for_each_body(const Statement* stmt, Fn&& fn) {
+    switch (stmt->kind) {
+    case NodeKind::FunctionDef:
+        fn(static_cast<const FunctionDef*>(stmt)->body);
+        break;
+    case NodeKind::StartBlock:
+        fn(static_cast<const StartBlock*>(stmt)->body);
+        break;
+    case NodeKind::If: {
+        auto branch_if = static_cast<const IfStatement*>(stmt);
+        for (const auto& branch : branch_if->branches) fn(branch.body);
+        fn(branch_if->else_body);
+        break;
+    }
+    case NodeKind::Repeat:
+        fn(static_cast<const RepeatStatement*>(stmt)->body);
+        break;
+    default:
+        break;
+    }
+}
+
+// A function another module defines, as its interface declares it.
+struct ExternFunction {
+    SymbolId name;
+    bool has_param;
 };
 
+// Owns every node of one compilation; they are all released together.
 struct AST {
-    std::vector<std::shared_ptr<Statement>> statements;
+    Arena arena;
+    Interner symbols;
+    std::vector<Statement*> statements;
+    size_t node_count = 0;
+    // What the imported modules define, filled in by link_imports() once
+    // they are found; generated code declares these and calls them.
+    std::vector<ExternFunction> externs;
 };
@@ -0,0 +1,386 @@
+// astimage.cpp - On-disk image of an analyzed AST, loaded back in place
+#include "astimage.hpp"
+#include "cache.hpp"
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace {
+
+struct ImageHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t layout;
+    uint64_t source_size;
+    uint64_t image_size;
+    uint64_t image_hash;
+    uint64_t node_count;
+    uint64_t roots;
+    uint64_t root_count;
+    uint64_t symbols;
+    uint64_t symbol_count;
+    uint64_t diagnostics;
+    uint64_t diagnostics_size;
+    uint64_t relocations;
+    uint64_t relocation_count;
+};
+
+const char image_magic[8] = "hcp-ast";
+
+// The image starts this far into the file, so it can be read into a block
+// that new[] has aligned for any node.
+constexpr size_t ImageStart = (sizeof(ImageHeader) + 15) / 16 * 16;
+
+// The low two bits of a relocation say what the word at its offset refers to.
+enum Relocation : uint64_t {
+    Pointer = 0,     // a node or array in the image
+    ImageView = 1,   // a string_view of text in the image
+    SourceView = 2   // a string_view of the source
+};
+
+static_assert(sizeof(void*) == sizeof(uintptr_t), "pointers are stored as offsets");
+
+// Images hold nodes as their bytes, so one written by a build that lays them
+// out differently must not load.
+uint32_t layout_signature() {
+    uint32_t byte_order = 0x01020304;
+    const uint64_t shape[] = {
+        sizeof(void*), sizeof(std::string_view), sizeof(Span<char>), sizeof(Argument), sizeof(Branch),
+        sizeof(SayStatement), sizeof(SetStatement), sizeof(ArithmeticStatement), sizeof(FunctionCall),
+        sizeof(FunctionDef), sizeof(StartBlock), sizeof(IfStatement), sizeof(RepeatStatement),
+        sizeof(ImportStatement), sizeof(NumberLiteral), sizeof(VariableRef), sizeof(BinaryExpr),
+        alignof(SayStatement), alignof(Argument), alignof(BinaryExpr),
+        *reinterpret_cast<const unsigned char*>(&byte_order)
+    };
+    // Where a view's pointer and size go is up to the standard library.
+    std::string_view probe(reinterpret_cast<const char*>(uintptr_t(1)), 2);
+    uint64_t seed = hash_bytes(std::string_view(reinterpret_cast<const char*>(&probe), sizeof(probe)));
+    std::string_view bytes(reinterpret_cast<const char*>(shape), sizeof(shape));
+    return static_cast<uint32_t>(hash_bytes(bytes, seed));
+}
+
+template <typename T, typename Member>
+size_t field(const T* node, const Member& member) {
+    return static_cast<size_t>(reinterpret_cast<const char*>(&member) - reinterpret_cast<const char*>(node));
+}
+
+// Copies nodes into `image` as they are, then rewrites each pointer in the
+// copy as an image or source offset and notes it in `relocations`. Only
+// offsets are held while writing, since `image` reallocates as it grows.
+// `image` starts with room for the header, and offsets count from after it.
+class ImageWriter {
+public:
+    ImageWriter(const AST& ast, std::string_view source) : ast(ast), source(source) {
+        // Room for the nodes as they are in the arena, and their relocations,
+        // which take about half as much again.
+        size_t arena = ast.arena.bytes_used();
+        image.reserve(ImageStart + arena + arena / 2);
+        image.resize(ImageStart, '\0');
+        relocations.reserve(arena / 16);
+    }
+
+    std::string write(const Diagnostics& diagnostics);
+
+private:
+    size_t size() const { return image.size() - ImageStart; }
+    char* bytes(size_t offset) { return &image[ImageStart + offset]; }
+
+    size_t align(size_t alignment) {
+        image.resize(ImageStart + (size() + alignment - 1) / alignment * alignment, '\0');
+        return size();
+    }
+
+    template <typename T>
+    size_t place(const T& value) {
+        static_assert(std::is_trivially_copyable<T>::value, "images hold nodes as they are in memory");
+        size_t at = align(alignof(T));
+        image.append(reinterpret_cast<const char*>(&value), sizeof(T));
+        return at;
+    }
+
+    // The pointer at `at` refers to image offset `target`.
+    void pointer(size_t at, size_t target) {
+        uintptr_t value = target;
+        std::memcpy(bytes(at), &value, sizeof(value));
+        relocations.push_back(uint64_t(at) << 2 | Pointer);
+    }
+
+    // The string_view at `at` is `text`: kept as a source offset when it is
+    // in the source, and copied into the image otherwise.
+    void view(size_t at, std::string_view text) {
+        if (!text.data()) return;
+        std::less_equal<const char*> less_equal;
+        const char* source_end = source.data() + source.size();
+        uint64_t kind = SourceView;
+        size_t offset;
+        if (source.data() && less_equal(source.data(), text.data()) &&
+            less_equal(text.data() + text.size(), source_end)) {
+            offset = static_cast<size_t>(text.data() - source.data());
+        }
+        else {
+            kind = ImageView;
+            offset = size();
+            image.append(text);
+        }
+        std::string_view encoded(reinterpret_cast<const char*>(uintptr_t(offset)), text.size());
+        std::memcpy(bytes(at), &encoded, sizeof(encoded));
+        relocations.push_back(uint64_t(at) << 2 | kind);
+    }
+
+    // Copies the elements of the Span at `at` and points it at the copies;
+    // each(offset, element) then fixes up what an element refers to.
+    template <typename T, typename Fn>
+    void span(size_t at, Span<T> items, Fn&& each) {
+        size_t data = at + offsetof(Span<T>, data);
+        if (items.empty()) {
+            T* none = nullptr;
+            std::memcpy(bytes(data), &none, sizeof(none));
+            return;
+        }
+        size_t first = align(alignof(T));
+        for (const T& item : items) place(item);
+        pointer(data, first);
+        for (size_t i = 0; i < items.size(); ++i) each(first + i * sizeof(T), items[i]);
+    }
+
+    void body(size_t at, Span<Statement*> statements) {
+        span(at, statements, [&](size_t slot, const Statement* stmt) {
+            if (stmt) pointer(slot, statement(stmt));
+        });
+    }
+
+    void argument(size_t at, const Argument& arg) {
+        view(at + offsetof(Argument, text), arg.text);
+    }
+
+    size_t statement(const Statement* stmt);
+    void expr(size_t at, const Expr* e);
+
+    const AST& ast;
+    std::string_view source;
+    std::string image;
+    std::vector<uint64_t> relocations;
+};
+
+size_t ImageWriter::statement(const Statement* stmt) {
+    switch (stmt->kind) {
+    case NodeKind::Say: {
+        auto say = static_cast<const SayStatement*>(stmt);
+        size_t at = place(*say);
+        span(at + field(say, say->args), say->args, [&](size_t arg, const Argument& a) { argument(arg, a); });
+        view(at + field(say, say->end), say->end);
+        return at;
+    }
+    case NodeKind::Set: {
+        auto set = static_cast<const SetStatement*>(stmt);
+        size_t at = place(*set);
+        expr(at + field(set, set->value), set->value);
+        return at;
+    }
+    case NodeKind::Arithmetic: {
+        auto arithmetic = static_cast<const ArithmeticStatement*>(stmt);
+        size_t at = place(*arithmetic);
+        expr(at + field(arithmetic, arithmetic->operand), arithmetic->operand);
+        return at;
+    }
+    case NodeKind::FunctionCall: {
+        auto call = static_cast<const FunctionCall*>(stmt);
+        size_t at = place(*call);
+        argument(at + field(call, call->arg), call->arg);
+        return at;
+    }
+    case NodeKind::FunctionDef: {
+        auto def = static_cast<const FunctionDef*>(stmt);
+        size_t at = place(*def);
+        body(at + field(def, def->body), def->body);
+        return at;
+    }
+    case NodeKind::StartBlock: {
+        auto start = static_cast<const StartBlock*>(stmt);
+        size_t at = place(*start);
+        body(at + field(start, start->body), start->body);
+        return at;
+    }
+    case NodeKind::If: {
+        auto branch_if = static_cast<const IfStatement*>(stmt);
+        size_t at = place(*branch_if);
+        span(at + field(branch_if, branch_if->branches), branch_if->branches, [&](size_t b, const Branch& branch) {
+            expr(b + offsetof(Branch, condition), branch.condition);
+            body(b + offsetof(Branch, body), branch.body);
+        });
+        body(at + field(branch_if, branch_if->else_body), branch_if->else_body);
+        return at;
+    }
+    case NodeKind::Repeat: {
+        auto repeat = static_cast<const RepeatStatement*>(stmt);
+        size_t at = place(*repeat);
+        expr(at + field(repeat, repeat->count), repeat->count);
+        body(at + field(repeat, repeat->body), repeat->body);
+        return at;
+    }
+    case NodeKind::Import: {
+        auto import = static_cast<const ImportStatement*>(stmt);
+        size_t at = place(*import);
+        view(at + field(import, import->module), import->module);
+        return at;
+    }
+    }
+    return place(*stmt);
+}
+
+// Copies `e` and points the pointer at `at` to it.
+void ImageWriter::expr(size_t at, const Expr* e) {
+    if (!e) return;
+    size_t target;
+    if (auto number = expr_cast<NumberLiteral>(e)) {
+        target = place(*number);
+        view(target + field(number, number->text), number->text);
+    }
+    else if (auto binary = expr_cast<BinaryExpr>(e)) {
+        target = place(*binary);
+        expr(target + field(binary, binary->lhs), binary->lhs);
+        expr(target + field(binary, binary->rhs), binary->rhs);
+    }
+    else {
+        target = place(*static_cast<const VariableRef*>(e));
+    }
+    pointer(at, target);
+}
+
+std::string ImageWriter::write(const Diagnostics& diagnostics) {
+    ImageHeader header{};
+    std::memcpy(header.magic, image_magic, sizeof(header.magic));
+    header.version = AstImageVersion;
+    header.layout = layout_signature();
+    header.source_size = source.size();
+    header.node_count = ast.node_count;
+
+    header.roots = align(alignof(Statement*));
+    header.root_count = ast.statements.size();
+    image.resize(image.size() + ast.statements.size() * sizeof(Statement*), '\0');
+    for (size_t i = 0; i < ast.statements.size(); ++i) {
+        if (ast.statements[i]) pointer(header.roots + i * sizeof(Statement*), statement(ast.statements[i]));
+    }
+
+    header.symbols = align(alignof(uint32_t));
+    header.symbol_count = ast.symbols.size();
+    for (SymbolId id = 1; id <= ast.symbols.size(); ++id) {
+        place(static_cast<uint32_t>(ast.symbols.name(id).size()));
+    }
+    for (SymbolId id = 1; id <= ast.symbols.size(); ++id) image.append(ast.symbols.name(id));
+
+    std::string saved = diagnostics.save();
+    header.diagnostics = size();
+    header.diagnostics_size = saved.size();
+    image += saved;
+
+    header.relocations = align(alignof(uint64_t));
+    header.relocation_count = relocations.size();
+    for (uint64_t relocation : relocations) place(relocation);
+    header.image_size = size();
+    header.image_hash = hash_bytes(std::string_view(image).substr(ImageStart));
+
+    std::memcpy(&image[0], &header, sizeof(header));
+    return std::move(image);
+}
+
+bool within(uint64_t offset, uint64_t count, uint64_t size, uint64_t limit) {
+    return offset <= limit && count <= (limit - offset) / size;
+}
+
+}
+
+std::string save_ast_image(const AST& ast, std::string_view source, const Diagnostics& diagnostics) {
+    return ImageWriter(ast, source).write(diagnostics);
+}
+
+bool load_ast_image(const std::string& path, std::string_view source, AST& ast, Diagnostics& diagnostics) {
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) return false;
+    std::streamoff file_size = in.tellg();
+    if (file_size < static_cast<std::streamoff>(ImageStart)) return false;
+
+    ImageHeader header;
+    in.seekg(0);
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))) return false;
+    uint64_t size = header.image_size;
+    if (std::memcmp(header.magic, image_magic, sizeof(header.magic)) != 0 || header.version != AstImageVersion ||
+        header.layout != layout_signature() || header.source_size != source.size() ||
+        size != static_cast<uint64_t>(file_size) - ImageStart) {
+        return false;
+    }
+    if (!within(header.roots, header.root_count, sizeof(Statement*), size) ||
+        !within(header.symbols, header.symbol_count, sizeof(uint32_t), size) ||
+        !within(header.diagnostics, header.diagnostics_size, 1, size) ||
+        !within(header.relocations, header.relocation_count, sizeof(uint64_t), size) ||
+        header.roots % alignof(Statement*) || header.symbols % alignof(uint32_t) ||
+        header.relocations % alignof(uint64_t)) {
+        return false;
+    }
+
+    // new[] aligns the block for any node, and the image was laid out from
+    // an aligned start.
+    std::unique_ptr<char[]> block(new char[size ? size : 1]);
+    char* base = block.get();
+    in.seekg(ImageStart);
+    if (!in.read(base, static_cast<std::streamsize>(size))) return false;
+    // Nodes are trusted as they are, kind tags, spans and symbol ids alike,
+    // so a damaged image must be caught before anything reads into it.
+    if (hash_bytes(std::string_view(base, size)) != header.image_hash) return false;
+
+    const uint64_t* relocations = reinterpret_cast<const uint64_t*>(base + header.relocations);
+    for (uint64_t i = 0; i < header.relocation_count; ++i) {
+        uint64_t at = relocations[i] >> 2;
+        uint64_t kind = relocations[i] & 3;
+        if (kind == Pointer) {
+            uintptr_t offset;
+            if (!within(at, 1, sizeof(offset), size)) return false;
+            std::memcpy(&offset, base + at, sizeof(offset));
+            if (offset >= size) return false;
+            char* target = base + offset;
+            std::memcpy(base + at, &target, sizeof(target));
+            continue;
+        }
+        std::string_view view;
+        if ((kind != ImageView && kind != SourceView) || !within(at, 1, sizeof(view), size)) return false;
+        std::memcpy(&view, base + at, sizeof(view));
+        uint64_t offset = reinterpret_cast<uintptr_t>(view.data());
+        uint64_t limit = kind == ImageView ? size : source.size();
+        if (!within(offset, view.size(), 1, limit)) return false;
+        const char* text = kind == ImageView ? base : source.data();
+        view = std::string_view(text ? text + offset : text, view.size());
+        std::memcpy(base + at, &view, sizeof(view));
+    }
+
+    // Names were interned in id order, so interning them again gives the
+    // same ids.
+    Interner symbols;
+    uint64_t name = header.symbols + header.symbol_count * sizeof(uint32_t);
+    for (uint64_t i = 0; i < header.symbol_count; ++i) {
+        uint32_t length;
+        std::memcpy(&length, base + header.symbols + i * sizeof(uint32_t), sizeof(length));
+        if (!within(name, length, 1, size) || symbols.intern(std::string_view(base + name, length)) != i + 1) {
+            return false;
+        }
+        name += length;
+    }
+
+    Diagnostics found;
+    if (!found.load(std::string_view(base + header.diagnostics, header.diagnostics_size))) return false;
+
+    std::vector<Statement*> statements(header.root_count);
+    if (!statements.empty()) {
+        std::memcpy(statements.data(), base + header.roots, statements.size() * sizeof(Statement*));
+    }
+
+    ast.arena.adopt(std::move(block), size);
+    ast.symbols = std::move(symbols);
+    ast.statements = std::move(statements);
+    ast.node_count = header.node_count;
+    diagnostics.append(found);
+    return true;
+}
@@ -0,0 +1,38 @@
+// astimage.hpp - On-disk image of an analyzed AST, loaded back in place
+#pragma once
+#include "ast.hpp"
+#include "diagnostics.hpp"
+#include <string>
+#include <string_view>
+
+// Bump whenever the layout below or any node struct changes.
+constexpr uint32_t AstImageVersion = 5;
+
+// An image is a header followed by the nodes exactly as they sit in memory,
+// so loading is one read into a single arena block plus a relocation pass,
+// with nothing parsed or allocated per node:
+//
+//   header      magic, version, a signature of the node layouts and pointer
+//               width, the source size, a hash of everything after the
+//               header, and where the sections below start
+//   roots       the top-level statements, in order
+//   nodes       every Statement, Expr, Argument, Branch and Span array, with
+//               pointers stored as offsets into the image, and the text of
+//               literals that are not in the source, such as those the
+//               optimizer folded
+//   symbols     the length of each interned name, by id, then the names
+//   diagnostics the warnings the front end reported, as Diagnostics::save()
+//   relocations one word per pointer: its offset, and whether it points into
+//               the image or into the source
+//
+// Literals that view the source are kept as source offsets, so a loaded AST
+// views the buffer it was loaded against, as a parsed one would. Images are
+// only valid for the same source bytes and compiler build; anything that does
+// not match, including the hash of the image, or is out of bounds, makes the
+// load fail.
+std::string save_ast_image(const AST& ast, std::string_view source, const Diagnostics& diagnostics);
+
+// Loads the image at `path` into `ast`, which must be empty, against
+// `source`, and replays its diagnostics into `diagnostics`. Returns false,
+// touching neither, if there is no usable image.
+bool load_ast_image(const std::string& path, std::string_view source, AST& ast, Diagnostics& diagnostics);
@@ -0,0 +1,218 @@
+// build.cpp - hcp build: generate, compile and link in one step
+#include "build.hpp"
+#include "cache.hpp"
+#include "output.hpp"
+#include "version.hpp"
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+static constexpr const char* pipe_mode = "wb";
+#else
+static constexpr const char* pipe_mode = "w";
+#endif
+
+namespace fs = std::filesystem;
+
+// Double quotes work for both sh and cmd.exe as long as the path has none.
+static std::string quote(const std::string& path) {
+    return "\"" + path + "\"";
+}
+
+static std::string read_text(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+// Runs `command` with stderr captured to `log`, feeding it `input` on stdin
+// when given. Whatever it printed is recorded into `diag` as a note. The
+// caller ignores SIGPIPE, so a tool that exits without reading all of its
+// input is a short write here rather than the end of hcp.
+static bool run_tool(const std::string& command, const std::string& log, const std::string* input,
+    Diagnostics& diag) {
+    std::string full = command + " 2> " + quote(log);
+    bool ok;
+    bool written = true;
+    if (input) {
+        std::FILE* pipe = popen(full.c_str(), pipe_mode);
+        if (!pipe) {
+            std::error_code ec;
+            fs::remove(log, ec);
+            diag.error(DiagCode::Tool, 0, 0, "Cannot run: " + command);
+            return false;
+        }
+        written = std::fwrite(input->data(), 1, input->size(), pipe) == input->size();
+        written = std::fflush(pipe) == 0 && written;
+        ok = pclose(pipe) == 0 && written;
+    }
+    else {
+        ok = std::system(full.c_str()) == 0;
+    }
+
+    std::string printed = read_text(log);
+    if (!printed.empty()) diag.note(DiagCode::ToolOutput, printed);
+    std::error_code ec;
+    fs::remove(log, ec);
+    if (!written) diag.error(DiagCode::Tool, 0, 0, "Exited before reading all of its input: " + command);
+    return ok;
+}
+
+// Compiles generated `source` into a cached object, named in `object`.
+static bool compile_object(const std::string& source, const std::string& compile, const std::string& cxx,
+    const std::string& object_dir, Diagnostics& diag, CompileStats* stats, std::string& object) {
+    // The object depends on the generated code and on exactly how it is compiled.
+    uint64_t key = hash_bytes(source, hash_bytes(compile + " hcp " HCP_VERSION));
+    char name[32];
+    std::snprintf(name, sizeof name, "%016llx", static_cast<unsigned long long>(key));
+    object = (fs::path(object_dir) / (std::string(name) + ".o")).string();
+
+    std::error_code ec;
+    if (fs::exists(object, ec)) {
+        if (stats) stats->cache_hit = true;
+        return true;
+    }
+
+    PhaseTimer timer(stats, "cxx");
+    // Unique to this call, then renamed into place, so concurrent builds
+    // never see a half-written object.
+    std::string temp = object + temp_suffix();
+    std::string command = compile + " -x c++ -c - -o " + quote(temp);
+    if (!run_tool(command, temp + ".log", &source, diag)) {
+        fs::remove(temp, ec);
+        diag.error(DiagCode::Tool, 0, 0, cxx + " failed on the generated code");
+        return false;
+    }
+    fs::rename(temp, object, ec);
+    if (ec) {
+        fs::remove(temp, ec);
+        diag.error(DiagCode::Tool, 0, 0, "Cannot write object file: " + object);
+        return false;
+    }
+    return true;
+}
+
+namespace {
+
+// The objects of the modules a batch imports, each built once, by the
+// first job that needs it.
+class ModuleObjects {
+public:
+    struct Entry {
+        std::once_flag built;
+        bool ok = false;
+        std::string object;
+    };
+
+    Entry& operator[](const std::string& path) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::unique_ptr<Entry>& entry = entries[path];
+        if (!entry) entry = std::make_unique<Entry>();
+        return *entry;
+    }
+
+private:
+    std::mutex mutex;
+    std::unordered_map<std::string, std::unique_ptr<Entry>> entries;
+};
+
+}
+
+// Builds the object of every module `imports` links with. The job that
+// builds one reports its diagnostics.
+static bool build_modules(const ImportSet& imports, const CompileOptions& options, const std::string& compile,
+    const std::string& cxx, const std::string& object_dir, ModuleObjects& modules, Diagnostics& diag,
+    std::vector<std::string>& objects) {
+    bool ok = true;
+    for (const std::string& path : imports.modules) {
+        ModuleObjects::Entry& module = modules[path];
+        std::call_once(module.built, [&]() {
+            Diagnostics found(options.diagnostics);
+            StringSink source;
+            module.ok = generate_source(path, options, source, found) &&
+                compile_object(source.str(), compile, cxx, object_dir, found, nullptr, module.object);
+            diag.append(found);
+        });
+        if (!module.ok) {
+            diag.error(DiagCode::Tool, 0, 0, "Cannot build module " + path);
+            ok = false;
+            continue;
+        }
+        objects.push_back(module.object);
+    }
+    return ok;
+}
+
+static bool build_one(const CompileJob& job, const CompileOptions& options, const std::string& cxx,
+    const BuildOptions& build, const std::string& object_dir, ModuleObjects& modules, Diagnostics& diag,
+    CompileStats* stats) {
+    StringSink source;
+    ImportSet imports;
+    if (!generate_source(job.input, options, source, diag, stats, &imports)) return false;
+
+    std::string compile = cxx + " -std=c++20 " + build.cxxflags;
+    std::vector<std::string> objects(1);
+    if (!compile_object(source.str(), compile, cxx, object_dir, diag, stats, objects[0])) return false;
+    if (!build_modules(imports, options, compile, cxx, object_dir, modules, diag, objects)) return false;
+
+    PhaseTimer timer(stats, "link");
+    std::string command = cxx + " " + build.cxxflags;
+    for (const std::string& object : objects) command += " " + quote(object);
+    command += " -o " + quote(job.output);
+    // Named after the output, which is the job's own: inputs that generate
+    // the same code share their object, and would share a log named after it.
+    if (!run_tool(command, job.output + ".link.log", nullptr, diag)) {
+        diag.error(DiagCode::Tool, 0, 0, "Linking " + job.output + " failed");
+        return false;
+    }
+    return true;
+}
+
+size_t build_batch(const std::vector<CompileJob>& jobs, const CompileOptions& options,
+    const BuildOptions& build, unsigned threads, std::vector<CompileStats>* stats) {
+    std::string cxx = build.cxx;
+    if (cxx.empty()) {
+        const char* env = std::getenv("CXX");
+        cxx = env && *env ? env : "c++";
+    }
+    std::string object_dir = !build.object_dir.empty() ? build.object_dir
+                           : !options.cache_dir.empty() ? options.cache_dir
+                           : ".hcp-cache";
+    std::error_code ec;
+    fs::create_directories(object_dir, ec);
+
+    // The host compiler only reads C++.
+    CompileOptions generate = options;
+    generate.backend = Backend::Cpp;
+
+    ModuleObjects modules;
+    if (stats) stats->assign(jobs.size(), CompileStats());
+#ifndef _WIN32
+    // Process-wide, since every worker writes to a pipe; see run_tool().
+    auto previous_sigpipe = std::signal(SIGPIPE, SIG_IGN);
+#endif
+    size_t failures = for_each_job(jobs, threads, options.diagnostics, [&](size_t i, Diagnostics& diag) {
+        return build_one(jobs[i], generate, cxx, build, object_dir, modules, diag, stats ? &(*stats)[i] : nullptr);
+    });
+#ifndef _WIN32
+    std::signal(SIGPIPE, previous_sigpipe);
+#endif
+    return failures;
+}
+
+std::string default_executable_path(const std::string& input) {
+#ifdef _WIN32
+    return default_output_path(input, ".exe");
+#else
+    return default_output_path(input, "");
+#endif
+}
@@ -0,0 +1,25 @@
+// build.hpp - hcp build: generate, compile and link in one step
+#pragma once
+#include "driver.hpp"
+#include <string>
+#include <vector>
+
+struct BuildOptions {
+    // Host compiler, invoked with GCC-style flags. Empty means $CXX, else c++.
+    std::string cxx;
+    std::string cxxflags = "-O2";
+    // Object files are cached here, keyed by generated source and compiler
+    // command. Empty means CompileOptions::cache_dir, else .hcp-cache.
+    std::string object_dir;
+};
+
+// Builds each job's input into the executable job.output on `threads`
+// workers. Generated C++ is piped to the compiler's stdin, so no source file
+// is written; only the linked executable and the cached object are. Compiler
+// output is reported with the job's own diagnostics. Returns the number of
+// failures.
+size_t build_batch(const std::vector<CompileJob>& jobs, const CompileOptions& options,
+    const BuildOptions& build, unsigned threads, std::vector<CompileStats>* stats = nullptr);
+
+// in.herc -> in, or in.exe on Windows
+std::string default_executable_path(const std::string& input);
@@ -0,0 +1,160 @@
+// cache.cpp - On-disk cache of generated code keyed by source content
+#include "cache.hpp"
+#include "source.hpp"
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <system_error>
+#include <thread>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+static uint64_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+uint64_t hash_bytes(std::string_view data, uint64_t seed) {
+    const uint64_t k = 0x9e3779b97f4a7c15ULL;
+    uint64_t h = seed ^ (data.size() * k);
+    size_t i = 0;
+    for (; i + 8 <= data.size(); i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data.data() + i, 8);
+        h = (h ^ mix(word)) * k;
+    }
+    uint64_t tail = 0;
+    for (size_t shift = 0; i < data.size(); ++i, shift += 8) {
+        tail |= static_cast<uint64_t>(static_cast<unsigned char>(data[i])) << shift;
+    }
+    return mix(h ^ mix(tail));
+}
+
+std::string CompileCache::key_path(uint64_t key, const char* extension) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx%s", static_cast<unsigned long long>(key), extension);
+    return (fs::path(dir) / name).string();
+}
+
+std::string CompileCache::entry_path(uint64_t key) const {
+    return key_path(key, ".cpp");
+}
+
+bool CompileCache::lookup(uint64_t key, std::string& diagnostics) const {
+    std::error_code ec;
+    if (!fs::is_regular_file(entry_path(key), ec)) return false;
+
+    std::ifstream in(key_path(key, ".diag"), std::ios::binary);
+    if (!in) return false;
+    diagnostics.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+std::string temp_suffix() {
+    static std::atomic<unsigned> counter{ 0 };
+    char suffix[80];
+    std::snprintf(suffix, sizeof(suffix), ".%ld.%zx.%u.tmp", static_cast<long>(getpid()),
+        std::hash<std::thread::id>()(std::this_thread::get_id()), counter++);
+    return suffix;
+}
+
+std::string CompileCache::temp_path(uint64_t key) const {
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    return key_path(key, temp_suffix().c_str());
+}
+
+bool CompileCache::store(uint64_t key, const std::string& temp, const std::string& diagnostics) const {
+    // The .diag file goes first: lookup() treats an entry without one as a miss.
+    std::string diag_temp = temp + ".diag";
+    {
+        std::ofstream out(diag_temp, std::ios::binary);
+        out << diagnostics;
+        if (!out) return false;
+    }
+
+    std::error_code ec;
+    fs::rename(diag_temp, key_path(key, ".diag"), ec);
+    if (!ec) fs::rename(temp, entry_path(key), ec);
+    if (ec) {
+        fs::remove(diag_temp, ec);
+        fs::remove(temp, ec);
+        return false;
+    }
+    return true;
+}
+
+std::string CompileCache::image_path(uint64_t key) const {
+    return key_path(key, ".ast");
+}
+
+std::string CompileCache::interface_path(uint64_t key) const {
+    return key_path(key, ".hci");
+}
+
+std::string CompileCache::imports_path(uint64_t key) const {
+    return key_path(key, ".imports");
+}
+
+bool CompileCache::store_file(const std::string& path, const std::string& bytes) const {
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    std::string temp = path + temp_suffix();
+    {
+        std::ofstream out(temp, std::ios::binary);
+        out << bytes;
+        if (!out) {
+            out.close();
+            fs::remove(temp, ec);
+            return false;
+        }
+    }
+
+    fs::rename(temp, path, ec);
+    if (ec) {
+        fs::remove(temp, ec);
+        return false;
+    }
+    return true;
+}
+
+bool CompileCache::read_file(const std::string& path, std::string& bytes) const {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return !in.bad();
+}
+
+bool install_file(const std::string& from, const std::string& to) {
+    SourceBuffer cached;
+    if (!cached.open(from)) return false;
+
+    if (to == "-") {
+        std::string_view bytes = cached.view();
+        return std::fwrite(bytes.data(), 1, bytes.size(), stdout) == bytes.size() && std::fflush(stdout) == 0;
+    }
+
+    {
+        SourceBuffer existing;
+        if (existing.open(to) && existing.view() == cached.view()) return true;
+    }
+
+    std::error_code ec;
+    fs::copy_file(from, to, fs::copy_options::overwrite_existing, ec);
+    return !ec;
+}
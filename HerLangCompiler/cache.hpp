@@ -0,0 +1,59 @@
+// cache.hpp - On-disk cache of generated code keyed by source content
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Fast non-cryptographic 64-bit hash; good enough to key a local cache.
+uint64_t hash_bytes(std::string_view data, uint64_t seed = 0);
+
+// Entries live in one directory as <key>.cpp plus <key>.diag holding the
+// warnings the compilation produced, so a hit can replay them. The front end
+// keeps its analyzed ASTs next to them as <key>.ast images, under keys of its
+// own, and the import system its module interfaces (.hci) and the imports
+// each importing file had (.imports). Entries are published with an atomic rename, so concurrent compilers
+// never observe a partial file.
+class CompileCache {
+public:
+    explicit CompileCache(std::string dir) : dir(std::move(dir)) {}
+
+    // True if `key` is cached; its recorded diagnostics go to `diagnostics`.
+    bool lookup(uint64_t key, std::string& diagnostics) const;
+
+    std::string entry_path(uint64_t key) const;
+
+    // Unique scratch file in the cache directory to generate into.
+    std::string temp_path(uint64_t key) const;
+
+    // Moves a finished temp file into place as the entry for `key`.
+    bool store(uint64_t key, const std::string& temp, const std::string& diagnostics) const;
+
+    // The AST image for `key`, see astimage.hpp.
+    std::string image_path(uint64_t key) const;
+
+    // The interface of the module with content key `key`, see modules.hpp.
+    std::string interface_path(uint64_t key) const;
+
+    // The imports of the file whose entries are under `key`.
+    std::string imports_path(uint64_t key) const;
+
+    // Publishes `bytes` as the file at `path`, one of the paths above.
+    bool store_file(const std::string& path, const std::string& bytes) const;
+
+    // Reads the file at `path` whole; false if there is none.
+    bool read_file(const std::string& path, std::string& bytes) const;
+
+private:
+    std::string key_path(uint64_t key, const char* extension) const;
+
+    std::string dir;
+};
+
+// A suffix for a scratch file that no other call, thread or process sharing
+// the directory is given: it holds the process id, the thread and a count.
+std::string temp_suffix();
+
+// Copies `from` to `to` unless `to` already holds identical bytes, in which
+// case it is left untouched so its mtime does not trigger downstream rebuilds.
+// "-" copies to stdout.
+bool install_file(const std::string& from, const std::string& to);
@@ -0,0 +1,60 @@
+// callgraph.cpp - Function call graph over a parsed AST
+#include "callgraph.hpp"
+
+static constexpr size_t undefined = ~size_t(0);
+
+// Appends the index of every defined function `body` calls, nested blocks
+// included. `by_name` maps each SymbolId to its function, or `undefined`.
+static void collect_calls(Span<Statement*> body, const std::vector<size_t>& by_name,
+                          std::vector<size_t>& callees) {
+    for (auto stmt : body) {
+        if (auto call = node_cast<FunctionCall>(stmt)) {
+            if (by_name[call->name] != undefined) callees.push_back(by_name[call->name]);
+        }
+        for_each_body(stmt, [&](Span<Statement*> inner) { collect_calls(inner, by_name, callees); });
+    }
+}
+
+CallGraph::CallGraph(const AST& ast) {
+    std::vector<size_t> by_name(ast.symbols.size() + 1, undefined);
+    for (auto stmt : ast.statements) {
+        if (auto func = node_cast<FunctionDef>(stmt)) {
+            by_name[func->name] = functions.size();
+            index.emplace(func, functions.size());
+            functions.push_back(func);
+        }
+    }
+
+    nodes.resize(functions.size());
+    std::vector<size_t> worklist;
+    for (size_t i = 0; i < functions.size(); ++i) {
+        collect_calls(functions[i]->body, by_name, nodes[i].callees);
+    }
+    for (auto stmt : ast.statements) {
+        if (auto start = node_cast<StartBlock>(stmt)) collect_calls(start->body, by_name, worklist);
+    }
+
+    while (!worklist.empty()) {
+        size_t i = worklist.back();
+        worklist.pop_back();
+        if (nodes[i].reachable) continue;
+        nodes[i].reachable = true;
+        ++reached;
+        worklist.insert(worklist.end(), nodes[i].callees.begin(), nodes[i].callees.end());
+    }
+}
+
+size_t CallGraph::index_of(const FunctionDef* func) const {
+    auto it = index.find(func);
+    return it == index.end() ? nodes.size() : it->second;
+}
+
+bool CallGraph::reachable(const FunctionDef* func) const {
+    size_t i = index_of(func);
+    return i < nodes.size() && nodes[i].reachable;
+}
+
+bool CallGraph::is_leaf(const FunctionDef* func) const {
+    size_t i = index_of(func);
+    return i < nodes.size() && nodes[i].callees.empty();
+}
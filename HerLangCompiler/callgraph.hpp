@@ -0,0 +1,31 @@
+// callgraph.hpp - Function call graph over a parsed AST
+#pragma once
+#include "ast.hpp"
+#include <unordered_map>
+#include <vector>
+
+// Which functions call which, and which of them the start block can reach,
+// directly or through other functions. Calls to names with no definition
+// are ignored; the C++ compiler reports those.
+class CallGraph {
+public:
+    explicit CallGraph(const AST& ast);
+
+    bool reachable(const FunctionDef* func) const;
+    // A leaf calls no other function.
+    bool is_leaf(const FunctionDef* func) const;
+    size_t reachable_count() const { return reached; }
+
+private:
+    struct Node {
+        std::vector<size_t> callees;
+        bool reachable = false;
+    };
+
+    size_t index_of(const FunctionDef* func) const;
+
+    std::vector<const FunctionDef*> functions;
+    std::vector<Node> nodes;
+    std::unordered_map<const FunctionDef*, size_t> index;
+    size_t reached = 0;
+};
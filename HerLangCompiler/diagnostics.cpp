@@ -0,0 +1,300 @@
+// diagnostics.cpp - Structured warnings and errors, rendered on demand
+#include "diagnostics.hpp"
+#include "utils.hpp"
+#include <charconv>
+#include <ostream>
+#include <sstream>
+
+namespace {
+
+// How a code reads in text output.
+enum class Layout : uint8_t {
+    Located,  // [Warning] Line 3: message   ([Warning] EOF: message without a line)
+    AtLine,   // [Error] message at line 3
+    Plain,    // [Error] message
+    Bare      // message, as printed by the tool or the driver
+};
+
+struct CodeInfo {
+    const char* name;
+    Layout layout;
+};
+
+const CodeInfo code_info[] = {
+    { "unmatched-end", Layout::Located },
+    { "end-indent", Layout::Located },
+    { "unmatched-branch", Layout::Located },
+    { "branch-indent", Layout::Located },
+    { "body-indent", Layout::Located },
+    { "unclosed-block", Layout::Located },
+    { "unterminated-string", Layout::AtLine },
+    { "syntax", Layout::AtLine },
+    { "unexpected-eof", Layout::Plain },
+    { "unknown-variable", Layout::AtLine },
+    { "unknown-function", Layout::AtLine },
+    { "wrong-arguments", Layout::AtLine },
+    { "program-structure", Layout::AtLine },
+    { "import", Layout::AtLine },
+    { "runtime", Layout::AtLine },
+    { "io", Layout::Bare },
+    { "tool", Layout::Plain },
+    { "tool-output", Layout::Bare },
+    { "request", Layout::Plain },
+    { "internal", Layout::Plain },
+};
+
+static_assert(sizeof(code_info) / sizeof(*code_info) == static_cast<size_t>(DiagCode::Count),
+    "one entry per DiagCode");
+
+const CodeInfo& info(DiagCode code) {
+    return code_info[static_cast<size_t>(code)];
+}
+
+const char* severity_name(Severity severity) {
+    switch (severity) {
+    case Severity::Note: return "note";
+    case Severity::Warning: return "warning";
+    case Severity::Error: return "error";
+    }
+    return "error";
+}
+
+// The message alone, without severity or location.
+void write_message(std::ostream& out, const Diagnostic& d, std::string_view text) {
+    switch (d.code) {
+    case DiagCode::UnmatchedEnd:
+        out << "'end' without matching block start.";
+        break;
+    case DiagCode::EndIndent:
+        out << "'end' indentation mismatch. Expected " << d.expected << " spaces but got " << d.got << ".";
+        break;
+    case DiagCode::UnmatchedBranch:
+        out << "'" << text << "' without matching 'if'.";
+        break;
+    case DiagCode::BranchIndent:
+        out << "'" << text << "' indentation mismatch. Expected " << d.expected << " spaces but got " << d.got << ".";
+        break;
+    case DiagCode::BodyIndent:
+        out << "Inconsistent indentation. Expected greater than " << d.expected << " spaces but got " << d.got << ".";
+        break;
+    case DiagCode::UnclosedBlock:
+        out << "Some blocks not closed properly (missing 'end').";
+        break;
+    default:
+        out << text;
+        break;
+    }
+}
+
+std::string message_of(const Diagnostic& d, std::string_view text) {
+    if (!is_warning_code(d.code)) return std::string(text);
+    std::ostringstream out;
+    write_message(out, d, text);
+    return out.str();
+}
+
+}
+
+const char* diag_code_name(DiagCode code) {
+    return info(code).name;
+}
+
+bool find_diag_code(std::string_view name, DiagCode& code) {
+    for (size_t i = 0; i < static_cast<size_t>(DiagCode::Count); ++i) {
+        if (name == code_info[i].name) {
+            code = static_cast<DiagCode>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool is_warning_code(DiagCode code) {
+    return code <= DiagCode::UnclosedBlock;
+}
+
+std::string format_error(DiagCode code, int line, const std::string& message) {
+    if (info(code).layout != Layout::AtLine || line <= 0) return message;
+    return message + " at line " + std::to_string(line);
+}
+
+CompileError::CompileError(DiagCode code, int line, int column, const std::string& message)
+    : std::runtime_error(format_error(code, line, message)), code(code), line(line), column(column),
+      message(message) {}
+
+Diagnostics::Diagnostics(DiagnosticOptions options) : options(options) {}
+
+void Diagnostics::set_file(std::string_view path) {
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (files[i] == path) {
+            current_file = static_cast<uint32_t>(i);
+            return;
+        }
+    }
+    current_file = static_cast<uint32_t>(files.size());
+    files.emplace_back(path);
+}
+
+std::string_view Diagnostics::file(const Diagnostic& d) const {
+    return d.file < files.size() ? std::string_view(files[d.file]) : std::string_view();
+}
+
+void Diagnostics::record(Diagnostic d, std::string_view text) {
+    if (d.severity == Severity::Warning) {
+        if (options.is_suppressed(d.code)) return;
+        if (options.warnings_as_errors) d.severity = Severity::Error;
+    }
+    // Most compilations report nothing; the first report makes room for
+    // plenty, so a noisy file does not reallocate per line.
+    if (entries.capacity() == 0) {
+        entries.reserve(64);
+        pool.reserve(1024);
+    }
+    d.text = static_cast<uint32_t>(pool.size());
+    d.text_size = static_cast<uint32_t>(text.size());
+    pool += text;
+
+    if (d.severity == Severity::Error) ++error_count;
+    else if (d.severity == Severity::Warning) ++warning_count;
+    entries.push_back(d);
+}
+
+void Diagnostics::warning(DiagCode code, int line, int column, int expected, int got, std::string_view text) {
+    record({ code, Severity::Warning, current_file, line, column, expected, got, 0, 0 }, text);
+}
+
+void Diagnostics::error(DiagCode code, int line, int column, std::string_view message) {
+    record({ code, Severity::Error, current_file, line, column, 0, 0, 0, 0 }, message);
+}
+
+void Diagnostics::note(DiagCode code, std::string_view text) {
+    record({ code, Severity::Note, current_file, 0, 0, 0, 0, 0, 0 }, text);
+}
+
+void Diagnostics::append(const Diagnostics& other) {
+    uint32_t own_file = current_file;
+    bool own_files = !files.empty();
+    for (const Diagnostic& d : other.entries) {
+        Diagnostic copy = d;
+        if (d.file < other.files.size()) {
+            set_file(other.files[d.file]);
+            copy.file = current_file;
+        }
+        else {
+            copy.file = own_file;
+        }
+        record(copy, other.text(d));
+    }
+    if (own_files) current_file = own_file;
+}
+
+void Diagnostics::print(std::ostream& out) {
+    if (options.format == DiagnosticFormat::Json) print_json(out, printed);
+    else print_text(out, printed);
+    printed = entries.size();
+}
+
+void Diagnostics::print_text(std::ostream& out, size_t first) const {
+    for (size_t i = first; i < entries.size(); ++i) {
+        const Diagnostic& d = entries[i];
+        std::string_view body = text(d);
+        Layout layout = info(d.code).layout;
+        if (layout == Layout::Bare) {
+            out << body;
+            if (d.code != DiagCode::ToolOutput) out << "\n";
+            continue;
+        }
+
+        if (d.severity == Severity::Error) out << "[Error] ";
+        else if (d.severity == Severity::Warning) out << "[Warning] ";
+        else out << "[Note] ";
+        if (layout == Layout::Located) {
+            if (d.line > 0) out << "Line " << d.line << ": ";
+            else out << "EOF: ";
+        }
+        write_message(out, d, body);
+        if (layout == Layout::AtLine && d.line > 0) out << " at line " << d.line;
+        out << "\n";
+    }
+}
+
+void Diagnostics::print_json(std::ostream& out, size_t first) const {
+    for (size_t i = first; i < entries.size(); ++i) {
+        const Diagnostic& d = entries[i];
+        std::string_view path = file(d);
+        out << "{\"file\":";
+        if (d.file >= files.size()) out << "null";
+        else out << "\"" << json_escape(path) << "\"";
+        out << ",\"line\":";
+        if (d.line > 0) out << d.line;
+        else out << "null";
+        out << ",\"column\":";
+        if (d.column > 0) out << d.column;
+        else out << "null";
+        out << ",\"severity\":\"" << severity_name(d.severity) << "\",\"code\":\"" << diag_code_name(d.code)
+            << "\",\"message\":\"" << json_escape(message_of(d, text(d))) << "\"}\n";
+    }
+}
+
+// "hcp-diag 1" on the first line, then one line of fields per diagnostic,
+// directly followed by the bytes of its text and a newline.
+static const char save_header[] = "hcp-diag 1\n";
+
+std::string Diagnostics::save() const {
+    std::string out = save_header;
+    for (const Diagnostic& d : entries) {
+        out += std::to_string(static_cast<unsigned>(d.code)) + " " + std::to_string(static_cast<unsigned>(d.severity)) +
+            " " + std::to_string(d.line) + " " + std::to_string(d.column) + " " + std::to_string(d.expected) + " " +
+            std::to_string(d.got) + " " + std::to_string(d.text_size) + "\n";
+        out += text(d);
+        out += '\n';
+    }
+    return out;
+}
+
+bool Diagnostics::load(std::string_view data) {
+    std::string_view header(save_header, sizeof(save_header) - 1);
+    if (data.substr(0, header.size()) != header) return false;
+
+    struct Loaded {
+        Diagnostic d;
+        std::string_view text;
+    };
+    std::vector<Loaded> loaded;
+    const char* p = data.data() + header.size();
+    const char* end = data.data() + data.size();
+    while (p != end) {
+        long long fields[7];
+        for (long long& field : fields) {
+            while (p != end && *p == ' ') ++p;
+            auto [next, ec] = std::from_chars(p, end, field);
+            if (ec != std::errc()) return false;
+            p = next;
+        }
+        if (p == end || *p != '\n') return false;
+        ++p;
+
+        size_t size = static_cast<size_t>(fields[6]);
+        if (fields[0] < 0 || fields[0] >= static_cast<long long>(DiagCode::Count) || fields[1] < 0 ||
+            fields[1] > static_cast<long long>(Severity::Error) || fields[6] < 0 ||
+            static_cast<size_t>(end - p) < size + 1 || p[size] != '\n') {
+            return false;
+        }
+        Diagnostic d{ static_cast<DiagCode>(fields[0]), static_cast<Severity>(fields[1]), current_file,
+            static_cast<int>(fields[2]), static_cast<int>(fields[3]), static_cast<int>(fields[4]),
+            static_cast<int>(fields[5]), 0, 0 };
+        loaded.push_back({ d, std::string_view(p, size) });
+        p += size + 1;
+    }
+
+    for (const Loaded& entry : loaded) record(entry.d, entry.text);
+    return true;
+}
+
+void Diagnostics::clear() {
+    entries.clear();
+    pool.clear();
+    error_count = 0;
+    warning_count = 0;
+    printed = 0;
+}
@@ -0,0 +1,160 @@
+// diagnostics.hpp - Structured warnings and errors, rendered on demand
+#pragma once
+#include <cstdint>
+#include <iosfwd>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum class Severity : uint8_t {
+    Note,
+    Warning,
+    Error
+};
+
+// What a diagnostic is about. The names in the comments are how tools and
+// -Wno-<name> refer to them, and do not change.
+enum class DiagCode : uint8_t {
+    // Warnings, from the indentation checker.
+    UnmatchedEnd,        // unmatched-end: 'end' with no block open
+    EndIndent,           // end-indent: 'end' not lined up with its block
+    UnmatchedBranch,     // unmatched-branch: 'elif' or 'else' with no 'if' open
+    BranchIndent,        // branch-indent: 'elif' or 'else' not lined up with its 'if'
+    BodyIndent,          // body-indent: a block body not indented past its opener
+    UnclosedBlock,       // unclosed-block: blocks still open at end of file
+
+    // Errors.
+    UnterminatedString,  // unterminated-string
+    Syntax,              // syntax
+    UnexpectedEof,       // unexpected-eof: end of file inside a block
+    UnknownVariable,     // unknown-variable: used before 'set', or never set
+    UnknownFunction,     // unknown-function
+    WrongArguments,      // wrong-arguments: a call that does not match the definition
+    ProgramStructure,    // program-structure: missing, repeated or nested blocks
+    Import,              // import: a module that cannot be found or imported
+    Runtime,             // runtime: a program failed under 'hcp run'
+    Io,                  // io: a file could not be read or written
+    Tool,                // tool: the C++ compiler or linker failed
+    ToolOutput,          // tool-output: what it printed, as a note
+    Request,             // request: a malformed server request
+    Internal,            // internal: anything else
+
+    Count
+};
+
+// "end-indent" and so on.
+const char* diag_code_name(DiagCode code);
+
+// Looks a code up by name; false when there is none.
+bool find_diag_code(std::string_view name, DiagCode& code);
+
+// Only warnings can be suppressed or promoted.
+bool is_warning_code(DiagCode code);
+
+// The way errors read in text output: `message` followed by " at line N"
+// for the codes that carry one.
+std::string format_error(DiagCode code, int line, const std::string& message);
+
+enum class DiagnosticFormat : uint8_t {
+    Text,  // "[Warning] Line 3: ..." lines, as hcp has always printed them
+    Json   // one JSON object per diagnostic and line
+};
+
+struct DiagnosticOptions {
+    bool warnings_as_errors = false;  // -Werror
+    uint64_t suppressed = 0;          // one bit per DiagCode, from -Wno-<name>
+    DiagnosticFormat format = DiagnosticFormat::Text;
+
+    void suppress(DiagCode code) { suppressed |= uint64_t(1) << static_cast<unsigned>(code); }
+    bool is_suppressed(DiagCode code) const { return suppressed >> static_cast<unsigned>(code) & 1; }
+};
+
+static_assert(static_cast<unsigned>(DiagCode::Count) <= 64, "DiagnosticOptions::suppressed has a bit per code");
+
+// One recorded diagnostic. Nothing is formatted until it is printed; the
+// only text kept is what cannot be rebuilt from the fields, such as a
+// variable name, in the engine's pool.
+struct Diagnostic {
+    DiagCode code;
+    Severity severity;  // after -Werror
+    uint32_t file;      // index into the engine's files
+    int line;           // 0 when it has none, as at end of file
+    int column;         // 1-based; 0 when unknown
+    int expected;       // indentation warnings: the indentation wanted...
+    int got;            // ...and found
+    uint32_t text;      // offset and size in the pool
+    uint32_t text_size;
+};
+
+// Collects the diagnostics of one compilation, or of a batch, and renders
+// them as text or JSON lines when asked to. Suppressed warnings are dropped
+// as they come in and -Werror applies as they are recorded, so counts and
+// output always agree with the options. Entries and their text go into two
+// arrays that are only allocated on the first report, then with room for 64
+// entries, so a clean compilation allocates nothing. Not thread-safe: a
+// batch gives each job its own.
+class Diagnostics {
+public:
+    explicit Diagnostics(DiagnosticOptions options = {});
+
+    // Diagnostics recorded from now on are about `path`.
+    void set_file(std::string_view path);
+
+    // `text` is the 'elif' or 'else' of the branch codes. Columns are 1-based,
+    // and 0 when unknown.
+    void warning(DiagCode code, int line, int column, int expected = 0, int got = 0, std::string_view text = {});
+    void error(DiagCode code, int line, int column, std::string_view message);
+    void note(DiagCode code, std::string_view text);
+
+    // Records everything in `other`, under this engine's options, as if it
+    // had been reported here.
+    void append(const Diagnostics& other);
+
+    size_t errors() const { return error_count; }
+    size_t warnings() const { return warning_count; }
+    bool empty() const { return entries.empty(); }
+    const std::vector<Diagnostic>& all() const { return entries; }
+
+    std::string_view text(const Diagnostic& d) const { return std::string_view(pool).substr(d.text, d.text_size); }
+    std::string_view file(const Diagnostic& d) const;
+
+    // Prints what has been recorded since the last print(), in the format
+    // the options ask for.
+    void print(std::ostream& out);
+    void print_text(std::ostream& out, size_t first = 0) const;
+    void print_json(std::ostream& out, size_t first = 0) const;
+
+    // A compact form for the compile cache, without the file names; load()
+    // records what it reads as if reported, and returns false on data it
+    // does not understand, recording nothing.
+    std::string save() const;
+    bool load(std::string_view data);
+
+    void clear();
+
+private:
+    void record(Diagnostic d, std::string_view text);
+
+    DiagnosticOptions options;
+    std::vector<Diagnostic> entries;
+    std::string pool;
+    std::vector<std::string> files;
+    uint32_t current_file = 0;
+    size_t error_count = 0;
+    size_t warning_count = 0;
+    size_t printed = 0;
+};
+
+// An error that stops compilation. what() reads as the text output does;
+// report_error() records the code, line and column.
+class CompileError : public std::runtime_error {
+public:
+    CompileError(DiagCode code, int line, const std::string& message) : CompileError(code, line, 0, message) {}
+    CompileError(DiagCode code, int line, int column, const std::string& message);
+
+    DiagCode code;
+    int line;
+    int column;  // 0 when unknown
+    std::string message;
+};
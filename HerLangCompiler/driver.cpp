@@ -0,0 +1,530 @@
+// driver.cpp - Compilation pipeline shared by single-file and batch modes
+#include "driver.hpp"
+#include "astimage.hpp"
+#include "cache.hpp"
+#include "version.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "sema.hpp"
+#include "generator.hpp"
+#include "irgen.hpp"
+#include "vm.hpp"
+#include "warnings.hpp"
+#include "source.hpp"
+#include "utils.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace fs = std::filesystem;
+
+#if _DEBUG
+static void dump_tokens(const std::vector<Token>& tokens) {
+    std::cerr << "=== Tokens ===\n";
+    for (const auto& tok : tokens) {
+        std::cerr << "[" << tok.line << "] ";
+        switch (tok.type) {
+        case TokenType::Keyword:        std::cerr << "Keyword    "; break;
+        case TokenType::Identifier:     std::cerr << "Identifier "; break;
+        case TokenType::StringLiteral:  std::cerr << "String     "; break;
+        case TokenType::NumberLiteral:  std::cerr << "Number     "; break;
+        case TokenType::Newline:        std::cerr << "Newline    "; break;
+        case TokenType::Indent:         std::cerr << "Indent     "; break;
+        case TokenType::Dedent:         std::cerr << "Dedent     "; break;
+        case TokenType::EOFToken:       std::cerr << "EOF        "; break;
+        case TokenType::Symbol:         std::cerr << "Symbol     "; break;
+        }
+        std::cerr << ": " << tok.value << "\n";
+    }
+    std::cerr << "==============\n";
+}
+
+static void dump_ast(const AST& ast) {
+    std::cerr << "=== AST ===\n";
+    for (auto stmt : ast.statements) {
+        if (auto func = node_cast<FunctionDef>(stmt)) {
+            std::cerr << "Function: " << ast.symbols.name(func->name) << "("
+                << (func->param != NoSymbol ? ast.symbols.name(func->param) : "") << "), body size = "
+                << func->body.size() << "\n";
+            for (auto inner : func->body) {
+                if (auto say = node_cast<SayStatement>(inner)) {
+                    std::cerr << "  Say: ";
+                    for (const Argument& arg : say->args) {
+                        if (arg.is_var()) {
+                            std::cerr << "VAR(" << ast.symbols.name(arg.var) << ") ";
+                        }
+                        else {
+                            std::cerr << "\"" << arg.text << "\" ";
+                        }
+                    }
+                    std::cerr << "ending = \"" << say->end << "\"\n";
+                }
+            }
+        }
+        else if (auto start = node_cast<StartBlock>(stmt)) {
+            std::cerr << "Start block, body size = " << start->body.size() << "\n";
+        }
+    }
+    std::cerr << "===========\n";
+}
+#endif
+
+std::string options_fingerprint(const CompileOptions& options) {
+    std::string fingerprint = "hcp " HCP_VERSION;
+    fingerprint += " -O" + std::to_string(options.optimize.level);
+    if (options.codegen.buffered_output) fingerprint += " --buffered-output";
+    if (!options.codegen.runtime_header.empty()) fingerprint += " --runtime-header " + options.codegen.runtime_header;
+    if (options.codegen.profile) fingerprint += " --profile";
+    if (options.codegen.profile_use) {
+        char hash[32];
+        std::snprintf(hash, sizeof(hash), " --profile-use %016llx",
+            static_cast<unsigned long long>(options.codegen.profile_use->hash));
+        fingerprint += hash;
+    }
+    if (options.backend == Backend::LlvmIr) fingerprint += " --emit-llvm";
+    return fingerprint;
+}
+
+AST parse_tokens(const std::vector<Token>& tokens, Interner symbols, const CompileOptions& options,
+    CompileStats* stats) {
+    if (stats) stats->tokens = tokens.size();
+#if _DEBUG
+    dump_tokens(tokens);
+#endif
+    AST ast;
+    {
+        PhaseTimer timer(stats, "parse");
+        ast = parse(tokens, std::move(symbols));
+    }
+    if (stats) stats->ast_nodes = ast.node_count;
+    if (options.optimize.level > 0) {
+        PhaseTimer timer(stats, "optimize");
+        optimize(ast, options.optimize);
+    }
+#if _DEBUG
+    dump_ast(ast);
+#endif
+    return ast;
+}
+
+// What the analyzed AST depends on besides the source; part of the key of
+// its image. Codegen flags are not, so changing them reuses the image.
+static std::string front_end_fingerprint(const CompileOptions& options) {
+    return "hcp " HCP_VERSION " ast " + std::to_string(AstImageVersion) + " -O" +
+        std::to_string(options.optimize.level);
+}
+
+static AST lex_and_parse(const SourceBuffer& source, const CompileOptions& options, Diagnostics& diag,
+    CompileStats* stats) {
+    std::vector<Token> tokens;
+    Interner symbols;
+    {
+        // Lex straight out of the mapped file; indentation warnings come from the same pass.
+        PhaseTimer timer(stats, "lex");
+        IndentationChecker indentation(diag);
+        tokens = lex_parallel(source.view(), options.lex_threads, &indentation, &symbols, &diag);
+        indentation.finish();
+    }
+    return parse_tokens(tokens, std::move(symbols), options, stats);
+}
+
+// Lex and parse `source`, then optimize when enabled. The AST refers into
+// `source`, which must outlive it. With a cache directory, the result is
+// loaded from its image when there is one, and saved as one otherwise.
+static AST parse_source(const SourceBuffer& source, const CompileOptions& options, Diagnostics& diag,
+    CompileStats* stats) {
+    if (options.cache_dir.empty()) return lex_and_parse(source, options, diag, stats);
+
+    CompileCache cache(options.cache_dir);
+    uint64_t key = hash_bytes(source.view(), hash_bytes(front_end_fingerprint(options)));
+    // The image keeps the warnings as found, as cache entries do.
+    Diagnostics found;
+    {
+        PhaseTimer timer(stats, "ast-load");
+        AST ast;
+        if (load_ast_image(cache.image_path(key), source.view(), ast, found)) {
+            if (stats) stats->ast_nodes = ast.node_count;
+            diag.append(found);
+            return ast;
+        }
+    }
+
+    AST ast;
+    try {
+        ast = lex_and_parse(source, options, found, stats);
+    }
+    catch (...) {
+        diag.append(found);
+        throw;
+    }
+    {
+        PhaseTimer timer(stats, "ast-save");
+        cache.store_file(cache.image_path(key), save_ast_image(ast, source.view(), found));
+    }
+    diag.append(found);
+    return ast;
+}
+
+void generate_code(const AST& ast, const CompileOptions& options, OutputSink& out) {
+    if (options.backend == Backend::LlvmIr) generate_llvm_ir(ast, out);
+    else generate_cpp(ast, out, options.codegen);
+}
+
+void report_error(const std::exception& e, Diagnostics& diag) {
+    if (auto* parse_errors = dynamic_cast<const ParseErrors*>(&e)) {
+        for (const ParseError& error : parse_errors->errors) diag.error(error.code, error.line, error.column, error.message);
+        return;
+    }
+    if (auto* compile_error = dynamic_cast<const CompileError*>(&e)) {
+        diag.error(compile_error->code, compile_error->line, compile_error->column, compile_error->message);
+        return;
+    }
+    diag.error(DiagCode::Internal, 0, 0, e.what());
+}
+
+static void cannot_open(Diagnostics& diag, const std::string& path) {
+    diag.error(DiagCode::Io, 0, 0, "Cannot open input file: " + path);
+}
+
+static void cannot_write(Diagnostics& diag, const std::string& path) {
+    diag.error(DiagCode::Io, 0, 0, "Cannot write to output file: " + path);
+}
+
+bool link_imports(AST& ast, const std::string& input, const CompileOptions& options, Diagnostics& diag,
+    ImportSet* imports, bool linked) {
+    ImportSet found;
+    const ImportStatement* first = first_import(ast);
+    if (first && options.backend != Backend::Cpp) {
+        diag.error(DiagCode::Import, first->line, 0, "Modules can only be imported when generating C++");
+        return false;
+    }
+    if (!resolve_imports(ast, input, options.cache_dir, diag, imports ? *imports : found, linked)) return false;
+    // Before any output is opened, so a bad call never truncates the last good one.
+    return check_calls(ast, diag);
+}
+
+// Lex, parse and generate `source`, read from `input`, into `output`.
+// Nothing is written when `diag` made a warning an error, or when the
+// compile fails.
+static bool run_pipeline(const SourceBuffer& source, const std::string& input, const std::string& output_path,
+    const CompileOptions& options, Diagnostics& diag, CompileStats* stats, ImportSet& imports) {
+    // Files are generated beside the output and renamed over it, so a
+    // compile that fails part way leaves the last good output in place.
+    std::string written = output_path == "-" ? output_path : output_path + ".tmp";
+    auto discard = [&]() {
+        if (written != output_path) std::remove(written.c_str());
+    };
+    size_t errors = diag.errors();
+    try {
+        AST ast = parse_source(source, options, diag, stats);
+        if (diag.errors() != errors) return false;
+        {
+            PhaseTimer timer(first_import(ast) ? stats : nullptr, "imports");
+            if (!link_imports(ast, input, options, diag, &imports)) return false;
+        }
+        {
+            PhaseTimer timer(stats, "generate");
+            FileSink output;
+            if (!output.open(written)) {
+                cannot_write(diag, output_path);
+                return false;
+            }
+            generate_code(ast, options, output);
+            if (stats) stats->output_bytes = output.bytes_written();
+            if (!output.close()) {
+                cannot_write(diag, output_path);
+                discard();
+                return false;
+            }
+        }
+    }
+    catch (const std::exception& e) {
+        discard();
+        report_error(e, diag);
+        return false;
+    }
+    if (written != output_path) {
+        std::error_code ec;
+        fs::rename(written, output_path, ec);
+        if (ec) {
+            discard();
+            cannot_write(diag, output_path);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool compile_file(const CompileJob& job, const CompileOptions& options, Diagnostics& diag,
+    CompileStats* stats) {
+    if (stats) stats->file = job.input;
+    diag.set_file(job.input);
+
+    SourceBuffer source;
+    {
+        PhaseTimer timer(stats, "read");
+        if (!source.open(job.input)) {
+            cannot_open(diag, job.input);
+            return false;
+        }
+    }
+    if (stats) stats->source_bytes = source.size();
+
+    ImportSet imports;
+    if (options.cache_dir.empty()) {
+        return run_pipeline(source, job.input, job.output, options, diag, stats, imports);
+    }
+
+    CompileCache cache(options.cache_dir);
+    uint64_t key;
+    {
+        PhaseTimer timer(stats, "cache");
+        key = hash_bytes(source.view(), hash_bytes(options_fingerprint(options)));
+
+        // An entry from before the diagnostics it holds were structured
+        // does not load, and counts as a miss.
+        std::string cached_diagnostics;
+        size_t errors = diag.errors();
+        uint64_t entry;
+        if (cached_entry_key(options.cache_dir, job.input, key, entry) &&
+            cache.lookup(entry, cached_diagnostics) && diag.load(cached_diagnostics)) {
+            if (stats) stats->cache_hit = true;
+            if (diag.errors() != errors) return false;
+            if (!install_file(cache.entry_path(entry), job.output)) {
+                cannot_write(diag, job.output);
+                return false;
+            }
+            return true;
+        }
+    }
+
+    // Miss: generate into the cache, then install from there. The entry
+    // keeps the warnings as found, whatever -Werror or -Wno- say this time.
+    std::string temp = cache.temp_path(key);
+    Diagnostics captured;
+    bool ok = run_pipeline(source, job.input, temp, options, captured, stats, imports);
+    size_t errors = diag.errors();
+    diag.append(captured);
+    if (!ok) {
+        std::remove(temp.c_str());
+        return false;
+    }
+
+    PhaseTimer timer(stats, "install");
+    uint64_t entry_key = store_imports(options.cache_dir, key, imports);
+    std::string entry = cache.entry_path(entry_key);
+    if (!cache.store(entry_key, temp, captured.save())) {
+        // Cache not writable; still deliver the output.
+        entry = temp;
+    }
+    ok = diag.errors() == errors && install_file(entry, job.output);
+    if (entry == temp) std::remove(temp.c_str());
+    if (!ok && diag.errors() == errors) {
+        cannot_write(diag, job.output);
+    }
+    return ok;
+}
+
+bool generate_source(const std::string& input, const CompileOptions& options, OutputSink& out,
+    Diagnostics& diag, CompileStats* stats, ImportSet* imports) {
+    if (stats) stats->file = input;
+    diag.set_file(input);
+
+    SourceBuffer source;
+    {
+        PhaseTimer timer(stats, "read");
+        if (!source.open(input)) {
+            cannot_open(diag, input);
+            return false;
+        }
+    }
+    if (stats) stats->source_bytes = source.size();
+
+    size_t errors = diag.errors();
+    try {
+        AST ast = parse_source(source, options, diag, stats);
+        if (diag.errors() != errors) return false;
+        {
+            PhaseTimer timer(first_import(ast) ? stats : nullptr, "imports");
+            if (!link_imports(ast, input, options, diag, imports, imports != nullptr)) return false;
+        }
+        PhaseTimer timer(stats, "generate");
+        generate_code(ast, options, out);
+        if (stats) stats->output_bytes = out.bytes_written();
+    }
+    catch (const std::exception& e) {
+        report_error(e, diag);
+        return false;
+    }
+    return true;
+}
+
+namespace {
+
+struct BatchSlot {
+    std::string diagnostics;
+    bool ok = false;
+    bool done = false;
+};
+
+}
+
+size_t for_each_job(const std::vector<CompileJob>& jobs, unsigned threads, const DiagnosticOptions& diagnostics,
+    const std::function<bool(size_t index, Diagnostics& diag)>& task) {
+    if (threads == 0) threads = 1;
+    if (threads > jobs.size()) threads = static_cast<unsigned>(jobs.size());
+
+    std::vector<BatchSlot> slots(jobs.size());
+    std::atomic<size_t> next{ 0 };
+    std::mutex mutex;
+    std::condition_variable finished;
+
+    auto worker = [&]() {
+        for (size_t i = next++; i < jobs.size(); i = next++) {
+            Diagnostics diag(diagnostics);
+            diag.set_file(jobs[i].input);
+            bool ok = task(i, diag);
+
+            // Rendered here, in parallel; text goes under a per-file heading,
+            // while JSON lines name their file themselves.
+            std::ostringstream rendered;
+            if (!diag.empty() && diagnostics.format == DiagnosticFormat::Text) {
+                rendered << "In " << jobs[i].input << ":\n";
+            }
+            diag.print(rendered);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            slots[i].diagnostics = rendered.str();
+            slots[i].ok = ok;
+            slots[i].done = true;
+            finished.notify_one();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < threads; ++t) pool.emplace_back(worker);
+
+    // Report in job order as soon as each prefix of the batch is complete.
+    size_t failures = 0;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&] { return slots[i].done; });
+        const BatchSlot& slot = slots[i];
+        lock.unlock();
+
+        std::cerr << slot.diagnostics;
+        if (!slot.ok) ++failures;
+    }
+
+    for (auto& t : pool) t.join();
+    return failures;
+}
+
+size_t compile_batch(const std::vector<CompileJob>& jobs, const CompileOptions& options,
+    unsigned threads, std::vector<CompileStats>* stats) {
+    if (stats) stats->assign(jobs.size(), CompileStats());
+    return for_each_job(jobs, threads, options.diagnostics, [&](size_t i, Diagnostics& diag) {
+        return compile_file(jobs[i], options, diag, stats ? &(*stats)[i] : nullptr);
+    });
+}
+
+bool run_file(const std::string& input, const CompileOptions& options, Diagnostics& diag,
+    CompileStats* stats) {
+    if (stats) stats->file = input;
+    diag.set_file(input);
+
+    SourceBuffer source;
+    {
+        PhaseTimer timer(stats, "read");
+        if (!source.open(input)) {
+            cannot_open(diag, input);
+            return false;
+        }
+    }
+    if (stats) stats->source_bytes = source.size();
+
+#ifdef _WIN32
+    SetConsoleOutputCP(CP_UTF8);
+#endif
+    FileSink output;
+    output.open("-");
+    size_t errors = diag.errors();
+    try {
+        AST ast = parse_source(source, options, diag, stats);
+        if (auto import = first_import(ast)) {
+            diag.error(DiagCode::Import, import->line, 0,
+                "'hcp run' cannot import modules; build the program with 'hcp build'");
+            diag.print(std::cerr);
+            return false;
+        }
+        if (!check_calls(ast, diag)) {
+            diag.print(std::cerr);
+            return false;
+        }
+        Bytecode program;
+        {
+            PhaseTimer timer(stats, "compile");
+            program = compile_bytecode(ast);
+        }
+        diag.print(std::cerr);
+        if (diag.errors() != errors) return false;
+        {
+            PhaseTimer timer(stats, "run");
+            run_bytecode(program, output);
+        }
+    }
+    catch (const std::exception& e) {
+        // Whatever the program said before failing still comes out first.
+        output.flush();
+        if (stats) stats->output_bytes = output.bytes_written();
+        std::fflush(stdout);
+        report_error(e, diag);
+        return false;
+    }
+    if (stats) stats->output_bytes = output.bytes_written();
+    return output.close();
+}
+
+bool read_manifest(const std::string& path, std::vector<CompileJob>& jobs, std::string_view extension) {
+    std::ifstream in(path);
+    if (!in) return false;
+
+    std::string line;
+    while (std::getline(in, line)) {
+        std::string entry = trim(line);
+        if (entry.empty() || entry[0] == '#') continue;
+
+        std::istringstream fields(entry);
+        CompileJob job;
+        fields >> job.input >> job.output;
+        if (job.output.empty()) job.output = default_output_path(job.input, extension);
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+std::string_view output_extension(const CompileOptions& options) {
+    return options.backend == Backend::LlvmIr ? ".ll" : ".cpp";
+}
+
+std::string default_output_path(const std::string& input, std::string_view extension) {
+    size_t slash = input.find_last_of("/\\");
+    size_t dot = input.rfind('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return input + std::string(extension);
+    }
+    return input.substr(0, dot) + std::string(extension);
+}
@@ -0,0 +1,114 @@
+// driver.hpp - Compilation pipeline shared by single-file and batch modes
+#pragma once
+#include "diagnostics.hpp"
+#include "generator.hpp"
+#include "lexer.hpp"
+#include "modules.hpp"
+#include "optimizer.hpp"
+#include "stats.hpp"
+#include <exception>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct CompileJob {
+    std::string input;
+    std::string output;
+};
+
+enum class Backend : uint8_t {
+    Cpp,     // portable C++ for any C++20 compiler
+    LlvmIr,  // textual LLVM IR for clang or llc
+};
+
+struct CompileOptions {
+    // When set, generated code is cached here keyed by input content, compiler
+    // version and codegen flags, and hits skip the front end entirely. The
+    // analyzed AST is kept here too, without the codegen flags in its key, so
+    // regenerating a file under other flags skips lexing and parsing.
+    std::string cache_dir;
+
+    OptimizeOptions optimize;
+    CodegenOptions codegen;
+    Backend backend = Backend::Cpp;
+
+    // Threads for lexing a single large file. Batch modes leave this at 1,
+    // since their files are already compiled in parallel.
+    unsigned lex_threads = 1;
+
+    // -Werror, -Wno-<code> and the output format. Not part of the cache key:
+    // entries keep the warnings as found, and these apply when they are
+    // replayed.
+    DiagnosticOptions diagnostics;
+};
+
+// Stable spelling of everything in `options` that affects generated code;
+// part of the cache key.
+std::string options_fingerprint(const CompileOptions& options);
+
+// Runs lex -> parse -> generate for one file. Warnings and errors are recorded
+// into `diag`, against job.input; returns false if the file could not be
+// compiled, or if `diag` turned a warning into an error. When `stats` is
+// given, per-phase timings and counters are recorded into it.
+bool compile_file(const CompileJob& job, const CompileOptions& options, Diagnostics& diag,
+    CompileStats* stats = nullptr);
+
+// Runs the front end on `input` and generates code into `out`, bypassing the
+// cache. Diagnostics go to `diag`; returns false on failure. `imports`, when
+// given, receives what the file imports and every module a program built
+// from it links with.
+bool generate_source(const std::string& input, const CompileOptions& options, OutputSink& out,
+    Diagnostics& diag, CompileStats* stats = nullptr, ImportSet* imports = nullptr);
+
+// Resolves the imports of `ast`, parsed from `input`, so generated code can
+// call into the modules; see resolve_imports(), which `imports` and `linked`
+// are passed to. Only the C++ backend can import. Then checks every call
+// against what it calls with check_calls().
+bool link_imports(AST& ast, const std::string& input, const CompileOptions& options, Diagnostics& diag,
+    ImportSet* imports = nullptr, bool linked = false);
+
+// Parses, analyzes and (when enabled) optimizes tokens lexed with `symbols`,
+// for callers that lex themselves. Throws like parse().
+AST parse_tokens(const std::vector<Token>& tokens, Interner symbols, const CompileOptions& options,
+    CompileStats* stats = nullptr);
+
+// Writes `ast` as the backend `options` selects.
+void generate_code(const AST& ast, const CompileOptions& options, OutputSink& out);
+
+// Records `e` as errors: one per syntax error of a ParseErrors, the code,
+// line and column of a CompileError, and what() of anything else.
+void report_error(const std::exception& e, Diagnostics& diag);
+
+// Runs task(i, diag) for every job on a pool of `threads` workers, each job
+// with its own Diagnostics under `diagnostics`, then prints each job's
+// diagnostics to stderr, in job order. Returns the number of tasks that
+// returned false.
+size_t for_each_job(const std::vector<CompileJob>& jobs, unsigned threads, const DiagnosticOptions& diagnostics,
+    const std::function<bool(size_t index, Diagnostics& diag)>& task);
+
+// Compiles every job on a pool of `threads` workers, each with its own
+// pipeline. Diagnostics are printed to stderr grouped per file, in job order,
+// regardless of which worker finished first. Returns the number of failures.
+// `stats`, when given, receives one entry per job in job order.
+size_t compile_batch(const std::vector<CompileJob>& jobs, const CompileOptions& options,
+    unsigned threads, std::vector<CompileStats>* stats = nullptr);
+
+// Compiles `input` to bytecode and runs it in-process, with its output on
+// stdout through the same 64 KiB buffered sink as generated code. Returns
+// false if it could not be compiled or failed while running. What `diag`
+// holds when the program starts is printed to stderr first, so warnings come
+// out ahead of its output.
+bool run_file(const std::string& input, const CompileOptions& options, Diagnostics& diag,
+    CompileStats* stats = nullptr);
+
+// Reads "input [output]" lines; blank lines and '#' comments are skipped.
+// A missing output defaults to the input with `extension`.
+bool read_manifest(const std::string& path, std::vector<CompileJob>& jobs,
+    std::string_view extension = ".cpp");
+
+// ".cpp" or ".ll", depending on the backend.
+std::string_view output_extension(const CompileOptions& options);
+
+// in.herc -> in.cpp
+std::string default_output_path(const std::string& input, std::string_view extension = ".cpp");
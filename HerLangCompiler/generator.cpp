@@ -1,110 +1,731 @@
 // generator.cpp - AST to C++ generator
 #include "generator.hpp"
 #include "ast.hpp"
-#include <sstream>
+#include "callgraph.hpp"
 #include <unordered_set>
+#include <charconv>
+#include <climits>
 #include <string>
 #include <algorithm>
 #include <iostream>
+#include <string_view>
+#include <vector>
 
 
-static std::string indent(int level) {
-    return std::string(level * 4, ' ');
+static void write_indent(OutputSink& out, int level) {
+    static constexpr std::string_view spaces = "                                ";
+    for (size_t n = static_cast<size_t>(level) * 4; n > 0;) {
+        size_t chunk = n < spaces.size() ? n : spaces.size();
+        out << spaces.substr(0, chunk);
+        n -= chunk;
+    }
 }
 
-static std::string escape_string(const std::string& s) {
-    std::string out;
-    for (char c : s) {
-        if (c == '\"') out += "\\\"";
-        else if (c == '\\') out += "\\\\";
-        else out += c;
+// Writes `s` as the body of a C++ string literal, copying unescaped runs whole.
+static void write_escaped(OutputSink& out, std::string_view s) {
+    size_t run = 0;
+    for (size_t i = 0; i < s.size(); ++i) {
+        char escape = 0;
+        switch (s[i]) {
+        case '"':  escape = '"'; break;
+        case '\\': escape = '\\'; break;
+        case '\n': escape = 'n'; break;
+        case '\r': escape = 'r'; break;
+        case '\t': escape = 't'; break;
+        default: continue;
+        }
+        out << s.substr(run, i - run) << '\\' << escape;
+        run = i + 1;
+    }
+    out << s.substr(run);
+}
+
+static std::string_view cpp_type(ValueType type) {
+    return type == ValueType::Float ? "double" : "long long";
+}
+
+static std::string_view cpp_operator(BinaryOp op) {
+    switch (op) {
+    case BinaryOp::Add:          return "+";
+    case BinaryOp::Minus:        return "-";
+    case BinaryOp::Multiply:     return "*";
+    case BinaryOp::Divide:       return "/";
+    case BinaryOp::Less:         return "<";
+    case BinaryOp::LessEqual:    return "<=";
+    case BinaryOp::Greater:      return ">";
+    case BinaryOp::GreaterEqual: return ">=";
+    case BinaryOp::Equal:        return "==";
+    case BinaryOp::NotEqual:     return "!=";
     }
-    return out;
+    return "+";
 }
 
-static void gen_stmt(std::ostringstream& out, const std::shared_ptr<Statement>& stmt, int indent_level = 1) {
-    std::string ind = indent(indent_level);
+static bool is_comparison(BinaryOp op) {
+    return op >= BinaryOp::Less;
+}
+
+// The runtime function for integer `op`, which wraps on overflow and
+// reports division by zero as the VM does, where long long would be
+// undefined.
+static std::string_view int_function(BinaryOp op) {
+    switch (op) {
+    case BinaryOp::Add:      return "herlang_add";
+    case BinaryOp::Minus:    return "herlang_sub";
+    case BinaryOp::Multiply: return "herlang_mul";
+    default:                 return "herlang_div";
+    }
+}
 
-    if (auto say = dynamic_cast<SayStatement*>(stmt.get())) {
-        out << ind << "std::cout";
-        for (size_t i = 0; i < say->args.size(); ++i) {
-            out << " << ";
-            if (say->is_vars[i]) {
-                out << say->args[i];
+// An integer literal as C++ reads it the way the VM does: leading zeros
+// would make it octal, and -9223372036854775808 is the negation of a
+// literal too large for long long.
+static void write_int_literal(OutputSink& out, std::string_view text) {
+    long long value = 0;
+    std::from_chars(text.data(), text.data() + text.size(), value);  // range checked by analyze()
+    if (value == LLONG_MIN) out << "(-9223372036854775807LL - 1)";
+    else out << std::to_string(value);
+}
+
+// Nested operations are fully parenthesized, so source grouping is kept as is.
+// Integer arithmetic calls the runtime instead; `line` is the statement's.
+static void write_expr(OutputSink& out, const Interner& symbols, const Expr* expr, int line, bool nested = false) {
+    switch (expr->kind) {
+    case ExprKind::Number:
+        if (expr->type == ValueType::Int) write_int_literal(out, static_cast<const NumberLiteral*>(expr)->text);
+        else out << static_cast<const NumberLiteral*>(expr)->text;
+        break;
+    case ExprKind::Variable:
+        out << symbols.name(static_cast<const VariableRef*>(expr)->name);
+        break;
+    case ExprKind::Binary: {
+        auto bin = static_cast<const BinaryExpr*>(expr);
+        if (bin->type == ValueType::Int && !is_comparison(bin->op)) {
+            out << int_function(bin->op) << '(';
+            write_expr(out, symbols, bin->lhs, line);
+            out << ", ";
+            write_expr(out, symbols, bin->rhs, line);
+            if (bin->op == BinaryOp::Divide) out << ", " << line;
+            out << ')';
+            break;
+        }
+        if (nested) out << '(';
+        write_expr(out, symbols, bin->lhs, line, true);
+        out << ' ' << cpp_operator(bin->op) << ' ';
+        write_expr(out, symbols, bin->rhs, line, true);
+        if (nested) out << ')';
+        break;
+    }
+    }
+}
+
+static bool is_literal_say(const Statement* stmt) {
+    auto say = node_cast<SayStatement>(stmt);
+    if (!say) return false;
+    for (const Argument& arg : say->args) {
+        if (arg.is_var()) return false;
+    }
+    return true;
+}
+
+// Writes the text a literal-only say prints, escaped, without quotes.
+static void write_say_text(OutputSink& out, const SayStatement* say) {
+    for (const Argument& arg : say->args) write_escaped(out, arg.text);
+    if (say->end == "\\n") out << "\\n";
+    else write_escaped(out, say->end);
+}
+
+// The function being generated, when its statements are counted
+// (--profile) or a profile guides it (--profile-use). Either way its
+// statements are numbered in source order, nested ones included, as
+// statement_lines() lists them.
+struct FunctionProfile {
+    std::string_view name;         // "start" for the start block
+    bool count;                    // emit the counters
+    const Profile::Function* use;  // null unless the profile matches the code
+    size_t next = 0;               // the number of the next statement
+};
+
+static void statement_lines(Span<Statement*> body, std::vector<int>& lines) {
+    for (auto stmt : body) {
+        lines.push_back(stmt->line);
+        for_each_body(stmt, [&](Span<Statement*> inner) { statement_lines(inner, lines); });
+    }
+}
+
+static void count_statement(OutputSink& out, FunctionProfile& profile, int indent_level) {
+    size_t number = profile.next++;
+    if (!profile.count) return;
+    write_indent(out, indent_level);
+    out << "++herlang_counts_" << profile.name << '[' << number << "];\n";
+}
+
+// Times the function from here to its end, and counts the call.
+static void write_profile_scope(OutputSink& out, std::string_view name, int indent_level) {
+    write_indent(out, indent_level);
+    out << "herlang_profile_scope herlang_scope(herlang_profile_" << name << ");\n";
+}
+
+// Marks a body that never ran in the profile, which is the one of the next
+// statement, so the C++ compiler moves it off the hot path. The attribute is
+// C++20, so it goes through the macro assemble() defines, which is empty
+// for older standards.
+static void write_likelihood(OutputSink& out, const FunctionProfile* profile, Span<Statement*> body) {
+    if (profile && profile->use && !body.empty() && profile->use->counts[profile->next] == 0) {
+        out << " HERLANG_UNLIKELY";
+    }
+}
+
+static constexpr std::string_view unlikely_macro =
+    "#if __cplusplus >= 202002L || (defined(_MSVC_LANG) && _MSVC_LANG >= 202002L)\n"
+    "#define HERLANG_UNLIKELY [[unlikely]]\n"
+    "#else\n"
+    "#define HERLANG_UNLIKELY\n"
+    "#endif\n\n";
+
+static void gen_stmt(OutputSink& out, const CodegenOptions& options, const Interner& symbols, const Statement* stmt,
+    int indent_level, FunctionProfile* profile);
+
+// Emits a block body. In buffered mode, runs of literal-only say statements
+// are coalesced into a single write.
+static void gen_block(OutputSink& out, const CodegenOptions& options, const Interner& symbols, Span<Statement*> body,
+    int indent_level, FunctionProfile* profile) {
+    for (size_t i = 0; i < body.size(); ++i) {
+        if (!options.buffered_output || !is_literal_say(body[i]) ||
+            i + 1 == body.size() || !is_literal_say(body[i + 1])) {
+            gen_stmt(out, options, symbols, body[i], indent_level, profile);
+            continue;
+        }
+
+        size_t end = i;
+        while (end < body.size() && is_literal_say(body[end])) ++end;
+        if (profile) {
+            for (size_t k = i; k < end; ++k) count_statement(out, *profile, indent_level);
+        }
+        write_indent(out, indent_level);
+        out << "herlang_text(\"";
+        for (; i < end; ++i) write_say_text(out, static_cast<const SayStatement*>(body[i]));
+        out << "\");\n";
+        --i;
+    }
+}
+
+static void gen_stmt(OutputSink& out, const CodegenOptions& options, const Interner& symbols, const Statement* stmt,
+    int indent_level, FunctionProfile* profile) {
+    if (profile && stmt->kind != NodeKind::FunctionDef) count_statement(out, *profile, indent_level);
+    switch (stmt->kind) {
+    case NodeKind::Say: {
+        // Literal pieces, the ending included, are written as one string.
+        // Without buffering, a default ending flushes like std::endl, also
+        // once -O has folded it into the text.
+        auto say = static_cast<const SayStatement*>(stmt);
+        bool first = true;
+        bool in_text = false;
+        auto next_call = [&]() {
+            if (first) write_indent(out, indent_level);
+            else out << ' ';
+            first = false;
+        };
+        auto open_text = [&]() {
+            if (in_text) return;
+            next_call();
+            out << "herlang_text(\"";
+            in_text = true;
+        };
+        auto close_text = [&]() {
+            if (in_text) out << "\");";
+            in_text = false;
+        };
+
+        for (const Argument& arg : say->args) {
+            if (arg.is_var()) {
+                close_text();
+                next_call();
+                out << "herlang_write(" << symbols.name(arg.var) << ");";
             }
-            else {
-                out << "\"" << escape_string(say->args[i]) << "\"";
+            else if (!arg.text.empty()) {
+                open_text();
+                write_escaped(out, arg.text);
             }
         }
-
-        if (say->end == "\\n")
-            out << " << std::endl;\n";
-        else
-            out << " << \"" << escape_string(say->end) << "\";\n";
+        bool newline = say->end == "\\n";
+        if (newline) {
+            open_text();
+            out << "\\n";
+        }
+        else if (!say->end.empty()) {
+            open_text();
+            write_escaped(out, say->end);
+        }
+        close_text();
+        if ((newline || say->flush_after) && !options.buffered_output) {
+            next_call();
+            out << "herlang_flush();";
+        }
+        if (!first) out << '\n';
+        break;
     }
-    else if (auto set = dynamic_cast<SetStatement*>(stmt.get())) {
-        out << ind << "auto " << set->var << " = 0;\n";
+    case NodeKind::Set: {
+        auto set = static_cast<const SetStatement*>(stmt);
+        write_indent(out, indent_level);
+        if (set->declares) out << cpp_type(set->type) << ' ';
+        out << symbols.name(set->var) << " = ";
+        if (set->value) write_expr(out, symbols, set->value, stmt->line);
+        else out << '0';
+        out << ";\n";
+        break;
+    }
+    case NodeKind::Arithmetic: {
+        auto arith = static_cast<const ArithmeticStatement*>(stmt);
+        std::string_view var = symbols.name(arith->var);
+        write_indent(out, indent_level);
+        if (arith->type == ValueType::Int) {
+            out << var << " = " << int_function(arith->op) << '(' << var << ", ";
+            write_expr(out, symbols, arith->operand, stmt->line);
+            if (arith->op == BinaryOp::Divide) out << ", " << stmt->line;
+            out << ");\n";
+            break;
+        }
+        out << var << ' ' << cpp_operator(arith->op) << "= ";
+        write_expr(out, symbols, arith->operand, stmt->line);
+        out << ";\n";
+        break;
     }
-    else if (auto func = dynamic_cast<FunctionDef*>(stmt.get())) {
-        if (!func->param.empty()) {
-            out << "void " << func->name << "(auto " << func->param << ") {\n";
+    case NodeKind::If: {
+        auto branch_if = static_cast<const IfStatement*>(stmt);
+        write_indent(out, indent_level);
+        for (size_t i = 0; i < branch_if->branches.size(); ++i) {
+            out << (i == 0 ? "if (" : " else if (");
+            write_expr(out, symbols, branch_if->branches[i].condition, stmt->line);
+            out << ')';
+            write_likelihood(out, profile, branch_if->branches[i].body);
+            out << " {\n";
+            gen_block(out, options, symbols, branch_if->branches[i].body, indent_level + 1, profile);
+            write_indent(out, indent_level);
+            out << '}';
         }
-        else {
-            out << "void " << func->name << "() {\n";
+        if (!branch_if->else_body.empty()) {
+            out << " else";
+            write_likelihood(out, profile, branch_if->else_body);
+            out << " {\n";
+            gen_block(out, options, symbols, branch_if->else_body, indent_level + 1, profile);
+            write_indent(out, indent_level);
+            out << '}';
         }
+        out << '\n';
+        break;
+    }
+    case NodeKind::Repeat: {
+        // The count is evaluated once, before the first iteration. Nested
+        // anonymous loops are told apart by their indent level.
+        auto loop = static_cast<const RepeatStatement*>(stmt);
+        std::string hidden = "herlang_loop" + std::to_string(indent_level);
+        std::string_view counter = loop->counter == NoSymbol ? std::string_view(hidden) : symbols.name(loop->counter);
+        write_indent(out, indent_level);
+        out << "for (long long " << counter << " = 0, " << hidden << "_end = ";
+        write_expr(out, symbols, loop->count, stmt->line);
+        out << "; " << counter << " < " << hidden << "_end; ++" << counter << ") {\n";
+        gen_block(out, options, symbols, loop->body, indent_level + 1, profile);
+        write_indent(out, indent_level);
+        out << "}\n";
+        break;
+    }
+    case NodeKind::FunctionDef: {
+        auto func = static_cast<const FunctionDef*>(stmt);
+        out << "void " << symbols.name(func->name) << '(';
+        if (func->param != NoSymbol) out << "auto " << symbols.name(func->param);
+        out << ") {\n";
+        if (profile && profile->count) write_profile_scope(out, profile->name, indent_level + 1);
 
-        for (auto& s : func->body) gen_stmt(out, s, indent_level + 1);
+        gen_block(out, options, symbols, func->body, indent_level + 1, profile);
         out << "}\n";
+        break;
     }
-    else if (auto call = dynamic_cast<FunctionCall*>(stmt.get())) {
-        out << ind << call->name << "(";
-#if _DEBUG
-        std::cerr << "[DEBUG] function call arg in gen " << escape_string(call->arg) << " ";
-        switch (call->arg_type) {
-        case TokenType::Keyword:        std::cerr << "Keyword    "; break;
-        case TokenType::Identifier:     std::cerr << "Identifier "; break;
-        case TokenType::StringLiteral:  std::cerr << "String     "; break;
-        case TokenType::Newline:        std::cerr << "Newline    "; break;
-        case TokenType::EOFToken:       std::cerr << "EOF        "; break;
-        case TokenType::Symbol:         std::cerr << "Symbol     "; break;
-        }
-        std::cerr << std::endl;
-#endif
-        if (!call->arg.empty()) {
-            if (call->arg_type == TokenType::StringLiteral) {
-                out << "\"" << escape_string(call->arg) << "\"";
-            }
-            else {
-                out << call->arg;
-            }
+    case NodeKind::FunctionCall: {
+        auto call = static_cast<const FunctionCall*>(stmt);
+        write_indent(out, indent_level);
+        out << symbols.name(call->name) << "(";
+        if (call->arg.is_var()) {
+            out << symbols.name(call->arg.var);
+        }
+        else if (!call->arg.text.empty()) {
+            out << '"';
+            write_escaped(out, call->arg.text);
+            out << '"';
         }
         out << ");\n";
+        break;
     }
-    else if (auto main = dynamic_cast<StartBlock*>(stmt.get())) {
-        out << "int main() {\n#ifdef _WIN32\nSetConsoleOutputCP(CP_UTF8);\n#endif\n\n";
-        for (auto& s : main->body) gen_stmt(out, s, indent_level + 1);
-        out << indent(indent_level + 1) << "return 0;\n";
-        out << "}\n";
+    case NodeKind::StartBlock:
+        // Emitted as the body of main, at top level only.
+        break;
+    case NodeKind::Import:
+        // The functions it brings in are declared by assemble().
+        break;
+    }
+}
+
+// main() around the start block's body, which the caller writes in between.
+// Every type a call can pass: a number variable, or a string literal.
+static constexpr std::string_view param_types[] = { "long long", "double", "const char*" };
+
+// A function whose code is in another translation unit. One with a
+// parameter is a template there, instantiated for each type in param_types.
+static void declare_extern(OutputSink& out, const Interner& symbols, const ExternFunction& func) {
+    std::string_view name = symbols.name(func.name);
+    if (!func.has_param) {
+        out << "void " << name << "();\n";
+        return;
     }
+    out << "void " << name << "(auto);\n";
+    for (std::string_view type : param_types) out << "extern template void " << name << '(' << type << ");\n";
 }
 
-std::string generate_cpp(const AST& ast) {
-    std::ostringstream out;
-    out << "#include <iostream>\n#include <string>\n\n#ifdef _WIN32\n#include <windows.h>\n#endif\n\n";
+static void gen_main_prologue(OutputSink& out, const CodegenOptions& options, bool uses_utf8) {
+    out << "int main() {\n";
+    if (uses_utf8) out << "#ifdef _WIN32\nSetConsoleOutputCP(65001);\n#endif\n\n";
+    if (options.buffered_output) {
+        write_indent(out, 1);
+        out << "std::setvbuf(stdout, herlang_stdout_buffer, _IOFBF, sizeof(herlang_stdout_buffer));\n\n";
+    }
+}
+
+static void gen_main_epilogue(OutputSink& out) {
+    write_indent(out, 1);
+    out << "return 0;\n";
+    out << "}\n";
+}
+
+// The runtime is a handful of stdio wrappers, emitted piece by piece so a
+// program carries only what it calls. write_runtime_header writes them all.
+static constexpr std::string_view runtime_head = "#include <cstdio>\n\n";
+
+static constexpr std::string_view runtime_text =
+    "template <std::size_t N>\n"
+    "inline void herlang_text(const char (&s)[N]) { std::fwrite(s, 1, N - 1, stdout); }\n";
+
+static constexpr std::string_view runtime_values =
+    "inline void herlang_write(const char* s) { std::fputs(s, stdout); }\n"
+    "inline void herlang_write(long long n) { std::printf(\"%lld\", n); }\n"
+    "inline void herlang_write(double d) { std::printf(\"%g\", d); }\n";
+
+static constexpr std::string_view runtime_flush =
+    "inline void herlang_flush() { std::fflush(stdout); }\n";
 
-    for (auto& stmt : ast.statements) {
-        if (dynamic_cast<FunctionDef*>(stmt.get())) {
-            gen_stmt(out, stmt, 0);
-            out << '\n';
+// Integer arithmetic as the VM does it: wrapping in unsigned, and a division
+// by zero ends the program with the VM's error.
+static constexpr std::string_view runtime_math =
+    "#include <cstdlib>\n"
+    "inline long long herlang_add(long long a, long long b) {\n"
+    "    return static_cast<long long>(static_cast<unsigned long long>(a) + static_cast<unsigned long long>(b));\n"
+    "}\n"
+    "inline long long herlang_sub(long long a, long long b) {\n"
+    "    return static_cast<long long>(static_cast<unsigned long long>(a) - static_cast<unsigned long long>(b));\n"
+    "}\n"
+    "inline long long herlang_mul(long long a, long long b) {\n"
+    "    return static_cast<long long>(static_cast<unsigned long long>(a) * static_cast<unsigned long long>(b));\n"
+    "}\n"
+    "inline long long herlang_div(long long a, long long b, int line) {\n"
+    "    if (b == 0) {\n"
+    "        std::fflush(stdout);\n"
+    "        std::fprintf(stderr, \"[Error] Integer division by zero at line %d\\n\", line);\n"
+    "        std::exit(1);\n"
+    "    }\n"
+    "    return b == -1 ? herlang_sub(0, a) : a / b;\n"
+    "}\n";
+
+// Declared by hand: <windows.h> costs more to parse than everything else.
+static constexpr std::string_view runtime_utf8 =
+    "#ifdef _WIN32\n"
+    "extern \"C\" __declspec(dllimport) int __stdcall SetConsoleOutputCP(unsigned int);\n"
+    "#endif\n";
+
+// Counters and timers for --profile. Each function's record is registered
+// before main, from every translation unit, and the first registration
+// arranges for all of them to be written at exit; see profile.hpp. The
+// programs are single-threaded, so the counters are plain statics.
+static constexpr std::string_view runtime_profile =
+    "#include <cstdlib>\n"
+    "#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))\n"
+    "#include <intrin.h>\n"
+    "inline unsigned long long herlang_ticks() { return __rdtsc(); }\n"
+    "#elif defined(__x86_64__) || defined(__i386__)\n"
+    "inline unsigned long long herlang_ticks() { return __builtin_ia32_rdtsc(); }\n"
+    "#else\n"
+    "#include <chrono>\n"
+    "inline unsigned long long herlang_ticks() {\n"
+    "    return std::chrono::steady_clock::now().time_since_epoch().count();\n"
+    "}\n"
+    "#endif\n"
+    "struct herlang_profile_function {\n"
+    "    const char* name;\n"
+    "    unsigned long long* counts;\n"
+    "    const int* lines;\n"
+    "    unsigned size;\n"
+    "    unsigned long long calls = 0, ticks = 0;\n"
+    "    herlang_profile_function* next = nullptr;\n"
+    "};\n"
+    "inline herlang_profile_function* herlang_profiled = nullptr;\n"
+    "inline void herlang_write_profile() {\n"
+    "    const char* path = std::getenv(\"HERLANG_PROFILE\");\n"
+    "    std::FILE* out = std::fopen(path && *path ? path : \"herlang.profile\", \"w\");\n"
+    "    if (!out) return;\n"
+    "    std::fputs(\"hcp-profile 1\\n\", out);\n"
+    "    for (herlang_profile_function* f = herlang_profiled; f; f = f->next) {\n"
+    "        std::fprintf(out, \"function %s %llu %llu\\n\", f->name, f->calls, f->ticks);\n"
+    "        for (unsigned i = 0; i < f->size; ++i) std::fprintf(out, \"%d %llu\\n\", f->lines[i], f->counts[i]);\n"
+    "    }\n"
+    "    std::fclose(out);\n"
+    "}\n"
+    "struct herlang_profile_register {\n"
+    "    explicit herlang_profile_register(herlang_profile_function& f) {\n"
+    "        if (!herlang_profiled) std::atexit(herlang_write_profile);\n"
+    "        f.next = herlang_profiled;\n"
+    "        herlang_profiled = &f;\n"
+    "    }\n"
+    "};\n"
+    "struct herlang_profile_scope {\n"
+    "    herlang_profile_function& f;\n"
+    "    unsigned long long start = herlang_ticks();\n"
+    "    explicit herlang_profile_scope(herlang_profile_function& f) : f(f) { ++f.calls; }\n"
+    "    ~herlang_profile_scope() { f.ticks += herlang_ticks() - start; }\n"
+    "};\n";
+
+static bool has_non_ascii(std::string_view s) {
+    for (char c : s) {
+        if (static_cast<unsigned char>(c) >= 0x80) return true;
+    }
+    return false;
+}
+
+static bool has_int_math(const Expr* expr) {
+    auto bin = expr_cast<BinaryExpr>(expr);
+    if (!bin) return false;
+    return (bin->type == ValueType::Int && !is_comparison(bin->op)) || has_int_math(bin->lhs) ||
+        has_int_math(bin->rhs);
+}
+
+static void scan_runtime(const Statement* stmt, const CodegenOptions& options, RuntimeUse& use) {
+    if (auto say = node_cast<SayStatement>(stmt)) {
+        for (const Argument& arg : say->args) {
+            if (arg.is_var()) use.values = true;
+            else use.utf8 |= has_non_ascii(arg.text);
         }
+        use.text = true;
+        use.flush |= (say->end == "\\n" || say->flush_after) && !options.buffered_output;
+        use.utf8 |= has_non_ascii(say->end);
+    }
+    else if (auto call = node_cast<FunctionCall>(stmt)) {
+        use.utf8 |= has_non_ascii(call->arg.text);
+    }
+    else if (auto set = node_cast<SetStatement>(stmt)) {
+        use.math |= set->value && has_int_math(set->value);
+    }
+    else if (auto arith = node_cast<ArithmeticStatement>(stmt)) {
+        use.math |= arith->type == ValueType::Int || has_int_math(arith->operand);
     }
+    else if (auto branch_if = node_cast<IfStatement>(stmt)) {
+        for (auto& branch : branch_if->branches) use.math |= has_int_math(branch.condition);
+    }
+    else if (auto loop = node_cast<RepeatStatement>(stmt)) {
+        use.math |= has_int_math(loop->count);
+    }
+    for_each_body(stmt, [&](Span<Statement*> inner) {
+        for (auto nested : inner) scan_runtime(nested, options, use);
+    });
+}
 
-    for (auto& stmt : ast.statements) {
-        if (dynamic_cast<StartBlock*>(stmt.get())) {
-            gen_stmt(out, stmt, 0);
-            out << '\n';
+void write_runtime_header(OutputSink& out) {
+    // A guard rather than #pragma once, which warns when the header is
+    // compiled on its own into a precompiled header.
+    out << "// herlang_runtime.h - Runtime for C++ generated by hcp\n"
+           "#ifndef HERLANG_RUNTIME_H\n#define HERLANG_RUNTIME_H\n";
+    out << runtime_head << runtime_text << runtime_values << runtime_flush << runtime_math << runtime_utf8
+        << runtime_profile;
+    out << "#endif\n";
+    out.flush();
+}
+
+// Leaves at most this many statements long, nested ones included, are
+// emitted inline.
+static constexpr size_t inline_leaf_limit = 8;
+
+static size_t statement_count(Span<Statement*> body) {
+    size_t count = body.size();
+    for (auto stmt : body) {
+        for_each_body(stmt, [&](Span<Statement*> inner) { count += statement_count(inner); });
+    }
+    return count;
+}
+
+// With a profile, small leaves are only inlined if they ran, and hot ones,
+// taking this share of all calls or more, up to this many statements.
+static constexpr uint64_t hot_call_share = 100;
+static constexpr size_t hot_inline_leaf_limit = 4 * inline_leaf_limit;
+
+static bool inline_leaf(const FunctionDef* func, const CallGraph& graph, const AST& ast,
+    const CodegenOptions& options) {
+    if (!graph.is_leaf(func)) return false;
+    size_t size = statement_count(func->body);
+    const Profile* profile = options.profile_use.get();
+    const Profile::Function* seen = profile ? profile->find(ast.symbols.name(func->name)) : nullptr;
+    if (!seen) return size <= inline_leaf_limit;
+    if (seen->calls == 0) return false;
+    bool hot = seen->calls * hot_call_share >= profile->total_calls;
+    return size <= (hot ? hot_inline_leaf_limit : inline_leaf_limit);
+}
+
+// The counters of a function or start block under --profile, and the record
+// that writes them out with the line of each statement. Lines are only
+// written here, not in the code of the body, which stays valid when the
+// function moves.
+static void write_profile_record(OutputSink& out, std::string_view name, Span<Statement*> body) {
+    std::vector<int> lines;
+    statement_lines(body, lines);
+    size_t size = lines.size();
+    if (lines.empty()) lines.push_back(0);
+    out << "static unsigned long long herlang_counts_" << name << '[' << lines.size() << "];\n";
+    out << "static const int herlang_lines_" << name << "[] = {";
+    for (size_t i = 0; i < lines.size(); ++i) out << (i ? ", " : " ") << lines[i];
+    out << " };\n";
+    out << "static herlang_profile_function herlang_profile_" << name << "{ \"" << name << "\", herlang_counts_"
+        << name << ", herlang_lines_" << name << ", " << size << " };\n";
+    out << "static herlang_profile_register herlang_registered_" << name << "(herlang_profile_" << name << ");\n";
+}
+
+// Writes the translation unit around the code of each emitted function and
+// start block. use_of(i) says what the code of ast.statements[i] calls from
+// the runtime, and emit(i) writes it: a function's definition after its
+// linkage, or the body of main.
+template <typename UseOf, typename Emit>
+static void assemble(const AST& ast, OutputSink& out, const CodegenOptions& options, UseOf&& use_of, Emit&& emit) {
+    // A program only needs what start can reach, and nothing outside this
+    // translation unit calls in, so those functions get internal linkage.
+    // Without a start block every function is kept, as a library.
+    bool has_start = std::any_of(ast.statements.begin(), ast.statements.end(),
+        [](const Statement* stmt) { return stmt->kind == NodeKind::StartBlock; });
+    CallGraph graph(ast);
+    auto emitted = [&](const Statement* stmt) {
+        auto func = node_cast<FunctionDef>(stmt);
+        return func ? !has_start || graph.reachable(func) : stmt->kind == NodeKind::StartBlock;
+    };
+
+    RuntimeUse use;
+    for (size_t i = 0; i < ast.statements.size(); ++i) {
+        if (emitted(ast.statements[i])) use |= use_of(i);
+    }
+
+    if (!options.runtime_header.empty()) {
+        out << "#include \"" << options.runtime_header << "\"\n\n";
+    }
+    else {
+        out << runtime_head;
+        if (use.text) out << runtime_text;
+        if (use.values) out << runtime_values;
+        if (use.flush) out << runtime_flush;
+        if (use.math) out << runtime_math;
+        if (use.utf8) out << runtime_utf8;
+        if (options.profile) out << runtime_profile;
+        out << '\n';
+    }
+    if (options.profile_use) out << unlikely_macro;
+    if (options.buffered_output) {
+        // Installed as stdout's buffer at the top of main; flushed when full and at exit.
+        out << "static char herlang_stdout_buffer[1 << 16];\n\n";
+    }
+
+    for (const ExternFunction& func : ast.externs) declare_extern(out, ast.symbols, func);
+    if (!ast.externs.empty()) out << '\n';
+
+    for (size_t i = 0; i < ast.statements.size(); ++i) {
+        auto func = node_cast<FunctionDef>(ast.statements[i]);
+        if (!func || !emitted(func)) continue;
+        if (options.profile) write_profile_record(out, ast.symbols.name(func->name), func->body);
+        if (has_start) out << (inline_leaf(func, graph, ast, options) ? "static inline " : "static ");
+        emit(i);
+        if (!has_start && func->param != NoSymbol) {
+            // For the programs that import this library; see declare_extern().
+            std::string_view name = ast.symbols.name(func->name);
+            for (std::string_view type : param_types) out << "template void " << name << '(' << type << ");\n";
         }
+        out << '\n';
+    }
+
+    for (size_t i = 0; i < ast.statements.size(); ++i) {
+        auto main = node_cast<StartBlock>(ast.statements[i]);
+        if (!main) continue;
+        if (options.profile) write_profile_record(out, "start", main->body);
+        gen_main_prologue(out, options, use.utf8);
+        emit(i);
+        gen_main_epilogue(out);
+        out << '\n';
+    }
+
+    out.flush();
+}
+
+static RuntimeUse runtime_use(const Statement* stmt, const CodegenOptions& options) {
+    RuntimeUse use;
+    scan_runtime(stmt, options, use);
+    return use;
+}
+
+// What options.profile_use says about the function `name`, if it was
+// profiled with the statements `body` has now.
+static const Profile::Function* matching_profile(const CodegenOptions& options, std::string_view name,
+    Span<Statement*> body) {
+    const Profile::Function* function = options.profile_use ? options.profile_use->find(name) : nullptr;
+    if (!function) return nullptr;
+    std::vector<int> lines;
+    statement_lines(body, lines);
+    return lines == function->lines ? function : nullptr;
+}
+
+static void gen_top_level(OutputSink& out, const CodegenOptions& options, const Interner& symbols,
+    const Statement* stmt) {
+    auto main = node_cast<StartBlock>(stmt);
+    auto func = node_cast<FunctionDef>(stmt);
+    FunctionProfile profile{ main ? "start" : func ? symbols.name(func->name) : "", options.profile, nullptr };
+    FunctionProfile* profiled = nullptr;
+    if ((main || func) && (options.profile || options.profile_use)) {
+        profile.use = matching_profile(options, profile.name, main ? main->body : func->body);
+        profiled = &profile;
+    }
+
+    if (main) {
+        if (options.profile) write_profile_scope(out, profile.name, 1);
+        gen_block(out, options, symbols, main->body, 1, profiled);
     }
+    else {
+        gen_stmt(out, options, symbols, stmt, 0, profiled);
+    }
+}
+
+void generate_cpp(const AST& ast, OutputSink& out, const CodegenOptions& options) {
+    assemble(ast, out, options,
+        [&](size_t i) { return runtime_use(ast.statements[i], options); },
+        [&](size_t i) { gen_top_level(out, options, ast.symbols, ast.statements[i]); });
+}
+
+void generate_cpp(const AST& ast, const std::vector<CppPiece*>& pieces, OutputSink& out,
+    const CodegenOptions& options) {
+    StringSink scratch;
+    auto piece = [&](size_t i) -> const CppPiece& {
+        CppPiece& cached = *pieces[i];
+        if (!cached.valid) {
+            gen_top_level(scratch, options, ast.symbols, ast.statements[i]);
+            cached.code = scratch.take();
+            cached.use = runtime_use(ast.statements[i], options);
+            cached.valid = true;
+        }
+        return cached;
+    };
+    assemble(ast, out, options,
+        [&](size_t i) { return piece(i).use; },
+        [&](size_t i) { out << piece(i).code; });
+}
 
+std::string generate_cpp(const AST& ast, const CodegenOptions& options) {
+    StringSink out;
+    generate_cpp(ast, out, options);
     return out.str();
 }
@@ -2,6 +2,71 @@
 #pragma once
 #include "ast.hpp"
 #include "lexer.hpp"
+#include "output.hpp"
+#include "profile.hpp"
+#include <memory>
 #include <string>
+#include <vector>
 
-std::string generate_cpp(const AST& ast);
\ No newline at end of file
+struct CodegenOptions {
+    // Give stdout a 64 KiB buffer with setvbuf at the top of main, instead of
+    // flushing after every line that ends in '\n', and merge runs of
+    // literal-only say statements into one write.
+    bool buffered_output = false;
+
+    // When set, the generated file includes this header, as written by
+    // write_runtime_header, instead of carrying the runtime inline. One
+    // precompiled header then serves every generated file.
+    std::string runtime_header;
+
+    // Count how often each statement runs and time each function, writing
+    // a profile at exit; see profile.hpp.
+    bool profile = false;
+
+    // A profile from a run of the program, which decides what is inlined
+    // and marks branches that never ran [[unlikely]]. It only guides the
+    // C++ compiler, so a stale one costs speed, never correctness.
+    std::shared_ptr<const Profile> profile_use;
+};
+
+// Which parts of the runtime generated code calls, so a program carries only
+// those.
+struct RuntimeUse {
+    bool text = false;
+    bool values = false;
+    bool flush = false;
+    bool utf8 = false;  // non-ASCII text, which the Windows console needs told about
+    bool math = false;  // integer arithmetic
+
+    RuntimeUse& operator|=(const RuntimeUse& other) {
+        text |= other.text;
+        values |= other.values;
+        flush |= other.flush;
+        utf8 |= other.utf8;
+        math |= other.math;
+        return *this;
+    }
+};
+
+// The generated code of one top-level statement, kept between compiles: a
+// function's definition without its linkage, or the body of main.
+struct CppPiece {
+    std::string code;
+    RuntimeUse use;
+    bool valid = false;  // false until generated, and after the statement changes
+};
+
+// Streams the translation unit into `out` as it is generated.
+void generate_cpp(const AST& ast, OutputSink& out, const CodegenOptions& options = CodegenOptions());
+
+std::string generate_cpp(const AST& ast, const CodegenOptions& options = CodegenOptions());
+
+// Same output, with the code of ast.statements[i] taken from pieces[i],
+// which is generated first if it is not valid. Which functions are emitted,
+// their linkage and the runtime are still decided over the whole AST.
+void generate_cpp(const AST& ast, const std::vector<CppPiece*>& pieces, OutputSink& out,
+    const CodegenOptions& options = CodegenOptions());
+
+// The complete runtime that generated code calls into; see
+// CodegenOptions::runtime_header.
+void write_runtime_header(OutputSink& out);
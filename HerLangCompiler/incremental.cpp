@@ -0,0 +1,237 @@
+// incremental.cpp - Recompiling edited files one top-level statement at a time
+#include "incremental.hpp"
+#include "optimizer.hpp"
+#include "sema.hpp"
+#include "warnings.hpp"
+#include <algorithm>
+#include <functional>
+
+IncrementalCompiler::IncrementalCompiler(const CompileOptions& options, std::string input)
+    : options(options), input(std::move(input)) {}
+
+void IncrementalCompiler::reset() {
+    lexer.reset();
+    ast = AST();
+    units.clear();
+    errors.clear();
+    parsed = false;
+    previous = std::string_view();
+}
+
+// Index of the first token on `line` or later; lines without code have none.
+static size_t first_token_at(const std::vector<Token>& tokens, int line) {
+    auto it = std::lower_bound(tokens.begin(), tokens.end(), line,
+        [](const Token& tok, int n) { return tok.line < n; });
+    return static_cast<size_t>(it - tokens.begin());
+}
+
+static bool has_code(const std::vector<Token>& tokens, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+        TokenType type = tokens[i].type;
+        if (type != TokenType::Newline && type != TokenType::Indent && type != TokenType::Dedent &&
+            type != TokenType::EOFToken) {
+            return true;
+        }
+    }
+    return false;
+}
+
+namespace {
+
+// Moves a kept statement to where its text now is: `line_delta` lines and
+// `byte_delta` bytes further on, from `from` into the text starting at `to`.
+// Literals folded by the optimizer live in the arena and stay where they are.
+struct Move {
+    int line_delta;
+    const char* lo;
+    const char* hi;
+    const char* to;
+    ptrdiff_t byte_delta;
+
+    void text(std::string_view& view) const {
+        std::less<const char*> less;
+        const char* p = view.data();
+        if (!less(p, lo) && less(p, hi)) view = std::string_view(to + (p - lo) + byte_delta, view.size());
+    }
+
+    void expr(Expr* e) const {
+        if (auto number = expr_cast<NumberLiteral>(e)) text(number->text);
+        else if (auto binary = expr_cast<BinaryExpr>(e)) {
+            expr(binary->lhs);
+            expr(binary->rhs);
+        }
+    }
+
+    void stmt(Statement* s) const {
+        s->line += line_delta;
+        switch (s->kind) {
+        case NodeKind::Say: {
+            auto say = static_cast<SayStatement*>(s);
+            for (Argument& arg : say->args) text(arg.text);
+            text(say->end);
+            break;
+        }
+        case NodeKind::Set:
+            expr(static_cast<SetStatement*>(s)->value);
+            break;
+        case NodeKind::Arithmetic:
+            expr(static_cast<ArithmeticStatement*>(s)->operand);
+            break;
+        case NodeKind::FunctionCall:
+            text(static_cast<FunctionCall*>(s)->arg.text);
+            break;
+        case NodeKind::If:
+            for (const Branch& branch : static_cast<IfStatement*>(s)->branches) expr(branch.condition);
+            break;
+        case NodeKind::Repeat:
+            expr(static_cast<RepeatStatement*>(s)->count);
+            break;
+        case NodeKind::Import:
+            text(static_cast<ImportStatement*>(s)->module);
+            break;
+        default:
+            break;
+        }
+        for_each_body(s, [&](Span<Statement*> inner) {
+            for (auto nested : inner) stmt(nested);
+        });
+    }
+};
+
+}
+
+void IncrementalCompiler::parse_all(const std::vector<Token>& tokens) {
+    Parser parser(tokens, std::move(ast.symbols));
+    ast = parser.parse();
+    errors = parser.diagnostics();
+
+    units.clear();
+    for (const TopLevelItem& item : parser.items()) {
+        units.push_back({ item.first_line, item.last_line, item.stmt, item.failed });
+    }
+    reparsed_count = units.size();
+    arena_limit = std::max<size_t>(2 * ast.arena.bytes_used(), 1 << 20);
+}
+
+void IncrementalCompiler::reparse(const std::vector<Token>& tokens, const LineEdit& edit, std::string_view source) {
+    int delta = edit.new_end - edit.old_end;
+    // The lines before the edit are where they were; those after it moved.
+    Move before{ 0, previous.data(), previous.data() + previous.size(), source.data(), 0 };
+    Move after{ delta, before.lo, before.hi, before.to,
+        static_cast<ptrdiff_t>(source.size()) - static_cast<ptrdiff_t>(previous.size()) };
+    auto new_first_line = [&](const Unit& unit) {
+        return unit.first_line >= edit.old_end ? unit.first_line + delta : unit.first_line;
+    };
+
+    // A statement is only kept if its lines did not change, nor the token
+    // after it, which the parser may look at to see where it ends. Units
+    // are found again by line, so one sharing a line with its neighbour is
+    // parsed again with it.
+    std::vector<bool> keep(units.size());
+    for (size_t i = 0; i < units.size(); ++i) {
+        const Unit& unit = units[i];
+        bool has_next = i + 1 < units.size();
+        bool alone = (i == 0 || units[i - 1].last_line < unit.first_line) &&
+            (!has_next || unit.last_line < units[i + 1].first_line);
+        bool before = has_next && units[i + 1].first_line < edit.first;
+        keep[i] = !unit.failed && alone && (before || unit.first_line >= edit.old_end);
+    }
+
+    // Everything between two kept statements is parsed again, in order. A
+    // statement that runs on into the next kept one (say, because its 'end'
+    // was deleted) takes that one with it.
+    Parser parser(tokens);
+    std::vector<Unit> next;
+    next.reserve(units.size() + 1);
+    size_t parsed_to = 0;
+    int gap_line = 1;
+    reparsed_count = 0;
+    for (size_t i = 0; i <= units.size(); ++i) {
+        if (i < units.size() && !keep[i]) continue;
+
+        size_t begin = std::max(parsed_to, first_token_at(tokens, gap_line));
+        size_t end = i < units.size() ? first_token_at(tokens, new_first_line(units[i])) : tokens.size();
+        if (begin > end) continue;
+        if (has_code(tokens, begin, end)) {
+            size_t items_before = parser.items().size();
+            parsed_to = parser.parse_range(ast, begin, end);
+            for (size_t k = items_before; k < parser.items().size(); ++k) {
+                const TopLevelItem& item = parser.items()[k];
+                next.push_back({ item.first_line, item.last_line, item.stmt, item.failed });
+            }
+            reparsed_count += parser.items().size() - items_before;
+            if (parsed_to > end) continue;
+        }
+        if (i == units.size()) break;
+
+        Unit& unit = units[i];
+        const Move& move = unit.first_line >= edit.old_end ? after : before;
+        unit.first_line += move.line_delta;
+        unit.last_line += move.line_delta;
+        if (unit.stmt) move.stmt(unit.stmt);
+        // What a profile says about a statement is found by its lines.
+        if (options.codegen.profile_use && move.line_delta != 0) unit.code.valid = false;
+        gap_line = unit.last_line + 1;
+        parsed_to = std::max(parsed_to, end);
+        next.push_back(std::move(unit));
+    }
+
+    units = std::move(next);
+    errors = parser.diagnostics();
+    ast.statements.clear();
+    for (const Unit& unit : units) {
+        if (unit.stmt) ast.statements.push_back(unit.stmt);
+    }
+}
+
+// As parse() and the optimizer do over a whole AST, for the statements not
+// yet done. Throws at the first error, in source order.
+void IncrementalCompiler::analyze_units() {
+    if (!errors.empty()) throw ParseErrors(errors);
+    for (Unit& unit : units) {
+        if (unit.ready || !unit.stmt) continue;
+        analyze_statement(ast, unit.stmt);
+        if (options.optimize.level > 0) optimize(ast, Span<Statement*>{ &unit.stmt, 1 }, options.optimize);
+        unit.ready = true;
+    }
+}
+
+bool IncrementalCompiler::compile(std::string_view source, OutputSink& out, Diagnostics& diag) {
+    size_t errors = diag.errors();
+    import_set = ImportSet();
+    try {
+        const std::vector<Token>* tokens;
+        {
+            IndentationChecker indentation(diag);
+            tokens = &lexer.lex(source, &indentation, &ast.symbols, &diag);
+            indentation.finish();
+        }
+
+        // After a version with lexer errors the lexer starts over, and so
+        // does the parse.
+        const LineEdit& edit = lexer.last_edit();
+        if (!parsed || edit.full || ast.arena.bytes_used() > arena_limit) parse_all(*tokens);
+        else reparse(*tokens, edit, source);
+        parsed = true;
+        previous = source;
+
+        analyze_units();
+        if (diag.errors() != errors || !link_imports(ast, input, options, diag, &import_set)) return false;
+        if (options.backend == Backend::Cpp) {
+            std::vector<CppPiece*> pieces;
+            pieces.reserve(ast.statements.size());
+            for (Unit& unit : units) {
+                if (unit.stmt) pieces.push_back(&unit.code);
+            }
+            generate_cpp(ast, pieces, out, options.codegen);
+        }
+        else {
+            generate_code(ast, options, out);
+        }
+    }
+    catch (const std::exception& e) {
+        report_error(e, diag);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,76 @@
+// incremental.hpp - Recompiling edited files one top-level statement at a time
+#pragma once
+#include "driver.hpp"
+#include "generator.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Compiles successive versions of one file, such as an editor saves them.
+// Function and start blocks are closed by 'end' and analyzed on their own,
+// so an edit only costs what it touched:
+// - only the lines the IncrementalLexer finds changed are re-lexed;
+// - only the top-level statements on those lines are re-parsed, analyzed
+//   and optimized, with whatever new code lies between their unchanged
+//   neighbours; the statements after them just move to their new lines;
+// - with the C++ backend, only their code is regenerated, and the rest of
+//   the translation unit is reassembled from the code kept for the others.
+//
+// Kept statements are re-pointed at the new text, so only the latest one
+// has to stay alive. Output and diagnostics are the same as compile_file()
+// on the same text, without a cache. Statements with syntax errors are
+// re-parsed on every compile until they are fixed, so all errors are
+// reported each time. Imports are resolved again on every compile, against
+// the modules as they are then.
+class IncrementalCompiler {
+public:
+    // `input` is the path the text comes from, which imports are relative to.
+    IncrementalCompiler(const CompileOptions& options, std::string input);
+
+    // `source` must stay alive, unchanged, until the next compile() or reset().
+    // Returns false, with `out` incomplete, on errors, including warnings
+    // `diag` made errors.
+    bool compile(std::string_view source, OutputSink& out, Diagnostics& diag);
+
+    // Forgets everything, so the next compile() starts from scratch.
+    void reset();
+
+    // Top-level statements the last compile() parsed.
+    size_t reparsed() const { return reparsed_count; }
+
+    // What the last compile() imported, as far as it got.
+    const ImportSet& imports() const { return import_set; }
+
+private:
+    struct Unit {
+        Unit(int first_line, int last_line, Statement* stmt, bool failed)
+            : first_line(first_line), last_line(last_line), stmt(stmt), failed(failed) {}
+
+        int first_line;
+        int last_line;
+        Statement* stmt;     // null if it had errors or produced nothing
+        bool failed;         // had syntax errors
+        bool ready = false;  // analyzed and optimized
+        CppPiece code;
+    };
+
+    void parse_all(const std::vector<Token>& tokens);
+    void reparse(const std::vector<Token>& tokens, const LineEdit& edit, std::string_view source);
+    void analyze_units();
+
+    CompileOptions options;
+    std::string input;
+    IncrementalLexer lexer;
+    // Re-parsed statements are allocated next to the ones they replace, so
+    // the arena only grows; past this size the next compile parses afresh.
+    AST ast;
+    size_t arena_limit = 0;
+    std::vector<Unit> units;
+    std::vector<ParseError> errors;
+    bool parsed = false;
+    std::string_view previous;  // the text `ast` was parsed from
+    size_t reparsed_count = 0;
+    ImportSet import_set;
+};
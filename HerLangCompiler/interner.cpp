@@ -0,0 +1,53 @@
+// interner.cpp - Identifier interning
+#include "interner.hpp"
+
+// FNV-1a; identifiers are short, so this beats anything block-wise.
+static uint32_t hash_name(std::string_view name) {
+    uint32_t hash = 2166136261u;
+    for (unsigned char c : name) {
+        hash ^= c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+SymbolId Interner::find(std::string_view name) const {
+    if (table.empty()) return NoSymbol;
+    uint32_t hash = hash_name(name);
+    size_t mask = table.size() - 1;
+    for (size_t i = hash & mask; table[i] != NoSymbol; i = (i + 1) & mask) {
+        SymbolId id = table[i];
+        if (entries[id - 1].hash == hash && this->name(id) == name) return id;
+    }
+    return NoSymbol;
+}
+
+SymbolId Interner::intern(std::string_view name) {
+    // At most half full, so probes stay short and always end at an empty slot.
+    if ((entries.size() + 1) * 2 > table.size()) grow();
+
+    uint32_t hash = hash_name(name);
+    size_t mask = table.size() - 1;
+    size_t i = hash & mask;
+    for (; table[i] != NoSymbol; i = (i + 1) & mask) {
+        SymbolId id = table[i];
+        if (entries[id - 1].hash == hash && this->name(id) == name) return id;
+    }
+
+    entries.push_back({ static_cast<uint32_t>(text.size()), static_cast<uint32_t>(name.size()), hash });
+    text.append(name);
+    SymbolId id = static_cast<SymbolId>(entries.size());
+    table[i] = id;
+    return id;
+}
+
+void Interner::grow() {
+    std::vector<SymbolId> bigger(table.empty() ? 64 : table.size() * 2, NoSymbol);
+    size_t mask = bigger.size() - 1;
+    for (SymbolId id = 1; id <= entries.size(); ++id) {
+        size_t i = entries[id - 1].hash & mask;
+        while (bigger[i] != NoSymbol) i = (i + 1) & mask;
+        bigger[i] = id;
+    }
+    table.swap(bigger);
+}
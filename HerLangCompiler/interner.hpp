@@ -0,0 +1,39 @@
+// interner.hpp - Identifier interning
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using SymbolId = uint32_t;
+constexpr SymbolId NoSymbol = 0;
+
+// Maps identifier spellings to dense ids (1, 2, ...) so that equal names
+// compare as integers. Spellings are copied into one contiguous buffer, so
+// the interner does not depend on the source it was fed from, and a name()
+// view stays valid until the next intern().
+class Interner {
+public:
+    SymbolId intern(std::string_view name);
+    // NoSymbol if `name` was never interned.
+    SymbolId find(std::string_view name) const;
+    std::string_view name(SymbolId id) const {
+        const Entry& entry = entries[id - 1];
+        return std::string_view(text).substr(entry.offset, entry.length);
+    }
+    size_t size() const { return entries.size(); }
+
+private:
+    struct Entry {
+        uint32_t offset;
+        uint32_t length;
+        uint32_t hash;
+    };
+
+    void grow();
+
+    std::string text;
+    std::vector<Entry> entries;  // entries[id - 1]
+    // Open addressing with linear probing; holds ids, NoSymbol when empty.
+    std::vector<SymbolId> table;
+};
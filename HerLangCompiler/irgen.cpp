@@ -0,0 +1,586 @@
+// irgen.cpp - AST to LLVM IR generator
+#include "irgen.hpp"
+#include "diagnostics.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Typed pointer syntax (i8*) is used throughout: LLVM 14 and older need it,
+// and newer releases read it as an opaque pointer.
+
+namespace {
+
+// What a function's parameter is bound to, per specialization.
+enum class ParamType : uint8_t {
+    None,
+    String,
+    Int,
+    Float
+};
+
+struct Value {
+    std::string ref;  // SSA register or constant
+    ValueType type;
+};
+
+struct Slot {
+    std::string ref;  // alloca'd pointer
+    ValueType type;
+};
+
+struct Specialization {
+    const FunctionDef* func;
+    ParamType param;
+    std::string symbol;
+};
+
+std::string_view ir_type(ValueType type) {
+    return type == ValueType::Float ? "double" : "i64";
+}
+
+std::string_view ir_type(ParamType type) {
+    switch (type) {
+    case ParamType::String: return "i8*";
+    case ParamType::Float:  return "double";
+    default:                return "i64";
+    }
+}
+
+ParamType param_type(ValueType type) {
+    return type == ValueType::Float ? ParamType::Float : ParamType::Int;
+}
+
+ValueType join(ValueType a, ValueType b) {
+    return a == ValueType::Float || b == ValueType::Float ? ValueType::Float : ValueType::Int;
+}
+
+bool is_comparison(BinaryOp op) {
+    return op >= BinaryOp::Less;
+}
+
+// Doubles are written as their bit pattern, which LLVM reads exactly.
+std::string double_constant(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof bits);
+    char buf[24];
+    std::snprintf(buf, sizeof buf, "0x%016llX", static_cast<unsigned long long>(bits));
+    return buf;
+}
+
+// Body of an LLVM c"..." string: printable ASCII as is, everything else as \XX.
+void append_ir_string(std::string& out, std::string_view bytes) {
+    static constexpr char hex[] = "0123456789ABCDEF";
+    for (unsigned char c : bytes) {
+        if (c >= 0x20 && c < 0x7f && c != '"' && c != '\\') {
+            out += static_cast<char>(c);
+        }
+        else {
+            out += '\\';
+            out += hex[c >> 4];
+            out += hex[c & 0xf];
+        }
+    }
+}
+
+// printf format text that prints `text` literally.
+void append_format_literal(std::string& format, std::string_view text) {
+    for (char c : text) {
+        if (c == '%') format += '%';
+        format += c;
+    }
+}
+
+// Integer division as the VM does it: a zero divisor ends the program with
+// `error` on stderr, and dividing by -1 wraps where sdiv would be undefined.
+constexpr std::string_view checked_division =
+    "define internal i64 @herlang.sdiv(i64 %a, i64 %b, i8* %error, i64 %size) {\n"
+    "entry:\n"
+    "  %zero = icmp eq i64 %b, 0\n"
+    "  br i1 %zero, label %fail, label %divide\n"
+    "fail:\n"
+    "  %flushed = call i32 @fflush(i8* null)\n"
+    "  %written = call i64 @write(i32 2, i8* %error, i64 %size)\n"
+    "  call void @exit(i32 1)\n"
+    "  unreachable\n"
+    "divide:\n"
+    "  %wraps = icmp eq i64 %b, -1\n"
+    "  %negated = sub i64 0, %a\n"
+    "  %divisor = select i1 %wraps, i64 1, i64 %b\n"
+    "  %quotient = sdiv i64 %a, %divisor\n"
+    "  %result = select i1 %wraps, i64 %negated, i64 %quotient\n"
+    "  ret i64 %result\n"
+    "}\n\n";
+
+class IrGenerator {
+public:
+    IrGenerator(const AST& ast, OutputSink& out) : ast(ast), out(out) {}
+
+    void run();
+
+private:
+    // Module level
+    std::string_view string_constant(std::string_view bytes);
+    const std::string& specialize(const FunctionDef* func, ParamType param);
+    void emit_function(const Specialization& spec);
+    void begin_function(std::string header, SymbolId param_name, ParamType param);
+    void end_function(std::string_view footer);
+
+    // Function level
+    std::string temp();
+    std::string label();
+    void start_block(const std::string& name);
+    const Slot* lookup(SymbolId name) const;
+    Slot new_slot(std::string_view name, ValueType type);
+    const Slot& declare(SymbolId name, ValueType type);
+    std::string name(SymbolId id) const { return std::string(ast.symbols.name(id)); }
+
+    Value emit_expr(const Expr* expr);
+    std::string emit_as(const Expr* expr, ValueType type);
+    std::string convert(const Value& value, ValueType type);
+    std::string emit_compare(const BinaryExpr* bin);
+    std::string emit_condition(const Expr* expr);
+    std::string emit_arithmetic(BinaryOp op, ValueType type, const std::string& lhs, const std::string& rhs);
+
+    void emit_body(Span<Statement*> statements);
+    void emit_stmt(const Statement* stmt);
+    void emit_say(const SayStatement* say);
+    void emit_call(const FunctionCall* call);
+    void emit_if(const IfStatement* branch_if);
+    void emit_repeat(const RepeatStatement* loop);
+
+    const AST& ast;
+    OutputSink& out;
+
+    std::unordered_map<SymbolId, const FunctionDef*> functions;
+    std::unordered_map<std::string, size_t> specialization_index;
+    std::vector<Specialization> specializations;
+    std::unordered_map<std::string, std::string> strings;  // bytes -> constant expression
+    std::string definitions;  // finished functions, in order
+    std::string globals;
+    bool divides = false;  // some function calls @herlang.sdiv
+
+    // State of the function being generated. Allocas are collected apart so
+    // they all land in the entry block, however deeply their set is nested.
+    std::string allocas;
+    std::string code;
+    unsigned next_temp = 0;
+    unsigned next_label = 0;
+    unsigned next_slot = 0;
+    int line = 0;  // of the statement being generated
+    std::vector<std::unordered_map<SymbolId, Slot>> scopes;
+    SymbolId param_name = NoSymbol;
+    ParamType param = ParamType::None;
+};
+
+void IrGenerator::run() {
+    const StartBlock* start = nullptr;
+    for (auto stmt : ast.statements) {
+        if (auto func = node_cast<FunctionDef>(stmt)) {
+            functions[func->name] = func;
+        }
+        else if (auto block = node_cast<StartBlock>(stmt)) {
+            if (start) throw CompileError(DiagCode::ProgramStructure, block->line, "More than one start block");
+            start = block;
+        }
+    }
+    if (!start) throw CompileError(DiagCode::ProgramStructure, 0, "The LLVM IR backend needs a start block");
+
+    begin_function("define i32 @main()", NoSymbol, ParamType::None);
+    emit_body(start->body);
+    end_function("  ret i32 0\n}\n\n");
+
+    // Generating one function can request more; the list only grows.
+    for (size_t i = 0; i < specializations.size(); ++i) {
+        Specialization spec = specializations[i];
+        emit_function(spec);
+    }
+
+    // Nothing is written before every function has generated, so an error
+    // never leaves part of a module behind.
+    out << "; Generated by hcp\n\n";
+    out << definitions;
+    if (divides) out << checked_division;
+    out << globals;
+    out << "\ndeclare i32 @printf(i8*, ...)\n";
+    if (divides) out << "declare i32 @fflush(i8*)\ndeclare i64 @write(i32, i8*, i64)\ndeclare void @exit(i32)\n";
+    out.flush();
+}
+
+std::string_view IrGenerator::string_constant(std::string_view bytes) {
+    auto [it, inserted] = strings.try_emplace(std::string(bytes));
+    if (inserted) {
+        std::string name = "@.str." + std::to_string(strings.size() - 1);
+        std::string array = "[" + std::to_string(bytes.size() + 1) + " x i8]";
+        globals += name + " = private unnamed_addr constant " + array + " c\"";
+        append_ir_string(globals, bytes);
+        globals += "\\00\"\n";
+        it->second = "getelementptr inbounds (" + array + ", " + array + "* " + name + ", i64 0, i64 0)";
+    }
+    return it->second;
+}
+
+const std::string& IrGenerator::specialize(const FunctionDef* func, ParamType param) {
+    static constexpr std::string_view suffix[] = { "", ".str", ".int", ".float" };
+    std::string symbol = "@herlang." + name(func->name);
+    symbol += suffix[static_cast<size_t>(param)];
+
+    auto [it, inserted] = specialization_index.try_emplace(symbol, specializations.size());
+    if (inserted) specializations.push_back({ func, param, symbol });
+    return specializations[it->second].symbol;
+}
+
+void IrGenerator::emit_function(const Specialization& spec) {
+    std::string header = "define internal void " + spec.symbol + "(";
+    if (spec.param != ParamType::None) header += std::string(ir_type(spec.param)) + " %param";
+    header += ")";
+
+    begin_function(header, spec.func->param, spec.param);
+    emit_body(spec.func->body);
+    end_function("  ret void\n}\n\n");
+}
+
+void IrGenerator::begin_function(std::string header, SymbolId name, ParamType type) {
+    code = std::move(header);
+    code += " {\nentry:\n";
+    allocas.clear();
+    next_temp = next_label = next_slot = 0;
+    scopes.assign(1, {});
+    param_name = name;
+    param = type;
+}
+
+void IrGenerator::end_function(std::string_view footer) {
+    code += footer;
+    code.insert(code.find("entry:\n") + 7, allocas);
+    definitions += code;
+}
+
+std::string IrGenerator::temp() {
+    return "%t" + std::to_string(next_temp++);
+}
+
+std::string IrGenerator::label() {
+    return "L" + std::to_string(next_label++);
+}
+
+void IrGenerator::start_block(const std::string& name) {
+    code += name + ":\n";
+}
+
+const Slot* IrGenerator::lookup(SymbolId name) const {
+    for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+        auto it = scope->find(name);
+        if (it != scope->end()) return &it->second;
+    }
+    return nullptr;
+}
+
+Slot IrGenerator::new_slot(std::string_view name, ValueType type) {
+    Slot slot{ "%v" + std::to_string(next_slot++) + "." + std::string(name), join(type, ValueType::Int) };
+    allocas += "  " + slot.ref + " = alloca " + std::string(ir_type(slot.type)) + "\n";
+    return slot;
+}
+
+const Slot& IrGenerator::declare(SymbolId name, ValueType type) {
+    return scopes.back()[name] = new_slot(ast.symbols.name(name), type);
+}
+
+Value IrGenerator::emit_expr(const Expr* expr) {
+    if (auto num = expr_cast<NumberLiteral>(expr)) {
+        if (expr->type == ValueType::Float) {
+            return { double_constant(std::strtod(std::string(num->text).c_str(), nullptr)), ValueType::Float };
+        }
+        return { std::string(num->text), ValueType::Int };
+    }
+
+    if (auto var = expr_cast<VariableRef>(expr)) {
+        const Slot* slot = lookup(var->name);
+        if (!slot) {
+            throw CompileError(DiagCode::UnknownVariable, 0, "Unknown numeric variable '" + name(var->name) + "'");
+        }
+        std::string t = temp();
+        std::string type(ir_type(slot->type));
+        code += "  " + t + " = load " + type + ", " + type + "* " + slot->ref + "\n";
+        return { t, slot->type };
+    }
+
+    auto bin = static_cast<const BinaryExpr*>(expr);
+    if (is_comparison(bin->op)) {
+        // A comparison used as a number is 0 or 1, as in C++.
+        std::string flag = emit_compare(bin);
+        std::string t = temp();
+        code += "  " + t + " = zext i1 " + flag + " to i64\n";
+        return { t, ValueType::Int };
+    }
+
+    ValueType type = join(bin->lhs->type, bin->rhs->type);
+    std::string lhs = emit_as(bin->lhs, type);
+    std::string rhs = emit_as(bin->rhs, type);
+    return { emit_arithmetic(bin->op, type, lhs, rhs), type };
+}
+
+// Integer add, sub and mul wrap, as without nsw they do; integer division
+// goes through @herlang.sdiv.
+std::string IrGenerator::emit_arithmetic(BinaryOp op, ValueType type, const std::string& lhs, const std::string& rhs) {
+    bool fp = type == ValueType::Float;
+    std::string t = temp();
+    if (op == BinaryOp::Divide && !fp) {
+        std::string error = "[Error] Integer division by zero at line " + std::to_string(line) + "\n";
+        code += "  " + t + " = call i64 @herlang.sdiv(i64 " + lhs + ", i64 " + rhs + ", i8* " +
+            std::string(string_constant(error)) + ", i64 " + std::to_string(error.size()) + ")\n";
+        divides = true;
+        return t;
+    }
+
+    std::string_view name;
+    switch (op) {
+    case BinaryOp::Add:      name = fp ? "fadd" : "add"; break;
+    case BinaryOp::Minus:    name = fp ? "fsub" : "sub"; break;
+    case BinaryOp::Multiply: name = fp ? "fmul" : "mul"; break;
+    default:                 name = "fdiv"; break;
+    }
+    code += "  " + t + " = " + std::string(name) + " " + std::string(ir_type(type)) + " " + lhs + ", " + rhs + "\n";
+    return t;
+}
+
+std::string IrGenerator::emit_as(const Expr* expr, ValueType type) {
+    // Integer literals in a float context become float constants directly.
+    auto num = expr_cast<NumberLiteral>(expr);
+    if (num && type == ValueType::Float) {
+        return double_constant(std::strtod(std::string(num->text).c_str(), nullptr));
+    }
+    return convert(emit_expr(expr), type);
+}
+
+std::string IrGenerator::convert(const Value& value, ValueType type) {
+    ValueType target = join(type, ValueType::Int);
+    if (value.type == target) return value.ref;
+
+    std::string t = temp();
+    if (target == ValueType::Float) code += "  " + t + " = sitofp i64 " + value.ref + " to double\n";
+    else code += "  " + t + " = fptosi double " + value.ref + " to i64\n";
+    return t;
+}
+
+std::string IrGenerator::emit_compare(const BinaryExpr* bin) {
+    ValueType type = join(bin->lhs->type, bin->rhs->type);
+    std::string lhs = emit_as(bin->lhs, type);
+    std::string rhs = emit_as(bin->rhs, type);
+    bool fp = type == ValueType::Float;
+
+    std::string_view op;
+    switch (bin->op) {
+    case BinaryOp::Less:         op = fp ? "fcmp olt" : "icmp slt"; break;
+    case BinaryOp::LessEqual:    op = fp ? "fcmp ole" : "icmp sle"; break;
+    case BinaryOp::Greater:      op = fp ? "fcmp ogt" : "icmp sgt"; break;
+    case BinaryOp::GreaterEqual: op = fp ? "fcmp oge" : "icmp sge"; break;
+    case BinaryOp::Equal:        op = fp ? "fcmp oeq" : "icmp eq"; break;
+    default:                     op = fp ? "fcmp une" : "icmp ne"; break;
+    }
+
+    std::string t = temp();
+    code += "  " + t + " = " + std::string(op) + " " + std::string(ir_type(type)) + " " + lhs + ", " + rhs + "\n";
+    return t;
+}
+
+std::string IrGenerator::emit_condition(const Expr* expr) {
+    auto bin = expr_cast<BinaryExpr>(expr);
+    if (bin && is_comparison(bin->op)) return emit_compare(bin);
+
+    Value value = emit_expr(expr);
+    std::string t = temp();
+    if (value.type == ValueType::Float) code += "  " + t + " = fcmp une double " + value.ref + ", 0.0\n";
+    else code += "  " + t + " = icmp ne i64 " + value.ref + ", 0\n";
+    return t;
+}
+
+void IrGenerator::emit_body(Span<Statement*> statements) {
+    for (auto stmt : statements) emit_stmt(stmt);
+}
+
+void IrGenerator::emit_stmt(const Statement* stmt) {
+    line = stmt->line;
+    switch (stmt->kind) {
+    case NodeKind::Say:
+        emit_say(static_cast<const SayStatement*>(stmt));
+        break;
+    case NodeKind::Set: {
+        auto set = static_cast<const SetStatement*>(stmt);
+        std::string value = set->value ? emit_as(set->value, set->type) : std::string("0");
+        const Slot* slot = set->declares ? &declare(set->var, set->type) : lookup(set->var);
+        if (!set->value && slot->type == ValueType::Float) value = double_constant(0);
+        std::string type(ir_type(slot->type));
+        code += "  store " + type + " " + value + ", " + type + "* " + slot->ref + "\n";
+        break;
+    }
+    case NodeKind::Arithmetic: {
+        auto arith = static_cast<const ArithmeticStatement*>(stmt);
+        const Slot* slot = lookup(arith->var);
+        std::string operand = emit_as(arith->operand, slot->type);
+        std::string type(ir_type(slot->type));
+        std::string old_value = temp();
+        code += "  " + old_value + " = load " + type + ", " + type + "* " + slot->ref + "\n";
+        std::string new_value = emit_arithmetic(arith->op, slot->type, old_value, operand);
+        code += "  store " + type + " " + new_value + ", " + type + "* " + slot->ref + "\n";
+        break;
+    }
+    case NodeKind::FunctionCall:
+        emit_call(static_cast<const FunctionCall*>(stmt));
+        break;
+    case NodeKind::If:
+        emit_if(static_cast<const IfStatement*>(stmt));
+        break;
+    case NodeKind::Repeat:
+        emit_repeat(static_cast<const RepeatStatement*>(stmt));
+        break;
+    case NodeKind::FunctionDef:
+    case NodeKind::StartBlock:
+    case NodeKind::Import:
+        throw CompileError(DiagCode::ProgramStructure, stmt->line, "Nested function or start block");
+    }
+}
+
+void IrGenerator::emit_say(const SayStatement* say) {
+    std::string format;
+    std::string args;
+    for (const Argument& arg : say->args) {
+        if (!arg.is_var()) {
+            append_format_literal(format, arg.text);
+            continue;
+        }
+
+        if (arg.var == param_name && param != ParamType::None && !lookup(arg.var)) {
+            format += param == ParamType::String ? "%s" : param == ParamType::Float ? "%g" : "%lld";
+            args += ", " + std::string(ir_type(param)) + " %param";
+            continue;
+        }
+
+        const Slot* slot = lookup(arg.var);
+        if (!slot) throw CompileError(DiagCode::UnknownVariable, say->line, "Unknown variable '" + name(arg.var) + "'");
+        std::string t = temp();
+        std::string type(ir_type(slot->type));
+        code += "  " + t + " = load " + type + ", " + type + "* " + slot->ref + "\n";
+        // std::cout prints doubles like %g, with six significant digits.
+        format += slot->type == ValueType::Float ? "%g" : "%lld";
+        args += ", " + type + " " + t;
+    }
+    append_format_literal(format, say->end == "\\n" ? std::string_view("\n") : say->end);
+    if (format.empty()) return;
+
+    std::string t = temp();
+    code += "  " + t + " = call i32 (i8*, ...) @printf(i8* " + std::string(string_constant(format)) + args + ")\n";
+}
+
+void IrGenerator::emit_call(const FunctionCall* call) {
+    auto it = functions.find(call->name);
+    if (it == functions.end()) {
+        throw CompileError(DiagCode::UnknownFunction, call->line, "Unknown function '" + name(call->name) + "'");
+    }
+    const FunctionDef* func = it->second;
+    if ((func->param != NoSymbol) != call->has_arg()) {
+        throw CompileError(DiagCode::WrongArguments, call->line,
+            "Wrong number of arguments to '" + name(call->name) + "'");
+    }
+
+    ParamType type = ParamType::None;
+    std::string arg;
+    if (call->arg.is_var()) {
+        if (const Slot* slot = lookup(call->arg.var)) {
+            type = param_type(slot->type);
+            arg = temp();
+            std::string ir(ir_type(slot->type));
+            code += "  " + arg + " = load " + ir + ", " + ir + "* " + slot->ref + "\n";
+        }
+        else if (call->arg.var == param_name && param != ParamType::None) {
+            type = param;
+            arg = "%param";
+        }
+        else {
+            throw CompileError(DiagCode::UnknownVariable, call->line, "Unknown variable '" + name(call->arg.var) + "'");
+        }
+    }
+    else if (call->has_arg()) {
+        type = ParamType::String;
+        arg = string_constant(call->arg.text);
+    }
+
+    code += "  call void " + specialize(func, type) + "(";
+    if (type != ParamType::None) code += std::string(ir_type(type)) + " " + arg;
+    code += ")\n";
+}
+
+void IrGenerator::emit_if(const IfStatement* branch_if) {
+    std::string end = label();
+    for (auto& branch : branch_if->branches) {
+        std::string then = label();
+        std::string next = label();
+        std::string flag = emit_condition(branch.condition);
+        code += "  br i1 " + flag + ", label %" + then + ", label %" + next + "\n";
+
+        start_block(then);
+        scopes.emplace_back();
+        emit_body(branch.body);
+        scopes.pop_back();
+        code += "  br label %" + end + "\n";
+        start_block(next);
+    }
+
+    scopes.emplace_back();
+    emit_body(branch_if->else_body);
+    scopes.pop_back();
+    code += "  br label %" + end + "\n";
+    start_block(end);
+}
+
+void IrGenerator::emit_repeat(const RepeatStatement* loop) {
+    // Evaluated once; analyze() only lets integer counts through.
+    std::string limit = emit_as(loop->count, ValueType::Int);
+
+    scopes.emplace_back();
+    std::string counter_ref = loop->counter == NoSymbol ? new_slot("loop", ValueType::Int).ref
+                                                    : declare(loop->counter, ValueType::Int).ref;
+
+    std::string cond = label();
+    std::string body = label();
+    std::string end = label();
+    code += "  store i64 0, i64* " + counter_ref + "\n";
+    code += "  br label %" + cond + "\n";
+
+    start_block(cond);
+    std::string index = temp();
+    std::string more = temp();
+    code += "  " + index + " = load i64, i64* " + counter_ref + "\n";
+    code += "  " + more + " = icmp slt i64 " + index + ", " + limit + "\n";
+    code += "  br i1 " + more + ", label %" + body + ", label %" + end + "\n";
+
+    start_block(body);
+    scopes.emplace_back();
+    emit_body(loop->body);
+    scopes.pop_back();
+    std::string current = temp();
+    std::string next = temp();
+    code += "  " + current + " = load i64, i64* " + counter_ref + "\n";
+    code += "  " + next + " = add i64 " + current + ", 1\n";
+    code += "  store i64 " + next + ", i64* " + counter_ref + "\n";
+    code += "  br label %" + cond + "\n";
+    scopes.pop_back();
+
+    start_block(end);
+}
+
+}
+
+void generate_llvm_ir(const AST& ast, OutputSink& out) {
+    IrGenerator(ast, out).run();
+}
+
+std::string generate_llvm_ir(const AST& ast) {
+    StringSink out;
+    generate_llvm_ir(ast, out);
+    return out.str();
+}
@@ -0,0 +1,17 @@
+// irgen.hpp - AST to LLVM IR generator
+#pragma once
+#include "ast.hpp"
+#include "output.hpp"
+#include <string>
+
+// Writes the program as a textual LLVM IR module (.ll) into `out`, for
+// `clang out.ll -o out` or `llc`. Output goes through printf, so no C++
+// headers are involved. A function's parameter takes the type of each call's
+// argument, and every combination used gets its own definition. Only
+// functions reachable from start are generated. Throws CompileError
+// for programs the C++ compiler would also reject: no start block, calls to
+// undefined functions, or the wrong number of arguments; nothing is written
+// to `out` then.
+void generate_llvm_ir(const AST& ast, OutputSink& out);
+
+std::string generate_llvm_ir(const AST& ast);
@@ -0,0 +1,100 @@
+// keywords.hpp - Compile-time keyword recognizer
+#pragma once
+#include <cstdint>
+#include <string_view>
+
+enum class KeywordKind : uint8_t {
+    None,
+    Function,
+    Start,
+    End,
+    If,
+    Elif,
+    Else,
+    Say,
+    Set,
+    Add,
+    Minus,
+    Multiply,
+    Divide,
+    Repeat,
+    Import
+};
+
+// Dispatches on length and one distinguishing character, so every word is
+// checked against at most one keyword spelling.
+constexpr KeywordKind classify_keyword(std::string_view w) {
+    auto match = [&](std::string_view kw, KeywordKind kind) {
+        return w == kw ? kind : KeywordKind::None;
+    };
+
+    switch (w.size()) {
+    case 2:
+        return match("if", KeywordKind::If);
+    case 3:
+        switch (w[2]) {
+        case 'd': return w[0] == 'e' ? match("end", KeywordKind::End) : match("add", KeywordKind::Add);
+        case 'y': return match("say", KeywordKind::Say);
+        case 't': return match("set", KeywordKind::Set);
+        default:  return KeywordKind::None;
+        }
+    case 4:
+        switch (w[1]) {
+        case 'l': return w[2] == 'i' ? match("elif", KeywordKind::Elif) : match("else", KeywordKind::Else);
+        default:  return KeywordKind::None;
+        }
+    case 5:
+        switch (w[0]) {
+        case 's': return match("start", KeywordKind::Start);
+        case 'm': return match("minus", KeywordKind::Minus);
+        default:  return KeywordKind::None;
+        }
+    case 6:
+        switch (w[0]) {
+        case 'd': return match("divide", KeywordKind::Divide);
+        case 'r': return match("repeat", KeywordKind::Repeat);
+        case 'i': return match("import", KeywordKind::Import);
+        default:  return KeywordKind::None;
+        }
+    case 8:
+        switch (w[0]) {
+        case 'f': return match("function", KeywordKind::Function);
+        case 'm': return match("multiply", KeywordKind::Multiply);
+        default:  return KeywordKind::None;
+        }
+    default:
+        return KeywordKind::None;
+    }
+}
+
+constexpr std::string_view keyword_name(KeywordKind kind) {
+    switch (kind) {
+    case KeywordKind::Function: return "function";
+    case KeywordKind::Start:    return "start";
+    case KeywordKind::End:      return "end";
+    case KeywordKind::If:       return "if";
+    case KeywordKind::Elif:     return "elif";
+    case KeywordKind::Else:     return "else";
+    case KeywordKind::Say:      return "say";
+    case KeywordKind::Set:      return "set";
+    case KeywordKind::Add:      return "add";
+    case KeywordKind::Minus:    return "minus";
+    case KeywordKind::Multiply: return "multiply";
+    case KeywordKind::Divide:   return "divide";
+    case KeywordKind::Repeat:   return "repeat";
+    case KeywordKind::Import:   return "import";
+    default:                    return "";
+    }
+}
+
+// Every keyword must round-trip through the recognizer.
+constexpr bool keyword_table_is_consistent() {
+    for (int k = static_cast<int>(KeywordKind::Function); k <= static_cast<int>(KeywordKind::Import); ++k) {
+        KeywordKind kind = static_cast<KeywordKind>(k);
+        if (classify_keyword(keyword_name(kind)) != kind) return false;
+    }
+    return true;
+}
+static_assert(keyword_table_is_consistent(), "keyword recognizer out of sync with keyword_name()");
+static_assert(classify_keyword("ends") == KeywordKind::None, "prefixes must not match");
+static_assert(classify_keyword("sad") == KeywordKind::None, "near misses must not match");
@@ -1,66 +1,514 @@
 // lexer.cpp - MyLang lexer implementation
 #include "lexer.hpp"
+#include "diagnostics.hpp"
+#include "scan.hpp"
 #include "utils.hpp"
-#include <regex>
-#include <sstream>
-#include <cctype>
+#include "warnings.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+static CompileError unterminated_string(int lineno, int column) {
+    return CompileError(DiagCode::UnterminatedString, lineno, column, "Unterminated string");
+}
+
+// Records an unterminated string into `diag`, or throws it without one.
+static void report_unterminated(Diagnostics* diag, int lineno, int column) {
+    if (!diag) throw unterminated_string(lineno, column);
+    diag->error(DiagCode::UnterminatedString, lineno, column, "Unterminated string");
+}
+
+namespace {
+
+// A string literal that is not closed, at the column of its quote.
+struct Unterminated {
+    int lineno;
+    int column;
+};
+
+}
+
+// Tokenizes one trimmed, non-empty, non-comment line, which starts `offset`
+// bytes into its raw line. Returns the column of the quote of a string
+// literal that is not closed, or 0; the line's tokens up to that quote are
+// still appended, and its Newline, so lexing can go on with the next line.
+static int lex_line(std::string_view line, int lineno, size_t offset, std::vector<Token>& tokens,
+    Interner* symbols) {
+    auto column = [&](size_t j) { return static_cast<int>(offset + j + 1); };
+    size_t j = 0;
+    while (j < line.size()) {
+        if (is_space(line[j])) {
+            j = skip_spaces(line, j + 1);
+            continue;
+        }
+
+        if (line[j] == '"') {
+            // Parse string literal
+            size_t end = find_byte(line, j + 1, '"');
+            if (end == line.size()) {
+                tokens.push_back({ TokenType::Newline, "\\n", lineno });
+                tokens.back().column = column(line.size());
+                return column(j);
+            }
+            tokens.push_back({ TokenType::StringLiteral, line.substr(j + 1, end - j - 1), lineno });
+            tokens.back().column = column(j);
+            j = end + 1;
+        }
+        else if (is_digit(line[j]) ||
+            (line[j] == '-' && j + 1 < line.size() && is_digit(line[j + 1]))) {
+            // Number literal: -?digits(.digits)?
+            size_t start = j++;
+            while (j < line.size() && is_digit(line[j])) ++j;
+            if (j + 1 < line.size() && line[j] == '.' && is_digit(line[j + 1])) {
+                ++j;
+                while (j < line.size() && is_digit(line[j])) ++j;
+            }
+            tokens.push_back({ TokenType::NumberLiteral, line.substr(start, j - start), lineno });
+            tokens.back().column = column(start);
+        }
+        else if (is_ident_start(line[j])) {
+            // Identifier or keyword
+            size_t start = j;
+            j = skip_ident(line, j + 1);
+            std::string_view word = line.substr(start, j - start);
+            SymbolId symbol = symbols ? symbols->intern(word) : NoSymbol;
+
+            KeywordKind keyword = classify_keyword(word);
+            if (keyword != KeywordKind::None) {
+                tokens.push_back({ TokenType::Keyword, word, lineno, symbol, keyword, column(start) });
+            }
+            else {
+                tokens.push_back({ TokenType::Identifier, word, lineno, symbol, KeywordKind::None, column(start) });
+            }
+        }
+        else if ((line[j] == '<' || line[j] == '>' || line[j] == '=' || line[j] == '!') &&
+            j + 1 < line.size() && line[j + 1] == '=') {
+            // Two-character comparisons: <= >= == !=
+            tokens.push_back({ TokenType::Symbol, line.substr(j, 2), lineno });
+            tokens.back().column = column(j);
+            j += 2;
+        }
+        else if (line[j] == ':' || line[j] == '=' || line[j] == '(' || line[j] == ')' ||
+            line[j] == '<' || line[j] == '>') {
+            // Symbols
+            tokens.push_back({ TokenType::Symbol, line.substr(j, 1), lineno });
+            tokens.back().column = column(j);
+            ++j;
+        }
+        else {
+            // Unexpected character, skip or report
+            ++j;
+        }
+    }
+
+    tokens.push_back({ TokenType::Newline, "\\n", lineno });
+    tokens.back().column = column(line.size());
+    return 0;
+}
+
+// The keyword a trimmed line starts with, if any, without lexing the line.
+static KeywordKind leading_keyword(std::string_view line) {
+    if (!is_ident_start(line[0])) return KeywordKind::None;
+    return classify_keyword(line.substr(0, skip_ident(line, 1)));
+}
+
+static int indent_width(std::string_view raw) {
+    size_t indent = 0;
+    while (indent < raw.size() && raw[indent] == ' ') ++indent;
+    return static_cast<int>(indent);
+}
+
+namespace {
+
+// Turns each line's indentation into layout tokens, Python style: an Indent
+// when a line is deeper than the innermost open level, and a Dedent for
+// every level a shallower line closes. Indentation warnings are fed from the
+// same widths.
+class Layout {
+public:
+    explicit Layout(IndentationChecker* checker) : checker(checker) {}
+
+    // Called before the line's own tokens are appended.
+    void line(int lineno, int indent, KeywordKind first, std::vector<Token>& tokens) {
+        if (checker) checker->line(lineno, indent, first);
+        while (indent < levels.back()) {
+            levels.pop_back();
+            tokens.push_back({ TokenType::Dedent, "", lineno });
+        }
+        if (indent > levels.back()) {
+            levels.push_back(indent);
+            tokens.push_back({ TokenType::Indent, "", lineno });
+        }
+    }
+
+    // Closes every level still open at the end of the file.
+    void finish(int lineno, std::vector<Token>& tokens) {
+        for (; levels.size() > 1; levels.pop_back()) tokens.push_back({ TokenType::Dedent, "", lineno });
+    }
+
+private:
+    IndentationChecker* checker;
+    std::vector<int> levels{ 0 };
+};
+
+// A line as recorded by a chunk, whose layout is only known once the chunks
+// before it have been merged.
+struct LineStart {
+    int lineno;
+    int indent;
+    KeywordKind first;
+    size_t token;  // index of the line's first token in the chunk
+};
+
+// What lex_lines() produced for one run of whole lines.
+struct LexedChunk {
+    std::vector<Token> tokens;
+    std::vector<LineStart> starts;  // recorded without a Layout, or when asked to
+    bool record_starts = false;
+    int lines = 0;
+    std::vector<Unterminated> unterminated;  // in line order
+};
+
+}
 
 std::vector<Token> lex(const std::vector<std::string>& lines) {
     std::vector<Token> tokens;
-    std::regex string_regex("\"(.*?)\"");
+    Layout layout(nullptr);
 
-    for (int i = 0; i < lines.size(); ++i) {
-        std::string line = trim(lines[i]);
+    for (size_t i = 0; i < lines.size(); ++i) {
+        std::string_view line = trim_view(lines[i]);
         if (line.empty() || line[0] == '#') continue;
 
-        size_t j = 0;
-        while (j < line.size()) {
-            if (std::isspace(line[j])) {
-                ++j;
-                continue;
-            }
+        int lineno = static_cast<int>(i) + 1;
+        layout.line(lineno, indent_width(lines[i]), leading_keyword(line), tokens);
+        if (int quote = lex_line(line, lineno, line.data() - lines[i].data(), tokens, nullptr)) {
+            throw unterminated_string(lineno, quote);
+        }
+    }
 
-            if (line[j] == '"') {
-                // Parse string literal
-                size_t end = line.find('"', j + 1);
-                if (end == std::string::npos) {
-                    throw std::runtime_error("Unterminated string at line " + std::to_string(i + 1));
-                }
-                std::string str = line.substr(j + 1, end - j - 1);
-                tokens.push_back({ TokenType::StringLiteral, str, i + 1 });
-                j = end + 1;
+    layout.finish((int)lines.size(), tokens);
+    tokens.push_back({ TokenType::EOFToken, "", (int)lines.size() });
+    return tokens;
+}
+
+// Same line splitting as std::getline: a trailing newline does not start
+// another (empty) line. Lines are numbered from 1 within `source`. With a
+// `layout` their Indent/Dedent tokens are emitted as they go; without one,
+// `chunk.starts` records each line so the merge can (and so it does with one
+// when chunk.record_starts is set). Unterminated strings go to
+// chunk.unterminated; with a layout they are reported as they are found too.
+static void lex_lines(std::string_view source, LexedChunk& chunk, Layout* layout, Interner* symbols,
+    Diagnostics* diag = nullptr) {
+    int lineno = 0;
+    size_t pos = 0;
+
+    while (pos < source.size()) {
+        size_t eol = find_byte(source, pos, '\n');
+        std::string_view raw = source.substr(pos, eol - pos);
+        pos = eol + 1;
+        ++lineno;
+
+        std::string_view line = trim_view(raw);
+        if (line.empty() || line[0] == '#') continue;
+
+        int indent = indent_width(raw);
+        KeywordKind first = leading_keyword(line);
+        if (layout) layout->line(lineno, indent, first, chunk.tokens);
+        if (!layout || chunk.record_starts) chunk.starts.push_back({ lineno, indent, first, chunk.tokens.size() });
+
+        if (int quote = lex_line(line, lineno, line.data() - raw.data(), chunk.tokens, symbols)) {
+            chunk.unterminated.push_back({ lineno, quote });
+            if (layout) report_unterminated(diag, lineno, quote);
+        }
+    }
+    chunk.lines = lineno;
+}
+
+std::vector<Token> lex(std::string_view source, IndentationChecker* indentation, Interner* symbols,
+    Diagnostics* diag) {
+    LexedChunk chunk;
+    Layout layout(indentation);
+    lex_lines(source, chunk, &layout, symbols, diag);
+
+    layout.finish(chunk.lines, chunk.tokens);
+    chunk.tokens.push_back({ TokenType::EOFToken, "", chunk.lines });
+    return std::move(chunk.tokens);
+}
+
+// Appends the chunks in order, renumbering their lines, and emits the layout
+// tokens, indentation warnings and symbols that depend on what came before.
+// Unterminated strings are reported after the layout of their line, as the
+// serial lex() does.
+static std::vector<Token> merge_chunks(const LexedChunk* chunks, size_t count, IndentationChecker* indentation,
+    Interner* symbols, Diagnostics* diag) {
+    std::vector<Token> tokens;
+    size_t total = 1;
+    for (size_t c = 0; c < count; ++c) total += chunks[c].tokens.size() + chunks[c].starts.size();
+    tokens.reserve(total);
+
+    Layout layout(indentation);
+    int base = 0;
+    for (size_t c = 0; c < count; ++c) {
+        const LexedChunk& chunk = chunks[c];
+        size_t next_error = 0;
+        for (size_t i = 0; i < chunk.starts.size(); ++i) {
+            const LineStart& start = chunk.starts[i];
+            layout.line(base + start.lineno, start.indent, start.first, tokens);
+            if (next_error < chunk.unterminated.size() && chunk.unterminated[next_error].lineno == start.lineno) {
+                report_unterminated(diag, base + start.lineno, chunk.unterminated[next_error].column);
+                ++next_error;
             }
-            else if (std::isalpha(line[j]) || line[j] == '_') {
-                // Identifier or keyword
-                size_t start = j;
-                while (j < line.size() && (std::isalnum(line[j]) || line[j] == '_')) ++j;
-                std::string word = line.substr(start, j - start);
-
-                if (word == "function" || word == "start" || word == "end" ||
-                    word == "if" || word == "elif" || word == "else" ||
-                    word == "say" || word == "set" ||
-                    word == "add" || word == "minus" ||
-                    word == "multiply" || word == "divide") {
-                    tokens.push_back({ TokenType::Keyword, word, i + 1 });
-                }
-                else {
-                    tokens.push_back({ TokenType::Identifier, word, i + 1 });
+
+            size_t end = i + 1 < chunk.starts.size() ? chunk.starts[i + 1].token : chunk.tokens.size();
+            for (size_t t = start.token; t < end; ++t) {
+                Token tok = chunk.tokens[t];
+                tok.line += base;
+                if (symbols && (tok.type == TokenType::Identifier || tok.type == TokenType::Keyword)) {
+                    tok.symbol = symbols->intern(tok.value);
                 }
+                tokens.push_back(tok);
             }
-            else if (line[j] == ':' || line[j] == '=' || line[j] == '(' || line[j] == ')') {
-                // Symbols
-                tokens.push_back({ TokenType::Symbol, std::string(1, line[j]), i + 1 });
-                ++j;
+        }
+        base += chunk.lines;
+    }
+
+    layout.finish(base, tokens);
+    tokens.push_back({ TokenType::EOFToken, "", base });
+    return tokens;
+}
+
+std::vector<Token> lex_parallel(std::string_view source, unsigned threads, IndentationChecker* indentation,
+    Interner* symbols, Diagnostics* diag) {
+    // Below this a chunk is not worth a thread.
+    constexpr size_t min_chunk_bytes = 256 * 1024;
+
+    size_t chunk_count = std::min<size_t>(threads, source.size() / min_chunk_bytes);
+    if (chunk_count < 2) return lex(source, indentation, symbols, diag);
+
+    // Cut just after the first newline at or past each even split point, so
+    // every chunk holds whole lines. A very long line can leave chunks empty.
+    std::vector<size_t> cuts{ 0 };
+    for (size_t i = 1; i < chunk_count; ++i) {
+        size_t eol = source.find('\n', std::max(cuts.back(), source.size() / chunk_count * i));
+        cuts.push_back(eol == std::string_view::npos ? source.size() : eol + 1);
+    }
+    cuts.push_back(source.size());
+
+    // Symbols and layout are order-dependent state, so chunks only tokenize;
+    // both are replayed below in source order.
+    std::vector<LexedChunk> chunks(chunk_count);
+    std::atomic<size_t> next{ 0 };
+    auto worker = [&] {
+        for (size_t i; (i = next.fetch_add(1)) < chunk_count;) {
+            LexedChunk& chunk = chunks[i];
+            chunk.tokens.reserve((cuts[i + 1] - cuts[i]) / 4);
+            lex_lines(source.substr(cuts[i], cuts[i + 1] - cuts[i]), chunk, nullptr, nullptr);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (size_t i = 1; i < chunk_count; ++i) pool.emplace_back(worker);
+    worker();
+    for (auto& thread : pool) thread.join();
+
+    return merge_chunks(chunks.data(), chunks.size(), indentation, symbols, diag);
+}
+
+struct IncrementalLexer::State {
+    std::string_view source;
+    std::vector<Token> tokens;
+    std::vector<LineStart> starts;  // LineStart::token indexes `tokens`
+    int lines = 0;
+    bool had_errors = false;        // the next version is lexed from scratch
+    // The previous version's vectors, kept for their capacity: refilling
+    // them is much cheaper than faulting in fresh pages for a large file.
+    std::vector<Token> spare_tokens;
+    std::vector<LineStart> spare_starts;
+};
+
+IncrementalLexer::IncrementalLexer() = default;
+IncrementalLexer::~IncrementalLexer() = default;
+IncrementalLexer::IncrementalLexer(IncrementalLexer&&) noexcept = default;
+IncrementalLexer& IncrementalLexer::operator=(IncrementalLexer&&) noexcept = default;
+
+void IncrementalLexer::reset() {
+    state.reset();
+}
+
+static size_t common_prefix(std::string_view a, std::string_view b) {
+    constexpr size_t block = 4096;
+    size_t n = std::min(a.size(), b.size());
+    size_t i = 0;
+    while (i + block <= n && std::memcmp(a.data() + i, b.data() + i, block) == 0) i += block;
+    while (i < n && a[i] == b[i]) ++i;
+    return i;
+}
+
+// Common trailing bytes, at most `limit`.
+static size_t common_suffix(std::string_view a, std::string_view b, size_t limit) {
+    constexpr size_t block = 4096;
+    const char* a_end = a.data() + a.size();
+    const char* b_end = b.data() + b.size();
+    size_t i = 0;
+    while (i + block <= limit && std::memcmp(a_end - i - block, b_end - i - block, block) == 0) i += block;
+    while (i < limit && *(a_end - i - 1) == *(b_end - i - 1)) ++i;
+    return i;
+}
+
+static bool line_boundary(std::string_view source, size_t offset) {
+    return offset == 0 || source[offset - 1] == '\n';
+}
+
+// First recorded line numbered above `lineno`.
+static size_t first_start_after(const std::vector<LineStart>& starts, int lineno) {
+    auto it = std::upper_bound(starts.begin(), starts.end(), lineno,
+        [](int n, const LineStart& start) { return n < start.lineno; });
+    return static_cast<size_t>(it - starts.begin());
+}
+
+namespace {
+
+// Rebuilds a file's tokens line by line from already lexed lines, in order,
+// into `tokens` and `starts`, which it clears first.
+class Splice {
+public:
+    Splice(IndentationChecker* indentation, std::vector<Token>& tokens, std::vector<LineStart>& starts)
+        : layout(indentation), tokens(tokens), starts(starts) {
+        tokens.clear();
+        starts.clear();
+    }
+
+    // Appends starts[first, end) of `from`, moved down `line_delta` lines.
+    // Tokens viewing `from_source` are re-pointed at the same bytes in
+    // `to_source`, `byte_delta` further on; the others view string literals.
+    // The unterminated strings in `errors`, numbered as in `from`, are
+    // reported into `diag`.
+    void lines(const std::vector<Token>& from, const std::vector<LineStart>& from_starts, size_t first, size_t end,
+        int line_delta, std::string_view from_source, const char* to_source, ptrdiff_t byte_delta,
+        const std::vector<Unterminated>& errors = {}, Diagnostics* diag = nullptr) {
+        size_t next_error = 0;
+        std::less<const char*> less;
+        const char* lo = from_source.data();
+        const char* hi = lo + from_source.size();
+        for (size_t i = first; i < end; ++i) {
+            LineStart start = from_starts[i];
+            bool error = next_error < errors.size() && errors[next_error].lineno == start.lineno;
+            start.lineno += line_delta;
+            layout.line(start.lineno, start.indent, start.first, tokens);
+            if (error) {
+                report_unterminated(diag, start.lineno, errors[next_error].column);
+                ++next_error;
             }
-            else {
-                // Unexpected character, skip or report
-                ++j;
+
+            size_t t = start.token;
+            start.token = tokens.size();
+            starts.push_back(start);
+
+            // A line's own tokens end with its Newline, on the line of an
+            // unterminated string too.
+            for (; t < from.size(); ++t) {
+                Token tok = from[t];
+                const char* p = tok.value.data();
+                if (!less(p, lo) && less(p, hi)) {
+                    tok.value = std::string_view(to_source + (p - lo) + byte_delta, tok.value.size());
+                }
+                tok.line += line_delta;
+                tokens.push_back(tok);
+                if (tok.type == TokenType::Newline) break;
             }
         }
+    }
 
-        tokens.push_back({ TokenType::Newline, "\\n", i + 1 });
+    void finish(int line_count) {
+        layout.finish(line_count, tokens);
+        tokens.push_back({ TokenType::EOFToken, "", line_count });
     }
 
-    tokens.push_back({ TokenType::EOFToken, "", (int)lines.size() });
-    return tokens;
+private:
+    Layout layout;
+    std::vector<Token>& tokens;
+    std::vector<LineStart>& starts;
+};
+
+}
+
+const std::vector<Token>& IncrementalLexer::lex(std::string_view source, IndentationChecker* indentation,
+    Interner* symbols, Diagnostics* diag) {
+    // A version with unterminated strings is not kept for the next one, whose
+    // reports would otherwise have to replay them.
+    if (state && state->had_errors) state.reset();
+    if (!state) {
+        LexedChunk chunk;
+        chunk.record_starts = true;
+        Layout layout(indentation);
+        relexed = source.size();
+        edit = LineEdit{ 1, 1, 1, true };
+        lex_lines(source, chunk, &layout, symbols, diag);
+        edit.new_end = chunk.lines + 1;
+
+        layout.finish(chunk.lines, chunk.tokens);
+        chunk.tokens.push_back({ TokenType::EOFToken, "", chunk.lines });
+        state = std::make_unique<State>();
+        state->source = source;
+        state->tokens = std::move(chunk.tokens);
+        state->starts = std::move(chunk.starts);
+        state->lines = chunk.lines;
+        state->had_errors = !chunk.unterminated.empty();
+        return state->tokens;
+    }
+
+    State& old = *state;
+    std::string_view before = old.source;
+
+    // Whole lines shared at the start, and at the end, of both versions.
+    size_t prefix = common_prefix(before, source);
+    while (prefix > 0 && source[prefix - 1] != '\n') --prefix;
+    size_t suffix = common_suffix(before, source, std::min(before.size(), source.size()) - prefix);
+    size_t new_end = source.size() - suffix;
+    size_t old_end = before.size() - suffix;
+    while (new_end < source.size() && !(line_boundary(source, new_end) && line_boundary(before, old_end))) {
+        size_t eol = find_byte(source, new_end, '\n');
+        new_end = eol == source.size() ? eol : eol + 1;
+        old_end = before.size() - (source.size() - new_end);
+    }
+
+    int prefix_lines = static_cast<int>(std::count(source.data(), source.data() + prefix, '\n'));
+    // With no shared suffix, the old version's last line is replaced even if
+    // it has no newline to count.
+    int old_end_line = new_end == source.size() ? old.lines : prefix_lines +
+        static_cast<int>(std::count(before.data() + prefix, before.data() + old_end, '\n'));
+
+    LexedChunk changed;
+    std::string_view middle = source.substr(prefix, new_end - prefix);
+    lex_lines(middle, changed, nullptr, symbols);
+    relexed = middle.size();
+    edit = LineEdit{ prefix_lines + 1, old_end_line + 1, prefix_lines + changed.lines + 1, false };
+    if (!diag && !changed.unterminated.empty()) {
+        state.reset();
+        const Unterminated& first = changed.unterminated.front();
+        throw unterminated_string(prefix_lines + first.lineno, first.column);
+    }
+
+    Splice splice(indentation, old.spare_tokens, old.spare_starts);
+    size_t kept = first_start_after(old.starts, prefix_lines);
+    splice.lines(old.tokens, old.starts, 0, kept, 0, before, source.data(), 0);
+    splice.lines(changed.tokens, changed.starts, 0, changed.starts.size(), prefix_lines, middle, middle.data(), 0,
+        changed.unterminated, diag);
+
+    int lines = prefix_lines + changed.lines;
+    if (new_end < source.size()) {
+        splice.lines(old.tokens, old.starts, first_start_after(old.starts, old_end_line), old.starts.size(),
+            lines - old_end_line, before, source.data(),
+            static_cast<ptrdiff_t>(new_end) - static_cast<ptrdiff_t>(old_end));
+        lines += old.lines - old_end_line;
+    }
+    splice.finish(lines);
+
+    old.source = source;
+    old.tokens.swap(old.spare_tokens);
+    old.starts.swap(old.spare_starts);
+    old.lines = lines;
+    old.had_errors = !changed.unterminated.empty();
+    return old.tokens;
 }
@@ -1,14 +1,22 @@
 // lexer.hpp - MyLang lexer interface
 #pragma once
+#include <memory>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <sstream>
 
+#include "interner.hpp"
+#include "keywords.hpp"
+
+class Diagnostics;
+class IndentationChecker;
 
 enum class TokenType {
     Keyword,
     Identifier,
     StringLiteral,
+    NumberLiteral,
     Symbol,
     Indent,
     Dedent,
@@ -17,10 +25,90 @@ enum class TokenType {
     Unknown
 };
 
+// Tokens do not own their text: `value` views the buffer that was lexed (or a
+// string literal for synthetic tokens), so that buffer must outlive the tokens
+// and everything built from them. `symbol` is the interned id of keywords and
+// identifiers when lexing with an Interner, and `keyword` says which keyword a
+// Keyword token is, so consumers can switch on it instead of comparing text.
+// `column` is the 1-based byte of the token in its line (its opening quote,
+// for a string), or just past the line's end for its Newline; it is 0 for
+// layout tokens. It sits in what was padding, so tokens do not grow.
 struct Token {
     TokenType type;
-    std::string value;
+    std::string_view value;
     int line;
+    SymbolId symbol = NoSymbol;
+    KeywordKind keyword = KeywordKind::None;
+    int column = 0;
 };
 
+// Every line that holds code starts with its layout tokens: an Indent if it
+// is indented deeper than the innermost open level, or one Dedent for each
+// level it closes; levels still open are closed by Dedents before EOFToken.
+// Indentation counts leading spaces. Nothing in the grammar depends on it,
+// since blocks still close with 'end'.
+
+// Tokens view into `lines`, which must stay alive while they are used.
 std::vector<Token> lex(const std::vector<std::string>& lines);
+
+// Single forward pass over a whole source buffer (e.g. a SourceBuffer view).
+// Lines are split in place. The indentation checker, when given, is fed the
+// same widths and leading keywords the layout tokens come from. Each
+// unterminated string is recorded into `diag`, and its line keeps the tokens
+// before the quote; without `diag`, the first one throws CompileError.
+std::vector<Token> lex(std::string_view source, IndentationChecker* indentation = nullptr,
+    Interner* symbols = nullptr, Diagnostics* diag = nullptr);
+
+// Same tokens, symbol ids and diagnostics as lex(source, ...), but
+// the buffer is cut at line boundaries into chunks that are lexed on up to
+// `threads` threads. Interning, layout tokens and indentation checks stay
+// serial, in source order. Sources under a few hundred KiB per thread are lexed serially.
+std::vector<Token> lex_parallel(std::string_view source, unsigned threads,
+    IndentationChecker* indentation = nullptr, Interner* symbols = nullptr, Diagnostics* diag = nullptr);
+
+// Lines [first, old_end) of one version of a file that were replaced by
+// lines [first, new_end) of the next; later lines moved by new_end - old_end.
+// Lines are numbered from 1. `full` means the new version was lexed from
+// scratch, and nothing is known to be shared.
+struct LineEdit {
+    int first = 1;
+    int old_end = 1;
+    int new_end = 1;
+    bool full = true;
+};
+
+// Lexes successive versions of one file, keeping each version's tokens so
+// that the next is only re-lexed from the first line that differs to the
+// last line that differs. Kept lines are renumbered and their tokens
+// re-pointed at the new buffer; layout tokens and indentation warnings are
+// replayed over the whole file. Results match lex(source, ...). A version
+// with an unterminated string is not kept, so the one after it is lexed
+// from scratch.
+//
+// The previous buffer must still be alive when the next one is lexed, and
+// every call must use the same interner (or none). The returned tokens are
+// valid until the next lex() or reset().
+class IncrementalLexer {
+public:
+    IncrementalLexer();
+    ~IncrementalLexer();
+    IncrementalLexer(IncrementalLexer&&) noexcept;
+    IncrementalLexer& operator=(IncrementalLexer&&) noexcept;
+
+    const std::vector<Token>& lex(std::string_view source, IndentationChecker* indentation = nullptr,
+        Interner* symbols = nullptr, Diagnostics* diag = nullptr);
+
+    // Forgets the kept tokens, so the next lex() scans its whole buffer.
+    void reset();
+
+    // Bytes the last lex() actually scanned.
+    size_t relexed_bytes() const { return relexed; }
+    // What the last lex() found changed since the version before.
+    const LineEdit& last_edit() const { return edit; }
+
+private:
+    struct State;
+    std::unique_ptr<State> state;
+    size_t relexed = 0;
+    LineEdit edit;
+};
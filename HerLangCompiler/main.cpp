@@ -1,85 +1,249 @@
 // main.cpp - Entry point for MyLangCompiler
-#include "lexer.hpp"
-#include "parser.hpp"
-#include "generator.hpp"
-#include "warnings.hpp"
-#include "utils.hpp"
-#include <fstream>
+#include "build.hpp"
+#include "driver.hpp"
+#include "server.hpp"
+#include "stats.hpp"
+#include "version.hpp"
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+enum class TimeReport { None, Text, Json };
+
+static void usage() {
+    std::cerr << "Usage: hcp [options] in.herc out.cpp\n"
+                 "       hcp --batch [options] [-j N] [--manifest list.txt] in1.herc in2.herc ...\n"
+                 "       hcp run [options] in.herc\n"
+                 "       hcp --server [options]\n"
+                 "       hcp build [options] [-j N] [-o out] [--cxx CXX] [--cxxflags FLAGS] in1.herc ...\n"
+                 "Options:\n"
+                 "  -O, -O0, -O1          enable (or disable) AST optimizations\n"
+                 "  --buffered-output     generated programs buffer stdout instead of flushing per say\n"
+                 "  --emit-llvm           generate LLVM IR (.ll) instead of C++\n"
+                 "  --runtime-header H    include H instead of inlining the runtime\n"
+                 "  --write-runtime-header FILE  write the runtime header to FILE\n"
+                 "  --profile             generated programs write per-line counts to herlang.profile\n"
+                 "  --profile-use FILE    let a profile guide inlining and branch layout\n"
+                 "  --cache-dir DIR       reuse generated code for unchanged inputs\n"
+                 "  -Werror               treat warnings as errors\n"
+                 "  -Wno-CODE             suppress the warning CODE, such as -Wno-body-indent\n"
+                 "  --diagnostics=json    print diagnostics as JSON lines instead of text\n"
+                 "  -j N                  worker threads: files for --batch and build, lexer chunks otherwise\n"
+                 "  --time-report[=json]  print per-phase timings and counters to stderr\n"
+                 "  --version             print the compiler version\n";
+}
+
+// A -j count: all digits, at least 1 and at most what fits in `threads`.
+static bool parse_threads(const char* text, unsigned& threads) {
+    std::string_view digits = text;
+    unsigned value = 0;
+    auto [end, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), value);
+    if (ec != std::errc() || end != digits.data() + digits.size() || value == 0) return false;
+    threads = value;
+    return true;
+}
+
+static void report(TimeReport mode, const std::vector<CompileStats>& stats) {
+    if (mode == TimeReport::Text) print_time_report(std::cerr, stats);
+    else if (mode == TimeReport::Json) print_time_report_json(std::cerr, stats);
+}
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        std::cerr << "Usage: hcp in.herc out.cpp\n";
-        return 1;
+    // Subcommands only count in first position.
+    std::string_view command = argc > 1 ? argv[1] : "";
+    bool run = command == "run";
+    bool build = command == "build";
+    bool batch = false;
+    bool server = false;
+    unsigned threads = std::thread::hardware_concurrency();
+    TimeReport time_report = TimeReport::None;
+    CompileOptions options;
+    std::vector<CompileJob> jobs;
+    std::vector<std::string> positional;
+    std::vector<std::string> manifests;
+
+    BuildOptions build_options;
+    std::string build_output;
+
+    for (int i = run || build ? 2 : 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg == "--batch") {
+            batch = true;
+        }
+        else if (arg == "--server") {
+            server = true;
+        }
+        else if (arg == "--version") {
+            std::cout << "hcp " HCP_VERSION "\n";
+            return 0;
+        }
+        else if (arg == "-O" || arg == "-O1") {
+            options.optimize.level = 1;
+        }
+        else if (arg == "-O0") {
+            options.optimize.level = 0;
+        }
+        else if (arg == "--buffered-output") {
+            options.codegen.buffered_output = true;
+        }
+        else if (arg == "--runtime-header" && i + 1 < argc) {
+            options.codegen.runtime_header = argv[++i];
+        }
+        else if (arg == "--write-runtime-header" && i + 1 < argc) {
+            FileSink header;
+            if (!header.open(argv[++i])) {
+                std::cerr << "Cannot write to output file: " << argv[i] << "\n";
+                return 1;
+            }
+            write_runtime_header(header);
+            return header.close() ? 0 : 1;
+        }
+        else if (arg == "--profile") {
+            options.codegen.profile = true;
+        }
+        else if (arg == "--profile-use" && i + 1 < argc) {
+            auto profile = std::make_shared<Profile>();
+            if (!load_profile(argv[++i], *profile)) {
+                std::cerr << "Cannot read profile: " << argv[i] << "\n";
+                return 1;
+            }
+            options.codegen.profile_use = std::move(profile);
+        }
+        else if (arg == "--emit-llvm") {
+            options.backend = Backend::LlvmIr;
+        }
+        else if (arg == "--cache-dir" && i + 1 < argc) {
+            options.cache_dir = argv[++i];
+        }
+        else if (arg == "-Werror") {
+            options.diagnostics.warnings_as_errors = true;
+        }
+        else if (arg.substr(0, 5) == "-Wno-") {
+            DiagCode code;
+            if (!find_diag_code(arg.substr(5), code) || !is_warning_code(code)) {
+                std::cerr << "Unknown warning: " << arg.substr(5) << "\n";
+                return 1;
+            }
+            options.diagnostics.suppress(code);
+        }
+        else if (arg == "--diagnostics=json") {
+            options.diagnostics.format = DiagnosticFormat::Json;
+        }
+        else if (arg == "--diagnostics=text") {
+            options.diagnostics.format = DiagnosticFormat::Text;
+        }
+        else if (arg == "--time-report") {
+            time_report = TimeReport::Text;
+        }
+        else if (arg == "--time-report=json") {
+            time_report = TimeReport::Json;
+        }
+        else if (arg.substr(0, 2) == "-j" && (arg.size() > 2 || i + 1 < argc)) {
+            if (!parse_threads(arg.size() > 2 ? argv[i] + 2 : argv[++i], threads)) {
+                usage();
+                return 1;
+            }
+        }
+        else if (build && arg == "--cxx" && i + 1 < argc) {
+            build_options.cxx = argv[++i];
+        }
+        else if (build && arg == "--cxxflags" && i + 1 < argc) {
+            build_options.cxxflags = argv[++i];
+        }
+        else if (build && arg == "-o" && i + 1 < argc) {
+            build_output = argv[++i];
+        }
+        else if (batch && arg == "--manifest" && i + 1 < argc) {
+            manifests.push_back(argv[++i]);
+        }
+        else {
+            positional.push_back(argv[i]);
+        }
     }
 
-    std::ifstream input(argv[1]);
-    if (!input) {
-        std::cerr << "Cannot open input file: " << argv[1] << "\n";
-        return 1;
+    std::vector<CompileStats> stats;
+    std::vector<CompileStats>* stats_out = time_report != TimeReport::None ? &stats : nullptr;
+
+    if (server) {
+        if (!positional.empty()) {
+            usage();
+            return 1;
+        }
+        CompileServer compile_server(options);
+        compile_server.serve(std::cin, std::cout);
+        return 0;
+    }
+
+    if (run) {
+        if (positional.size() != 1) {
+            usage();
+            return 1;
+        }
+        options.lex_threads = threads;
+        stats.resize(1);
+        Diagnostics diag(options.diagnostics);
+        bool ok = run_file(positional[0], options, diag, stats_out ? &stats[0] : nullptr);
+        diag.print(std::cerr);
+        report(time_report, stats);
+        return ok ? 0 : 1;
     }
 
-    std::string source((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
-    input.close();
-
-    check_indentation(source); // Check for indentation warnings
-
-    auto lines = split_lines(source);
-    auto tokens = lex(lines);
-#if _DEBUG
-    std::cerr << "=== Tokens ===\n";
-    for (const auto& tok : tokens) {
-        std::cerr << "[" << tok.line << "] ";
-        switch (tok.type) {
-        case TokenType::Keyword:        std::cerr << "Keyword    "; break;
-        case TokenType::Identifier:     std::cerr << "Identifier "; break;
-        case TokenType::StringLiteral:  std::cerr << "String     "; break;
-        case TokenType::Newline:        std::cerr << "Newline    "; break;
-        case TokenType::EOFToken:       std::cerr << "EOF        "; break;
-        case TokenType::Symbol:         std::cerr << "Symbol     "; break;
-        }
-        std::cerr << ": " << tok.value << "\n";
+    if (build) {
+        for (const auto& input : positional) jobs.push_back({ input, default_executable_path(input) });
+        if (jobs.empty() || (!build_output.empty() && jobs.size() != 1)) {
+            usage();
+            return 1;
+        }
+        if (!build_output.empty()) jobs[0].output = build_output;
+
+        size_t failures = build_batch(jobs, options, build_options, threads, stats_out);
+        report(time_report, stats);
+        std::cout << "Built " << jobs.size() - failures << " of " << jobs.size() << " programs\n";
+        return failures == 0 ? 0 : 1;
     }
-    std::cerr << "==============\n";
-
-#endif
-    auto ast = parse(tokens);
-#if _DEBUG
-    std::cerr << "=== AST ===\n";
-    for (const auto& stmt : ast.statements) {
-        if (auto func = std::dynamic_pointer_cast<FunctionDef>(stmt)) {
-            std::cerr << "Function: " << func->name << "(" << func->param << "), body size = " << func->body.size() << "\n";
-            for (auto& inner : func->body) {
-                if (auto say = std::dynamic_pointer_cast<SayStatement>(inner)) {
-                    std::cerr << "  Say: ";
-                    for (size_t i = 0; i < say->args.size(); ++i) {
-                        if (say->is_vars[i]) {
-                            std::cerr << "VAR(" << say->args[i] << ") ";
-                        }
-                        else {
-                            std::cerr << "\"" << say->args[i] << "\" ";
-                        }
-                    }
-                    std::cerr << "ending = \"" << say->end << "\"\n";
-                }
+
+    if (batch) {
+        // Read after every option, since the backend picks the default extension.
+        for (const auto& manifest : manifests) {
+            if (!read_manifest(manifest, jobs, output_extension(options))) {
+                std::cerr << "Cannot open manifest: " << manifest << "\n";
+                return 1;
             }
         }
-        else if (auto start = std::dynamic_pointer_cast<StartBlock>(stmt)) {
-            std::cerr << "Start block, body size = " << start->body.size() << "\n";
+        for (const auto& input : positional) jobs.push_back({ input, default_output_path(input, output_extension(options)) });
+        if (jobs.empty()) {
+            usage();
+            return 1;
         }
+
+        size_t failures = compile_batch(jobs, options, threads, stats_out);
+        report(time_report, stats);
+        std::cout << "Compiled " << jobs.size() - failures << " of " << jobs.size() << " files\n";
+        return failures == 0 ? 0 : 1;
     }
-    std::cerr << "===========\n";
-#endif
-    auto cpp_code = generate_cpp(ast);
 
-    std::ofstream output(argv[2]);
-    if (!output) {
-        std::cerr << "Cannot write to output file: " << argv[2] << "\n";
+    if (positional.size() != 2) {
+        usage();
         return 1;
     }
-    output << cpp_code;
-    output.close();
 
-    std::cout << "Compilation successful: " << argv[2] << "\n";
+    CompileJob job{ positional[0], positional[1] };
+    options.lex_threads = threads;
+    stats.resize(1);
+    Diagnostics diag(options.diagnostics);
+    bool ok = compile_file(job, options, diag, stats_out ? &stats[0] : nullptr);
+    diag.print(std::cerr);
+    report(time_report, stats);
+    if (!ok) return 1;
+
+    // "-" streams the generated code to stdout, which must stay clean for a pipe.
+    if (job.output == "-") return 0;
+    std::cout << "Compilation successful: " << job.output << "\n";
     return 0;
 }
@@ -0,0 +1,350 @@
+// modules.cpp - Imports: finding modules and what they export
+#include "modules.hpp"
+#include "cache.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "source.hpp"
+#include "version.hpp"
+#include <filesystem>
+#include <mutex>
+#include <system_error>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+std::string resolve_module(const std::string& importer, const ModuleImport& import) {
+    fs::path dir = fs::path(importer).parent_path();
+    std::error_code ec;
+    if (import.is_path) {
+        fs::path path = (dir / import.module).lexically_normal();
+        return fs::is_regular_file(path, ec) ? path.string() : std::string();
+    }
+    for (const char* extension : { ".herc", ".herlang" }) {
+        fs::path path = (dir / (import.module + extension)).lexically_normal();
+        if (fs::is_regular_file(path, ec)) return path.string();
+    }
+    return std::string();
+}
+
+const ImportStatement* first_import(const AST& ast) {
+    for (const Statement* stmt : ast.statements) {
+        if (auto import = node_cast<ImportStatement>(stmt)) return import;
+    }
+    return nullptr;
+}
+
+uint64_t with_imports(uint64_t key, uint64_t digest) {
+    return hash_bytes(std::string_view(reinterpret_cast<const char*>(&digest), sizeof(digest)), key);
+}
+
+// Chained over the interfaces in import order, by the hash of each.
+static uint64_t add_to_digest(uint64_t digest, const ModuleInterface& module) {
+    return hash_bytes(std::string_view(reinterpret_cast<const char*>(&module.hash), sizeof(module.hash)), digest);
+}
+
+static uint64_t interface_hash(const std::vector<ModuleInterface::Function>& functions) {
+    std::string text;
+    for (const auto& function : functions) {
+        text += function.name;
+        text += function.has_param ? " 1\n" : " 0\n";
+    }
+    return hash_bytes(text);
+}
+
+static void append_import(std::string& out, const ModuleImport& import) {
+    out += "import ";
+    out += import.is_path ? '1' : '0';
+    out += ' ';
+    out += import.module;
+    out += '\n';
+}
+
+// "import 0 name" or "import 1 path", the module taking the rest of the line.
+static bool parse_import_line(std::string_view line, ModuleImport& import) {
+    if (line.size() < 10 || line.substr(0, 7) != "import " || (line[7] != '0' && line[7] != '1') || line[8] != ' ') {
+        return false;
+    }
+    import.is_path = line[7] == '1';
+    import.module = std::string(line.substr(9));
+    return true;
+}
+
+static const char imports_header[] = "hcp-imports 1\n";
+
+static std::string save_imports(const std::vector<ModuleImport>& imports) {
+    std::string out = imports_header;
+    for (const ModuleImport& import : imports) append_import(out, import);
+    return out;
+}
+
+// Splits `data` into newline-terminated lines after `header`.
+template <typename Fn>
+static bool for_each_line(std::string_view data, std::string_view header, Fn&& fn) {
+    if (data.substr(0, header.size()) != header) return false;
+    data.remove_prefix(header.size());
+    while (!data.empty()) {
+        size_t end = data.find('\n');
+        if (end == std::string_view::npos || !fn(data.substr(0, end))) return false;
+        data.remove_prefix(end + 1);
+    }
+    return true;
+}
+
+static bool load_imports(std::string_view data, std::vector<ModuleImport>& imports) {
+    std::vector<ModuleImport> loaded;
+    bool ok = for_each_line(data, imports_header, [&](std::string_view line) {
+        ModuleImport import;
+        if (!parse_import_line(line, import)) return false;
+        loaded.push_back(std::move(import));
+        return true;
+    });
+    if (ok) imports = std::move(loaded);
+    return ok;
+}
+
+// On disk: "start 0|1", then "function 0|1 name" and "import 0|1 module"
+// lines. Broken modules are never stored, so their errors are found again.
+static const char interface_header[] = "hcp-interface 1\n";
+
+static std::string save_interface(const ModuleInterface& module) {
+    std::string out = interface_header;
+    out += module.has_start ? "start 1\n" : "start 0\n";
+    for (const auto& function : module.functions) {
+        out += function.has_param ? "function 1 " : "function 0 ";
+        out += function.name;
+        out += '\n';
+    }
+    for (const ModuleImport& import : module.imports) append_import(out, import);
+    return out;
+}
+
+static bool load_interface_data(std::string_view data, ModuleInterface& module) {
+    bool first = true;
+    bool ok = for_each_line(data, interface_header, [&](std::string_view line) {
+        if (first) {
+            first = false;
+            if (line != "start 0" && line != "start 1") return false;
+            module.has_start = line == "start 1";
+            return true;
+        }
+        if (line.substr(0, 9) == "function " && line.size() > 11 && (line[9] == '0' || line[9] == '1') &&
+            line[10] == ' ') {
+            module.functions.push_back({ std::string(line.substr(11)), line[9] == '1' });
+            return true;
+        }
+        ModuleImport import;
+        if (!parse_import_line(line, import)) return false;
+        module.imports.push_back(std::move(import));
+        return true;
+    });
+    if (!ok || first) return false;
+    module.hash = interface_hash(module.functions);
+    return true;
+}
+
+// Runs the front end over a module for what it defines; its warnings are
+// for whoever compiles the module itself.
+static void extract_interface(std::string_view source, ModuleInterface& module) {
+    try {
+        Interner symbols;
+        std::vector<Token> tokens = lex(source, nullptr, &symbols);
+        AST ast = parse(tokens, std::move(symbols));
+        for (const Statement* stmt : ast.statements) {
+            if (auto func = node_cast<FunctionDef>(stmt)) {
+                module.functions.push_back({ std::string(ast.symbols.name(func->name)), func->param != NoSymbol });
+            }
+            else if (auto import = node_cast<ImportStatement>(stmt)) {
+                module.imports.push_back({ std::string(import->module), import->is_path, import->line });
+            }
+            else if (stmt->kind == NodeKind::StartBlock) {
+                module.has_start = true;
+            }
+        }
+    }
+    catch (const std::exception&) {
+        module = ModuleInterface();
+        module.broken = true;
+    }
+    module.hash = interface_hash(module.functions);
+}
+
+namespace {
+
+struct KnownModule {
+    uint64_t content;
+    std::shared_ptr<const ModuleInterface> module;
+};
+
+std::mutex known_mutex;
+std::unordered_map<std::string, KnownModule> known;  // by path, as last loaded
+
+}
+
+std::shared_ptr<const ModuleInterface> load_interface(const std::string& path, const std::string& cache_dir) {
+    SourceBuffer source;
+    if (!source.open(path)) return nullptr;
+    uint64_t content = hash_bytes(source.view(), hash_bytes("hcp " HCP_VERSION " interface"));
+    {
+        std::lock_guard<std::mutex> lock(known_mutex);
+        auto it = known.find(path);
+        if (it != known.end() && it->second.content == content) return it->second.module;
+    }
+
+    auto module = std::make_shared<ModuleInterface>();
+    CompileCache cache(cache_dir);
+    std::string cached;
+    if (cache_dir.empty() || !cache.read_file(cache.interface_path(content), cached) ||
+        !load_interface_data(cached, *module)) {
+        *module = ModuleInterface();
+        extract_interface(source.view(), *module);
+        if (!cache_dir.empty() && !module->broken) {
+            cache.store_file(cache.interface_path(content), save_interface(*module));
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(known_mutex);
+    known[path] = { content, module };
+    return module;
+}
+
+namespace {
+
+// A module found for an import, and the interface it had.
+struct FoundModule {
+    std::string path;
+    std::shared_ptr<const ModuleInterface> module;
+};
+
+}
+
+static std::string module_name(const ModuleImport& import) {
+    return "'" + import.module + "'";
+}
+
+// Finds the module `import` names and loads its interface. With `diag`,
+// says why when that fails; returns false, or true with an empty path for a
+// module imported already.
+static bool find_module(const ModuleImport& import, const std::string& importer, const std::string& self,
+    const std::string& cache_dir, std::vector<FoundModule>& found, Diagnostics* diag) {
+    auto fail = [&](const std::string& message) {
+        if (diag) diag->error(DiagCode::Import, import.line, 0, message);
+        return false;
+    };
+
+    std::string path = resolve_module(importer, import);
+    if (path.empty()) return fail("Cannot find module " + module_name(import));
+    if (path == self) return fail("A file cannot import itself");
+    for (const FoundModule& known_module : found) {
+        if (known_module.path == path) return true;
+    }
+
+    auto module = load_interface(path, cache_dir);
+    if (!module) return fail("Cannot read module " + module_name(import) + ": " + path);
+    if (module->broken) return fail("Module " + module_name(import) + " does not compile: " + path);
+    if (module->has_start) {
+        return fail("Module " + module_name(import) + " has a start block, so it cannot be imported");
+    }
+    found.push_back({ path, module });
+    return true;
+}
+
+bool import_digest(const std::vector<ModuleImport>& imports, const std::string& importer,
+    const std::string& cache_dir, uint64_t& digest) {
+    std::string self = fs::path(importer).lexically_normal().string();
+    std::vector<FoundModule> found;
+    for (const ModuleImport& import : imports) {
+        if (!find_module(import, importer, self, cache_dir, found, nullptr)) return false;
+    }
+    digest = 0;
+    for (const FoundModule& module : found) digest = add_to_digest(digest, *module.module);
+    return true;
+}
+
+bool resolve_imports(AST& ast, const std::string& input, const std::string& cache_dir, Diagnostics& diag,
+    ImportSet& imports, bool linked) {
+    imports = ImportSet();
+    ast.externs.clear();
+    if (!first_import(ast)) return true;
+    size_t errors = diag.errors();
+
+    std::unordered_map<SymbolId, const FunctionDef*> local;
+    for (const Statement* stmt : ast.statements) {
+        if (auto func = node_cast<FunctionDef>(stmt)) local.emplace(func->name, func);
+    }
+
+    std::string self = fs::path(input).lexically_normal().string();
+    std::vector<FoundModule> found;
+    std::vector<int> found_line;  // of the import that found each one
+    std::unordered_map<SymbolId, std::string> provider;
+    for (const Statement* stmt : ast.statements) {
+        auto import = node_cast<ImportStatement>(stmt);
+        if (!import) continue;
+        imports.imports.push_back({ std::string(import->module), import->is_path, import->line });
+        const ModuleImport& spec = imports.imports.back();
+
+        size_t before = found.size();
+        if (!find_module(spec, input, self, cache_dir, found, &diag) || found.size() == before) continue;
+        found_line.push_back(spec.line);
+        imports.digest = add_to_digest(imports.digest, *found.back().module);
+
+        for (const auto& function : found.back().module->functions) {
+            SymbolId id = ast.symbols.intern(function.name);
+            auto defined = local.find(id);
+            if (defined != local.end()) {
+                diag.error(DiagCode::ProgramStructure, defined->second->line, 0,
+                    "Function '" + function.name + "' is also defined in module " + module_name(spec));
+                continue;
+            }
+            auto [other, inserted] = provider.emplace(id, spec.module);
+            if (!inserted) {
+                diag.error(DiagCode::ProgramStructure, spec.line, 0, "Function '" + function.name +
+                    "' is defined in both module '" + other->second + "' and module " + module_name(spec));
+                continue;
+            }
+            ast.externs.push_back({ id, function.has_param });
+        }
+    }
+
+    if (diag.errors() != errors || !linked) return diag.errors() == errors;
+
+    // The modules this one imports need theirs at link time too, and so on;
+    // their interfaces say which.
+    for (size_t i = 0; i < found.size(); ++i) {
+        // Reported at the import in this file that led to it.
+        int line = found_line[i];
+        FoundModule importer = found[i];
+        std::string importer_self = fs::path(importer.path).lexically_normal().string();
+        for (ModuleImport spec : importer.module->imports) {
+            spec.line = line;
+            if (!find_module(spec, importer.path, importer_self, cache_dir, found, nullptr)) {
+                diag.error(DiagCode::Import, line, 0, "Module '" + fs::path(importer.path).filename().string() +
+                    "' imports " + module_name(spec) + ", which cannot be loaded");
+                break;
+            }
+            found_line.resize(found.size(), line);
+        }
+    }
+    for (const FoundModule& module : found) imports.modules.push_back(module.path);
+    return diag.errors() == errors;
+}
+
+bool cached_entry_key(const std::string& cache_dir, const std::string& input, uint64_t key, uint64_t& entry,
+    std::vector<ModuleImport>* recorded) {
+    CompileCache cache(cache_dir);
+    std::string data;
+    std::vector<ModuleImport> imports;
+    entry = key;
+    if (!cache.read_file(cache.imports_path(key), data)) return true;
+    uint64_t digest;
+    if (!load_imports(data, imports) || !import_digest(imports, input, cache_dir, digest)) return false;
+    entry = with_imports(key, digest);
+    if (recorded) *recorded = std::move(imports);
+    return true;
+}
+
+uint64_t store_imports(const std::string& cache_dir, uint64_t key, const ImportSet& imports) {
+    if (imports.imports.empty()) return key;
+    CompileCache cache(cache_dir);
+    cache.store_file(cache.imports_path(key), save_imports(imports.imports));
+    return with_imports(key, imports.digest);
+}
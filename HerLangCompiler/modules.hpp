@@ -0,0 +1,92 @@
+// modules.hpp - Imports: finding modules and what they export
+#pragma once
+#include "ast.hpp"
+#include "diagnostics.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A module is any file without a start block. Importing it makes its
+// functions callable; their code is not copied in, but generated and
+// compiled once, from the module itself, and linked with every program that
+// imports it. All an importer needs is the module's interface: which
+// functions it defines and whether they take an argument.
+
+// One `import`, as written.
+struct ModuleImport {
+    std::string module;  // the name, or the path
+    bool is_path = false;
+    int line = 0;
+};
+
+// What a module makes available to the files that import it.
+struct ModuleInterface {
+    struct Function {
+        std::string name;
+        bool has_param;
+    };
+
+    std::vector<Function> functions;    // in definition order
+    std::vector<ModuleImport> imports;  // its own, for linking
+    bool has_start = false;             // so it is a program, and cannot be imported
+    bool broken = false;                // it does not compile
+    uint64_t hash = 0;                  // of `functions`, all importers' code depends on
+};
+
+// How the imports of one file were resolved.
+struct ImportSet {
+    std::vector<ModuleImport> imports;  // as written, in order
+    // Of the interfaces of the modules imported, which generated code
+    // depends on; see with_imports().
+    uint64_t digest = 0;
+    // Every module a program needs at link time, its imports' imports
+    // included, once each, when asked for.
+    std::vector<std::string> modules;
+};
+
+// The module `import` names in the file `importer`. A path is taken
+// relative to the importer's directory; a name is looked for there as
+// name.herc, then name.herlang. Empty when there is no such file.
+std::string resolve_module(const std::string& importer, const ModuleImport& import);
+
+// The interface of the module at `path`; null if it cannot be read. Every
+// interface is remembered for the life of the process and, with a cache
+// directory, kept there, both keyed by the module's content, so a module is
+// parsed once however many files import it. Thread-safe.
+std::shared_ptr<const ModuleInterface> load_interface(const std::string& path, const std::string& cache_dir);
+
+// Finds what `ast`, parsed from `input`, imports; checks that no function
+// is defined twice; and fills in ast.externs, against which check_calls()
+// then checks the calls into modules. With `linked`, the
+// full closure of modules is gathered as well. Errors go to `diag`; returns
+// false if there were any. Does nothing for a file without imports.
+bool resolve_imports(AST& ast, const std::string& input, const std::string& cache_dir, Diagnostics& diag,
+    ImportSet& imports, bool linked = false);
+
+// Recomputes ImportSet::digest for `imports` written in `importer`, from
+// the modules as they are now. False when one of them cannot be loaded, so
+// only compiling the importer can say why.
+bool import_digest(const std::vector<ModuleImport>& imports, const std::string& importer,
+    const std::string& cache_dir, uint64_t& digest);
+
+// A cache key for code generated from a file with imports: `key`, from its
+// source and options, combined with `digest`.
+uint64_t with_imports(uint64_t key, uint64_t digest);
+
+// The key the compile cache in `cache_dir` keeps the code generated from
+// `input` under, when `key` is that of its source and options: `key` itself
+// for a file without imports, and with_imports() of it, from the imports
+// recorded by store_imports(), for one with. False when the modules have to
+// be found again by compiling the file. `recorded`, when given, receives
+// those imports.
+bool cached_entry_key(const std::string& cache_dir, const std::string& input, uint64_t key, uint64_t& entry,
+    std::vector<ModuleImport>* recorded = nullptr);
+
+// Records in `cache_dir` what the file with `key` imports, for
+// cached_entry_key(), and returns the key of the code generated from it.
+uint64_t store_imports(const std::string& cache_dir, uint64_t key, const ImportSet& imports);
+
+// The first import in `ast`, or null.
+const ImportStatement* first_import(const AST& ast);
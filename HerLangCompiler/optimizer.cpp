@@ -0,0 +1,84 @@
+// optimizer.cpp - AST optimization passes
+#include "optimizer.hpp"
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Pass {
+    const char* name;
+    int min_level;
+    void (*run)(AST& ast, Span<Statement*> statements);
+};
+
+}
+
+// Calls `fn` on every statement, including those nested in blocks.
+template <typename Fn>
+static void for_each_statement(Span<Statement*> body, Fn&& fn) {
+    for (auto stmt : body) {
+        fn(stmt);
+        for_each_body(stmt, [&](Span<Statement*> inner) { for_each_statement(inner, fn); });
+    }
+}
+
+// Merges each run of adjacent literal say arguments into one literal, and
+// folds the end= suffix into a trailing literal, so every such statement
+// costs one write. The default "\n" ending becomes a real newline, with the
+// statement marked to flush after it as before.
+static void fold_say_literals(AST& ast, Span<Statement*> statements) {
+    std::vector<Argument> args;
+    std::string run;
+
+    for_each_statement(statements, [&](Statement* stmt) {
+        auto say = node_cast<SayStatement>(stmt);
+        if (!say) return;
+
+        args.clear();
+        bool in_run = false;
+        auto close_run = [&]() {
+            if (!in_run) return;
+            args.push_back({ ast.arena.store(run) });
+            in_run = false;
+        };
+
+        for (const Argument& arg : say->args) {
+            if (arg.is_var()) {
+                close_run();
+                args.push_back(arg);
+            }
+            else {
+                if (!in_run) run.clear();
+                run += arg.text;
+                in_run = true;
+            }
+        }
+
+        bool trailing_literal = in_run || say->args.empty();
+        if (trailing_literal) {
+            if (!in_run) run.clear();
+            say->flush_after |= say->end == "\\n";
+            run += say->end == "\\n" ? std::string_view("\n") : say->end;
+            in_run = true;
+            say->end = std::string_view();
+        }
+        close_run();
+
+        if (args.size() == say->args.size() && say->end.data()) return;
+        say->args = ast.arena.copy<Argument>(args);
+    });
+}
+
+static const Pass passes[] = {
+    { "fold-say-literals", 1, fold_say_literals },
+};
+
+void optimize(AST& ast, Span<Statement*> statements, const OptimizeOptions& options) {
+    for (const auto& pass : passes) {
+        if (options.level >= pass.min_level) pass.run(ast, statements);
+    }
+}
+
+void optimize(AST& ast, const OptimizeOptions& options) {
+    optimize(ast, Span<Statement*>{ ast.statements.data(), ast.statements.size() }, options);
+}
@@ -0,0 +1,15 @@
+// optimizer.hpp - AST optimization passes
+#pragma once
+#include "ast.hpp"
+
+struct OptimizeOptions {
+    int level = 0;  // 0 disables every pass
+};
+
+// Runs the pass pipeline enabled by `options` over `ast`, in place. New
+// nodes and strings are allocated from the AST's arena.
+void optimize(AST& ast, const OptimizeOptions& options);
+
+// Same, over `statements` only, e.g. the top-level statements an incremental
+// compile has just re-parsed.
+void optimize(AST& ast, Span<Statement*> statements, const OptimizeOptions& options);
@@ -0,0 +1,46 @@
+// output.cpp - Buffered output sinks for generated code
+#include "output.hpp"
+
+void OutputSink::write_large(std::string_view s) {
+    flush();
+    if (s.size() >= buffer.size()) {
+        write_chunk(s.data(), s.size());
+        flushed += s.size();
+    }
+    else {
+        std::memcpy(buffer.data(), s.data(), s.size());
+        used = s.size();
+    }
+}
+
+bool FileSink::open(const std::string& path) {
+    close();
+    failed = false;
+    if (path == "-") {
+        file = stdout;
+        owns_file = false;
+    }
+    else {
+        file = std::fopen(path.c_str(), "w");
+        owns_file = true;
+    }
+    return file != nullptr;
+}
+
+bool FileSink::close() {
+    if (!file) return !failed;
+    flush();
+    if (owns_file) {
+        if (std::fclose(file) != 0) failed = true;
+    }
+    else if (std::fflush(file) != 0) {
+        failed = true;
+    }
+    file = nullptr;
+    return !failed;
+}
+
+void FileSink::write_chunk(const char* data, size_t size) {
+    if (!file || failed) return;
+    if (std::fwrite(data, 1, size, file) != size) failed = true;
+}
@@ -0,0 +1,108 @@
+// output.hpp - Buffered output sinks for generated code
+#pragma once
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// Accumulates output in a fixed user-space buffer and hands it to the
+// concrete sink in chunks, so generated code never has to exist in memory
+// as a whole. Derived classes must flush() before they are destroyed.
+class OutputSink {
+public:
+    explicit OutputSink(size_t capacity = 64 * 1024) : buffer(capacity) {}
+    virtual ~OutputSink() = default;
+
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+
+    OutputSink& operator<<(std::string_view s) {
+        if (s.size() > buffer.size() - used) {
+            write_large(s);
+        }
+        else {
+            std::memcpy(buffer.data() + used, s.data(), s.size());
+            used += s.size();
+        }
+        return *this;
+    }
+
+    OutputSink& operator<<(char c) {
+        if (used == buffer.size()) flush();
+        buffer[used++] = c;
+        return *this;
+    }
+
+    template <typename T, typename = std::enable_if_t<std::is_integral<T>::value &&
+        !std::is_same<T, char>::value && !std::is_same<T, bool>::value>>
+    OutputSink& operator<<(T n) {
+        char digits[24];
+        auto result = std::to_chars(digits, digits + sizeof(digits), n);
+        return *this << std::string_view(digits, result.ptr - digits);
+    }
+
+    void flush() {
+        if (used > 0) write_chunk(buffer.data(), used);
+        flushed += used;
+        used = 0;
+    }
+
+    size_t bytes_written() const { return flushed + used; }
+
+protected:
+    virtual void write_chunk(const char* data, size_t size) = 0;
+
+private:
+    void write_large(std::string_view s);
+
+    std::vector<char> buffer;
+    size_t used = 0;
+    size_t flushed = 0;
+};
+
+// Writes to a file, or to stdout when the path is "-".
+class FileSink : public OutputSink {
+public:
+    FileSink() = default;
+    ~FileSink() override { close(); }
+
+    bool open(const std::string& path);
+    // Flushes and closes; false if any write failed.
+    bool close();
+
+protected:
+    void write_chunk(const char* data, size_t size) override;
+
+private:
+    std::FILE* file = nullptr;
+    bool owns_file = false;
+    bool failed = false;
+};
+
+// Collects output in memory (tests, wrappers that need the text).
+class StringSink : public OutputSink {
+public:
+    ~StringSink() override { flush(); }
+
+    const std::string& str() {
+        flush();
+        return text;
+    }
+
+    // Moves the text out, leaving the sink empty for reuse.
+    std::string take() {
+        flush();
+        std::string taken = std::move(text);
+        text.clear();
+        return taken;
+    }
+
+protected:
+    void write_chunk(const char* data, size_t size) override { text.append(data, size); }
+
+private:
+    std::string text;
+};
@@ -1,242 +1,531 @@
 // parser.cpp - MyLang parser implementation
 #include "parser.hpp"
+#include "sema.hpp"
 #include "utils.hpp"
+#include <algorithm>
 #include <stdexcept>
 #include <iostream>
+#include <string>
 
-static int pos = 0;
-static std::vector<Token> toks;
+static const Token eof_token{ TokenType::EOFToken, "", 0 };
 
-static Token dummy_eof_token() {
-    return Token{ TokenType::EOFToken, "" };
-}
-
-static Token peek() {
+const Token& Parser::peek() const {
     if (pos >= toks.size()) {
 #if _DEBUG
         std::cerr << "[ERROR] peek: pos=" << pos << ", toks.size=" << toks.size() << "\n";
 #endif
-        return dummy_eof_token();
+        return eof_token;
     }
-    auto t = toks[pos];
+    const Token& t = toks[pos];
 #if _DEBUG
     std::cerr << "[peek] pos=" << pos << ", token=(" << t.value << ")\n";
 #endif
     return t;
 }
 
-static Token advance() {
+const Token& Parser::advance() {
     if (pos >= toks.size()) {
 #if _DEBUG
         std::cerr << "[ERROR] advance: pos=" << pos << ", toks.size=" << toks.size() << "\n";
 #endif
-        return dummy_eof_token();
+        return eof_token;
     }
-    auto t = toks[pos++];
+    const Token& t = toks[pos++];
 #if _DEBUG
     std::cerr << "[advance] pos=" << pos << ", token=(" << t.value << ")\n";
 #endif
     return t;
 }
 
-static void skip_newlines() {
-    while (peek().type == TokenType::Newline) {
-        advance();
+// Layout tokens only ever come right after a newline, and blocks are
+// delimited by 'end', so they are skipped along with the newlines.
+void Parser::skip_newlines() {
+    while (pos < toks.size() && (toks[pos].type == TokenType::Newline ||
+        toks[pos].type == TokenType::Indent || toks[pos].type == TokenType::Dedent)) {
+        ++pos;
     }
 }
 
-std::shared_ptr<Statement> parse_statement();
+SymbolId Parser::symbol(const Token& tok) {
+    return tok.symbol != NoSymbol ? tok.symbol : ast->symbols.intern(tok.value);
+}
 
-AST parse(const std::vector<Token>& tokens) {
-    toks = tokens;
-    pos = 0;
-    AST ast;
+static bool is_symbol(const Token& tok, std::string_view symbol) {
+    return tok.type == TokenType::Symbol && tok.value == symbol;
+}
+
+static bool at_line_end(const Token& tok) {
+    return tok.type == TokenType::Newline || tok.type == TokenType::EOFToken;
+}
+
+std::nullptr_t Parser::error(const std::string& message, const Token& at) {
+    errors.push_back({ at.line, at.column, DiagCode::Syntax, message });
+    return nullptr;
+}
 
+void Parser::synchronize() {
     while (pos < toks.size()) {
-        Token current = peek();
-        if (current.type == TokenType::EOFToken) break;
+        TokenType type = toks[pos].type;
+        if (type == TokenType::EOFToken) return;
+        ++pos;
+        if (type == TokenType::Newline) return;
+    }
+}
+
+ParseErrors::ParseErrors(std::vector<ParseError> all)
+    : std::runtime_error(format_error(all.front().code, all.front().line, all.front().message)),
+      errors(std::move(all)) {}
+
+AST parse(const std::vector<Token>& tokens, Interner symbols) {
+    Parser parser(tokens, std::move(symbols));
+    AST ast = parser.parse();
+    if (!parser.diagnostics().empty()) throw ParseErrors(parser.diagnostics());
+    analyze(ast);
+    return ast;
+}
+
+AST Parser::parse() {
+    AST result;
+    result.symbols = std::move(symbols);
+    parse_range(result, 0, toks.size());
+    return result;
+}
 
+size_t Parser::parse_range(AST& target, size_t begin, size_t end) {
+    pos = begin;
+    ast = &target;
+    parse_top_level(end);
+    ast = nullptr;
+    return pos;
+}
+
+void Parser::parse_top_level(size_t end) {
+    while (pos < end) {
+        skip_newlines();
+        if (pos >= end || peek().type == TokenType::EOFToken) break;
+
+        size_t begin = pos;
+        int first_line = peek().line;
+        size_t errors_before = errors.size();
         auto stmt = parse_statement();
+        bool failed = errors.size() != errors_before;
         if (stmt) {
-            ast.statements.push_back(stmt);
+            ast->statements.push_back(stmt);
         }
-        else {
-            advance();
+        else if (failed) {
+            synchronize();
         }
-    }
 
-    return ast;
+        // Indent and Dedent tokens carry the line they open, not this one.
+        size_t last = std::min(pos, toks.size());
+        while (last > begin + 1 && (toks[last - 1].type == TokenType::Indent ||
+            toks[last - 1].type == TokenType::Dedent)) {
+            --last;
+        }
+        int last_line = last > begin ? toks[last - 1].line : first_line;
+        top_level.push_back({ first_line, std::max(first_line, last_line), stmt, failed });
+    }
 }
 
-std::vector<std::shared_ptr<Statement>> parse_block() {
-    std::vector<std::shared_ptr<Statement>> body;
-    int safety_counter = 0;
+Span<Statement*> Parser::parse_block(bool in_if) {
+    std::vector<Statement*> body;
 
     while (true) {
         skip_newlines();
 
-        Token current = peek();
-        if (current.type == TokenType::Keyword && current.value == "end") {
+        const Token& current = peek();
+        if (current.keyword == KeywordKind::End) {
             advance(); // consume "end"
             break;
         }
+        if (in_if && (current.keyword == KeywordKind::Elif || current.keyword == KeywordKind::Else)) {
+            break; // left for parse_if
+        }
         if (current.type == TokenType::EOFToken) {
-            throw std::runtime_error("Unexpected end of file inside block.");
+            // Every enclosing block ends here too; say so once.
+            if (!eof_reported) {
+                errors.push_back({ current.line, current.column, DiagCode::UnexpectedEof,
+                    "Unexpected end of file inside block." });
+            }
+            eof_reported = true;
+            break;
         }
 
+        if (current.keyword == KeywordKind::Import) {
+            error("'import' is only allowed outside functions and blocks", current);
+            synchronize();
+            continue;
+        }
+
+        // On an error, skip the rest of the line and carry on with the next
+        // statement, so one pass reports every broken line.
+        size_t errors_before = errors.size();
         auto stmt = parse_statement();
         if (stmt) {
             body.push_back(stmt);
         }
-        else {
-            advance();
-        }
-
-        if (++safety_counter > 10000) {
-            throw std::runtime_error("Too many statements parsed without encountering 'end'");
+        else if (errors.size() != errors_before) {
+            synchronize();
         }
     }
 
-    return body;
+    return ast->arena.copy<Statement*>(body);
 }
 
-std::shared_ptr<Statement> parse_statement() {
+Statement* Parser::parse_statement() {
     skip_newlines();
 
-    Token tok = peek();
+    const Token& tok = peek();
 
     if (tok.type == TokenType::EOFToken) {
         return nullptr;
     }
 
-    // function definition
-    if (tok.type == TokenType::Keyword && tok.value == "function") {
-        advance(); // consume 'function'
+    int line = tok.line;
+    Statement* stmt = nullptr;
+    switch (tok.keyword) {
+    case KeywordKind::Function: stmt = parse_function(); break;
+    case KeywordKind::Start:    stmt = parse_start(); break;
+    case KeywordKind::Say:      stmt = parse_say(); break;
+    case KeywordKind::Set:      stmt = parse_set(); break;
+    case KeywordKind::If:       stmt = parse_if(); break;
+    case KeywordKind::Repeat:   stmt = parse_repeat(); break;
+    case KeywordKind::Import:   stmt = parse_import(); break;
+    case KeywordKind::Elif:
+    case KeywordKind::Else:
+        // Skip the orphaned arms along with their bodies and 'end'.
+        error("'" + std::string(tok.value) + "' without matching 'if'", tok);
+        do {
+            synchronize();
+            parse_block(true);
+        } while (peek().keyword == KeywordKind::Elif || peek().keyword == KeywordKind::Else);
+        return nullptr;
+    case KeywordKind::Add:
+    case KeywordKind::Minus:
+    case KeywordKind::Multiply:
+    case KeywordKind::Divide:   stmt = parse_arithmetic(); break;
+    default:
+        if (tok.type == TokenType::Identifier) {
+            stmt = parse_call();
+            break;
+        }
+        if (tok.keyword == KeywordKind::End) {
+            // A stray 'end' is reported as UnmatchedEnd while lexing.
+            advance();
+            return nullptr;
+        }
+        // The caller skips the rest of the line.
+        return error("Unexpected token: " + std::string(tok.value), tok);
+    }
 
-        Token name = advance();
-        Token maybe_param_or_colon = advance();
+    if (stmt) stmt->line = line;
+    return stmt;
+}
 
-        std::string param = "";
+// A block construct whose header is broken still parses its body, so the
+// body's 'end' closes it rather than the enclosing block.
+Statement* Parser::recover_block() {
+    synchronize();
+    parse_block();
+    return nullptr;
+}
 
-        Token colon;
-        if (maybe_param_or_colon.type == TokenType::Symbol && maybe_param_or_colon.value == ":") {
-            colon = maybe_param_or_colon;
-        }
-        else {
-            param = maybe_param_or_colon.value;
-            colon = advance();
-            if (colon.value != ":") {
-                throw std::runtime_error("Expected ':' after parameter in function definition");
-            }
-        }
+Statement* Parser::parse_function() {
+    advance(); // consume 'function'
 
-        auto body = parse_block();
-        return std::make_shared<FunctionDef>(name.value, param, body);
+    const Token& name = peek();
+    if (at_line_end(name)) {
+        error("Expected function name", name);
+        return recover_block();
     }
+    advance();
 
-    // start block
-    if (tok.type == TokenType::Keyword && tok.value == "start") {
-        advance();
-        Token colon = advance();
-        if (colon.value != ":") throw std::runtime_error("Expected ':' after start");
-        auto body = parse_block();
-        return std::make_shared<StartBlock>(body);
+    SymbolId param = NoSymbol;
+    if (!is_symbol(peek(), ":") && !at_line_end(peek())) {
+        param = symbol(advance());
     }
+    if (!expect_colon("parameter in function definition")) return recover_block();
 
-    // say
-    if (tok.type == TokenType::Keyword && tok.value == "say") {
-        advance(); // consume 'say'
+    auto body = parse_block();
+    return make<FunctionDef>(symbol(name), param, body);
+}
 
-        std::vector<std::string> args;
-        std::vector<bool> is_vars;
-        std::string ending = "\\n"; // default end
+Statement* Parser::parse_start() {
+    advance(); // consume 'start'
+    if (!expect_colon("start")) return recover_block();
+    auto body = parse_block();
+    return make<StartBlock>(body);
+}
+
+Statement* Parser::parse_say() {
+    advance(); // consume 'say'
+
+    std::vector<Argument> args;
+    std::string_view ending = "\\n"; // default end
 
-        while (true) {
-            Token next = peek();
+    while (true) {
+        const Token& next = peek();
 #if _DEBUG
-            std::cerr << "[DEBUG] say loop: next=" << next.value << ", type=" << static_cast<int>(next.type) << "\n";
+        std::cerr << "[DEBUG] say loop: next=" << next.value << ", type=" << static_cast<int>(next.type) << "\n";
 #endif
 
-            if (next.type == TokenType::Keyword && next.value == "end") {
-                advance(); // consume 'end'
+        if (next.keyword == KeywordKind::End) {
+            advance(); // consume 'end'
 
-                Token eq = peek();
-                if (eq.type != TokenType::Symbol || eq.value != "=") {
-                    throw std::runtime_error("Expected '=' after 'end'");
-                }
-                advance(); // consume '='
+            const Token& eq = peek();
+            if (!is_symbol(eq, "=")) return error("Expected '=' after 'end'", eq);
+            advance(); // consume '='
 
-                Token val = peek();
-                if (val.type != TokenType::StringLiteral) {
-                    throw std::runtime_error("Expected string literal after end=");
-                }
-                ending = advance().value;
+            const Token& val = peek();
+            if (val.type != TokenType::StringLiteral) return error("Expected string literal after end=", val);
+            ending = advance().value;
 
-                break;
-            }
+            break;
+        }
 
-            if (next.type == TokenType::Newline || next.type == TokenType::EOFToken) {
-                advance(); // consume newline/EOF
-                break;
-            }
+        if (next.type == TokenType::Newline || next.type == TokenType::EOFToken) {
+            advance(); // consume newline/EOF
+            break;
+        }
 
-            
-            if (next.type == TokenType::StringLiteral || next.type == TokenType::Identifier) {
-                Token arg = advance();
-                args.push_back(arg.value);
-                is_vars.push_back(arg.type == TokenType::Identifier);
-
-                
-                Token comma = peek();
-                if (comma.type == TokenType::Symbol && comma.value == ",") {
-                    advance(); // consume comma
-                }
-            }
-            else {
-                throw std::runtime_error("Unexpected token in 'say': " + next.value);
+        if (next.type == TokenType::StringLiteral || next.type == TokenType::Identifier) {
+            const Token& arg = advance();
+            if (arg.type == TokenType::Identifier) args.push_back({ {}, symbol(arg) });
+            else args.push_back({ arg.value });
+
+            const Token& comma = peek();
+            if (comma.type == TokenType::Symbol && comma.value == ",") {
+                advance(); // consume comma
             }
         }
-
-        if (args.size() != is_vars.size()) {
-            throw std::runtime_error("Internal error: say args/vars mismatch.");
+        else {
+            return error("Unexpected token in 'say': " + std::string(next.value), next);
         }
+    }
 
-        return std::make_shared<SayStatement>(args, is_vars, ending);
+    return make<SayStatement>(ast->arena.copy<Argument>(args), ending);
+}
+
+Statement* Parser::parse_set() {
+    advance(); // consume 'set'
+    const Token& var = peek();
+    if (var.type != TokenType::Identifier) return error("Expected variable name after 'set'", var);
+    advance();
+
+    Expr* value = nullptr;
+    if (is_symbol(peek(), "=")) {
+        advance(); // consume '='
+        value = parse_expr();
+        if (!value) return nullptr;
     }
+    if (!at_line_end(peek())) {
+        return error("Unexpected token after expression: " + std::string(peek().value), peek());
+    }
+    return make<SetStatement>(symbol(var), value);
+}
 
-    // set
-    if (tok.type == TokenType::Keyword && tok.value == "set") {
-        advance();
-        Token var = advance();
-        return std::make_shared<SetStatement>(var.value);
+static bool binary_op(KeywordKind keyword, BinaryOp& op) {
+    switch (keyword) {
+    case KeywordKind::Add:      op = BinaryOp::Add; return true;
+    case KeywordKind::Minus:    op = BinaryOp::Minus; return true;
+    case KeywordKind::Multiply: op = BinaryOp::Multiply; return true;
+    case KeywordKind::Divide:   op = BinaryOp::Divide; return true;
+    default:                    return false;
     }
+}
 
-    // function call
-    if (tok.type == TokenType::Identifier) {
-        Token func = advance();
-        Token next = peek();
-        if (next.type == TokenType::StringLiteral || next.type == TokenType::Identifier) {
-            Token arg = advance();
-#if _DEBUG
-            std::cerr << "[DEBUG] function call arg " << arg.value << " ";
-            switch (arg.type) {
-            case TokenType::Keyword:        std::cerr << "Keyword    "; break;
-            case TokenType::Identifier:     std::cerr << "Identifier "; break;
-            case TokenType::StringLiteral:  std::cerr << "String     "; break;
-            case TokenType::Newline:        std::cerr << "Newline    "; break;
-            case TokenType::EOFToken:       std::cerr << "EOF        "; break;
-            case TokenType::Symbol:         std::cerr << "Symbol     "; break;
+Statement* Parser::parse_arithmetic() {
+    BinaryOp op = BinaryOp::Add;
+    const Token& keyword = advance();
+    binary_op(keyword.keyword, op);
+
+    const Token& var = peek();
+    if (var.type != TokenType::Identifier) {
+        return error("Expected variable name after '" + std::string(keyword.value) + "'", keyword);
+    }
+    advance();
+    Expr* operand = parse_expr();
+    if (!operand) return nullptr;
+    if (!at_line_end(peek())) {
+        return error("Unexpected token after expression: " + std::string(peek().value), peek());
+    }
+    return make<ArithmeticStatement>(op, symbol(var), operand);
+}
+
+bool Parser::expect_colon(const char* construct) {
+    const Token& colon = peek();
+    if (!is_symbol(colon, ":")) {
+        error(std::string("Expected ':' after ") + construct, colon);
+        return false;
+    }
+    advance();
+    return true;
+}
+
+Statement* Parser::parse_if() {
+    std::vector<Branch> branches;
+    Span<Statement*> else_body;
+
+    // A broken arm is skipped to its body, and the rest of the if still
+    // parses; the statement is dropped at the end.
+    bool failed = false;
+    advance(); // consume 'if'
+    while (true) {
+        Expr* condition = parse_condition();
+        if (!condition || !expect_colon("condition")) {
+            failed = true;
+            synchronize();
+        }
+        branches.push_back({ condition, parse_block(true) });
+
+        const Token& next = peek();
+        if (next.keyword == KeywordKind::Elif) {
+            advance();
+            continue;
+        }
+        if (next.keyword == KeywordKind::Else) {
+            advance();
+            if (!expect_colon("else")) {
+                failed = true;
+                synchronize();
             }
-            std::cerr << std::endl;
-#endif
-            return std::make_shared<FunctionCall>(func.value, arg.value, arg.type);
+            else_body = parse_block();
         }
-        else {
-            return std::make_shared<FunctionCall>(func.value, "", TokenType::EOFToken);
+        break;
+    }
+
+    if (failed) return nullptr;
+    return make<IfStatement>(ast->arena.copy<Branch>(branches), else_body);
+}
+
+Statement* Parser::parse_repeat() {
+    advance(); // consume 'repeat'
+
+    // "repeat i n:" names the counter; "repeat n:" does not.
+    SymbolId counter = NoSymbol;
+    if (peek().type == TokenType::Identifier && pos + 1 < toks.size()) {
+        const Token& after = toks[pos + 1];
+        if (after.type == TokenType::Identifier || after.type == TokenType::NumberLiteral ||
+            (after.type == TokenType::Symbol && after.value == "(")) {
+            counter = symbol(advance());
         }
     }
 
+    Expr* count = parse_expr();
+    if (!count || !expect_colon("repeat count")) return recover_block();
+    auto body = parse_block();
+    return make<RepeatStatement>(counter, count, body);
+}
 
+// import name | import "path"
+Statement* Parser::parse_import() {
+    advance(); // consume 'import'
+
+    const Token& module = peek();
+    if (module.type != TokenType::Identifier && module.type != TokenType::StringLiteral) {
+        return error("Expected a module name or path after 'import'", module);
+    }
+    if (module.value.empty()) return error("Empty module path", module);
     advance();
-    return nullptr;
+    if (!at_line_end(peek())) {
+        return error("Unexpected token after module name: " + std::string(peek().value), peek());
+    }
+    return make<ImportStatement>(module.value, module.type == TokenType::StringLiteral);
+}
+
+static bool comparison_op(const Token& tok, BinaryOp& op) {
+    if (tok.type != TokenType::Symbol) return false;
+    if (tok.value == "<")  { op = BinaryOp::Less; return true; }
+    if (tok.value == "<=") { op = BinaryOp::LessEqual; return true; }
+    if (tok.value == ">")  { op = BinaryOp::Greater; return true; }
+    if (tok.value == ">=") { op = BinaryOp::GreaterEqual; return true; }
+    if (tok.value == "==") { op = BinaryOp::Equal; return true; }
+    if (tok.value == "!=") { op = BinaryOp::NotEqual; return true; }
+    return false;
+}
+
+// condition := expr [('<' | '<=' | '>' | '>=' | '==' | '!=') expr]
+// A bare expression is true when non-zero.
+Expr* Parser::parse_condition() {
+    Expr* lhs = parse_expr();
+    BinaryOp op;
+    if (lhs && comparison_op(peek(), op)) {
+        advance();
+        Expr* rhs = parse_expr();
+        return rhs ? make<BinaryExpr>(op, lhs, rhs) : nullptr;
+    }
+    return lhs;
+}
+
+// expr := term (('add' | 'minus') term)*
+Expr* Parser::parse_expr() {
+    Expr* lhs = parse_term();
+    BinaryOp op;
+    while (lhs && binary_op(peek().keyword, op) && (op == BinaryOp::Add || op == BinaryOp::Minus)) {
+        advance();
+        Expr* rhs = parse_term();
+        lhs = rhs ? make<BinaryExpr>(op, lhs, rhs) : nullptr;
+    }
+    return lhs;
+}
+
+// term := factor (('multiply' | 'divide') factor)*
+Expr* Parser::parse_term() {
+    Expr* lhs = parse_factor();
+    BinaryOp op;
+    while (lhs && binary_op(peek().keyword, op) && (op == BinaryOp::Multiply || op == BinaryOp::Divide)) {
+        advance();
+        Expr* rhs = parse_factor();
+        lhs = rhs ? make<BinaryExpr>(op, lhs, rhs) : nullptr;
+    }
+    return lhs;
+}
+
+// factor := number | variable | '(' expr ')'
+Expr* Parser::parse_factor() {
+    const Token& tok = peek();
+    if (tok.type == TokenType::NumberLiteral) {
+        advance();
+        return make<NumberLiteral>(tok.value);
+    }
+    if (tok.type == TokenType::Identifier) {
+        advance();
+        return make<VariableRef>(symbol(tok));
+    }
+    if (is_symbol(tok, "(")) {
+        advance();
+        Expr* inner = parse_expr();
+        if (!inner) return nullptr;
+        const Token& close = peek();
+        if (!is_symbol(close, ")")) return error("Expected ')'", close);
+        advance();
+        return inner;
+    }
+    return error("Expected a number or variable", tok);
+}
+
+Statement* Parser::parse_call() {
+    const Token& func = advance();
+    const Token& next = peek();
+    // The parameter is untyped and only ever said, so a number passes as its text.
+    if (next.type == TokenType::StringLiteral || next.type == TokenType::Identifier ||
+        next.type == TokenType::NumberLiteral) {
+        const Token& arg = advance();
+#if _DEBUG
+        std::cerr << "[DEBUG] function call arg " << arg.value << " ";
+        switch (arg.type) {
+        case TokenType::Keyword:        std::cerr << "Keyword    "; break;
+        case TokenType::Identifier:     std::cerr << "Identifier "; break;
+        case TokenType::StringLiteral:  std::cerr << "String     "; break;
+        case TokenType::NumberLiteral:  std::cerr << "Number     "; break;
+        case TokenType::Newline:        std::cerr << "Newline    "; break;
+        case TokenType::EOFToken:       std::cerr << "EOF        "; break;
+        case TokenType::Symbol:         std::cerr << "Symbol     "; break;
+        }
+        std::cerr << std::endl;
+#endif
+        if (arg.type == TokenType::Identifier) return make<FunctionCall>(symbol(func), Argument{ {}, symbol(arg) });
+        return make<FunctionCall>(symbol(func), Argument{ arg.value });
+    }
+    return make<FunctionCall>(symbol(func));
 }
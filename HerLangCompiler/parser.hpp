@@ -1,7 +1,111 @@
 // parser.hpp - MyLang parser interface
 #pragma once
 #include "ast.hpp"
+#include "diagnostics.hpp"
 #include "lexer.hpp"
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <utility>
 #include <vector>
 
-AST parse(const std::vector<Token>& tokens);
+struct ParseError {
+    int line;
+    int column;  // of the token it is about; 0 when unknown
+    DiagCode code;
+    std::string message;  // without the line, which format_error() adds
+};
+
+// Thrown by parse() when the source has syntax errors: what() is the first,
+// and `errors` holds all of them in source order.
+class ParseErrors : public std::runtime_error {
+public:
+    explicit ParseErrors(std::vector<ParseError> all);
+
+    std::vector<ParseError> errors;
+};
+
+// One top-level statement as the parser found it: the lines from its first
+// token to its last, and the statement itself, or null when the tokens were
+// skipped as an error or produced nothing.
+struct TopLevelItem {
+    int first_line;
+    int last_line;
+    Statement* stmt;
+    bool failed;  // at least one error was reported in it
+};
+
+// Recursive-descent parser over a token stream it does not own. All state
+// lives in the object, so independent files can be parsed concurrently.
+// `symbols` must be the interner the tokens were lexed with, if any; it ends
+// up in the AST, and tokens without a symbol are interned into it as parsed.
+class Parser {
+public:
+    explicit Parser(const std::vector<Token>& tokens, Interner symbols = {})
+        : toks(tokens), symbols(std::move(symbols)) {}
+
+    // Never throws on bad input. Errors are collected in diagnostics() and
+    // the statements they occur in are left out of the AST.
+    AST parse();
+
+    // Parses the top-level statements in tokens [begin, end) into `ast`,
+    // using its arena and interner; a statement that starts before `end`
+    // is finished past it. Returns where parsing stopped. Calls may be
+    // repeated, in increasing token order, to re-parse parts of a file.
+    size_t parse_range(AST& ast, size_t begin, size_t end);
+
+    const std::vector<ParseError>& diagnostics() const { return errors; }
+    // Every top-level statement parse() or parse_range() went through, in order.
+    const std::vector<TopLevelItem>& items() const { return top_level; }
+
+private:
+    void parse_top_level(size_t end);
+    const Token& peek() const;
+    const Token& advance();
+    void skip_newlines();
+    // Records an error at `at`; returns nullptr so a failing parse can
+    // `return error(...)`.
+    std::nullptr_t error(const std::string& message, const Token& at);
+    // Panic-mode recovery: skips to just past the end of the current line.
+    void synchronize();
+    Statement* recover_block();
+    SymbolId symbol(const Token& tok);
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        ++ast->node_count;
+        return ast->arena.make<T>(std::forward<Args>(args)...);
+    }
+
+    Statement* parse_statement();
+    // Statements up to and including 'end'. Inside an if arm, also stops (without
+    // consuming) at 'elif' or 'else'.
+    Span<Statement*> parse_block(bool in_if = false);
+    Statement* parse_function();
+    Statement* parse_start();
+    Statement* parse_say();
+    Statement* parse_set();
+    Statement* parse_arithmetic();
+    Statement* parse_if();
+    Statement* parse_repeat();
+    Statement* parse_import();
+    bool expect_colon(const char* construct);
+    Expr* parse_condition();
+    Expr* parse_expr();
+    Expr* parse_term();
+    Expr* parse_factor();
+    Statement* parse_call();
+
+    const std::vector<Token>& toks;
+    Interner symbols;
+    size_t pos = 0;
+    AST* ast = nullptr;
+    std::vector<ParseError> errors;
+    std::vector<TopLevelItem> top_level;
+    bool eof_reported = false;
+};
+
+// Parses and runs semantic analysis (type inference) over the result, with
+// `symbols` as in Parser. Throws ParseErrors listing every syntax error, or
+// CompileError for the first semantic one.
+AST parse(const std::vector<Token>& tokens, Interner symbols = {});
@@ -0,0 +1,49 @@
+// profile.cpp - Execution profiles of programs generated with --profile
+#include "profile.hpp"
+#include "cache.hpp"
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+const Profile::Function* Profile::find(std::string_view name) const {
+    auto it = functions.find(std::string(name));
+    return it != functions.end() ? &it->second : nullptr;
+}
+
+bool load_profile(const std::string& path, Profile& profile) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    std::string data(std::istreambuf_iterator<char>(in), (std::istreambuf_iterator<char>()));
+    if (in.bad()) return false;
+
+    std::istringstream lines(data);
+    std::string line;
+    if (!std::getline(lines, line) || line != "hcp-profile 1") return false;
+
+    Profile loaded;
+    loaded.hash = hash_bytes(data);
+    // A function run from more than one translation unit, such as a module
+    // linked twice, keeps its first entry.
+    Profile::Function ignored;
+    Profile::Function* current = nullptr;
+    while (std::getline(lines, line)) {
+        std::istringstream fields(line);
+        if (line.compare(0, 9, "function ") == 0) {
+            std::string keyword, name;
+            Profile::Function function;
+            if (!(fields >> keyword >> name >> function.calls >> function.ticks)) return false;
+            auto [it, inserted] = loaded.functions.emplace(name, function);
+            current = inserted ? &it->second : &ignored;
+            if (inserted) loaded.total_calls += function.calls;
+            continue;
+        }
+
+        int number;
+        uint64_t count;
+        if (!current || !(fields >> number >> count)) return false;
+        current->lines.push_back(number);
+        current->counts.push_back(count);
+    }
+    profile = std::move(loaded);
+    return true;
+}
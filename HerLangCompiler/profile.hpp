@@ -0,0 +1,35 @@
+// profile.hpp - Execution profiles of programs generated with --profile
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// A program generated with CodegenOptions::profile counts how often each
+// statement runs and times each function, and at exit writes them to
+// $HERLANG_PROFILE, or herlang.profile in its working directory:
+//
+//   hcp-profile 1
+//   function NAME CALLS TICKS     for each function, and "start"
+//   LINE COUNT                    for each statement in it, in source order
+//
+// Ticks are the time stamp counter where there is one, and steady_clock
+// otherwise, from entry to exit with callees included.
+struct Profile {
+    struct Function {
+        uint64_t calls = 0;
+        uint64_t ticks = 0;
+        std::vector<int> lines;        // of each statement, in the order above
+        std::vector<uint64_t> counts;  // how often each one ran
+    };
+
+    std::unordered_map<std::string, Function> functions;
+    uint64_t total_calls = 0;  // of every function
+    uint64_t hash = 0;         // of the file, which code generated with it depends on
+
+    const Function* find(std::string_view name) const;
+};
+
+// Reads the profile at `path`; false if it cannot be read or is not one.
+bool load_profile(const std::string& path, Profile& profile);
@@ -0,0 +1,151 @@
+// scan.cpp - SIMD scans over source text
+#include "scan.hpp"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define HERLANG_SCAN_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HERLANG_SCAN_SSE2 1
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define HERLANG_SCAN_NEON 1
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+namespace {
+
+#if HERLANG_SCAN_AVX2 || HERLANG_SCAN_SSE2 || HERLANG_SCAN_NEON
+#define HERLANG_SCAN_SIMD 1
+
+// A block of bytes and the few operations the scans need. A Mask has one bit
+// per byte (one nibble on NEON, which has no movemask), set where a byte
+// matched.
+#if HERLANG_SCAN_AVX2
+constexpr size_t block_size = 32;
+using Block = __m256i;
+using Mask = uint32_t;
+constexpr Mask all_bytes = 0xffffffffu;
+constexpr int bits_per_byte = 1;
+
+inline Block load(const char* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+inline Block splat(char c) { return _mm256_set1_epi8(c); }
+inline Block bit_or(Block a, Block b) { return _mm256_or_si256(a, b); }
+inline Mask to_mask(Block m) { return static_cast<Mask>(_mm256_movemask_epi8(m)); }
+inline Mask equal(Block b, char c) { return to_mask(_mm256_cmpeq_epi8(b, splat(c))); }
+// Bytes in [lo, hi]: b - lo <= hi - lo, unsigned, tested as min(d, hi - lo) == d.
+inline Mask in_range(Block b, char lo, char hi) {
+    Block d = _mm256_sub_epi8(b, splat(lo));
+    return to_mask(_mm256_cmpeq_epi8(_mm256_min_epu8(d, splat(static_cast<char>(hi - lo))), d));
+}
+#elif HERLANG_SCAN_SSE2
+constexpr size_t block_size = 16;
+using Block = __m128i;
+using Mask = uint32_t;
+constexpr Mask all_bytes = 0xffffu;
+constexpr int bits_per_byte = 1;
+
+inline Block load(const char* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+inline Block splat(char c) { return _mm_set1_epi8(c); }
+inline Block bit_or(Block a, Block b) { return _mm_or_si128(a, b); }
+inline Mask to_mask(Block m) { return static_cast<Mask>(_mm_movemask_epi8(m)); }
+inline Mask equal(Block b, char c) { return to_mask(_mm_cmpeq_epi8(b, splat(c))); }
+inline Mask in_range(Block b, char lo, char hi) {
+    Block d = _mm_sub_epi8(b, splat(lo));
+    return to_mask(_mm_cmpeq_epi8(_mm_min_epu8(d, splat(static_cast<char>(hi - lo))), d));
+}
+#else
+constexpr size_t block_size = 16;
+using Block = uint8x16_t;
+using Mask = uint64_t;
+constexpr Mask all_bytes = ~0ull;
+constexpr int bits_per_byte = 4;
+
+inline Block load(const char* p) { return vld1q_u8(reinterpret_cast<const uint8_t*>(p)); }
+inline Block splat(char c) { return vdupq_n_u8(static_cast<uint8_t>(c)); }
+inline Block bit_or(Block a, Block b) { return vorrq_u8(a, b); }
+// Narrowing shift packs each 0x00/0xff byte into a nibble.
+inline Mask to_mask(Block m) {
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+}
+inline Mask equal(Block b, char c) { return to_mask(vceqq_u8(b, splat(c))); }
+inline Mask in_range(Block b, char lo, char hi) {
+    return to_mask(vcleq_u8(vsubq_u8(b, splat(lo)), splat(static_cast<char>(hi - lo))));
+}
+#endif
+
+inline size_t first_byte(Mask m) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    if constexpr (sizeof(Mask) == 4) _BitScanForward(&index, m);
+    else _BitScanForward64(&index, m);
+    return index / bits_per_byte;
+#else
+    return static_cast<size_t>(__builtin_ctzll(m)) / bits_per_byte;
+#endif
+}
+
+inline Mask space_mask(Block b) { return equal(b, ' ') | in_range(b, '\t', '\r'); }
+
+// Setting bit 0x20 folds upper case onto lower case, and '_' (0x5f) onto
+// 0x7f, which is not a letter, so it is tested on the original bytes.
+inline Mask ident_mask(Block b) {
+    return in_range(bit_or(b, splat(0x20)), 'a', 'z') | in_range(b, '0', '9') | equal(b, '_');
+}
+
+#endif
+
+// Runs `stop_mask` over whole blocks, then `stop` over the remaining bytes.
+template <typename BlockStop, typename ByteStop>
+size_t scan(std::string_view s, size_t from, BlockStop stop_mask, ByteStop stop) {
+    const char* p = s.data();
+    size_t n = s.size();
+    size_t i = from;
+#if HERLANG_SCAN_SIMD
+    for (; i + block_size <= n; i += block_size) {
+        Mask m = stop_mask(load(p + i));
+        if (m) return i + first_byte(m);
+    }
+#else
+    (void)stop_mask;
+#endif
+    for (; i < n; ++i) {
+        if (stop(p[i])) return i;
+    }
+    return n;
+}
+
+}
+
+#if HERLANG_SCAN_SIMD
+#define HERLANG_BLOCK_STOP(expr) [&](Block b) { return expr; }
+#else
+#define HERLANG_BLOCK_STOP(expr) nullptr
+#endif
+
+size_t find_byte(std::string_view s, size_t from, char c) {
+    return scan(s, from, HERLANG_BLOCK_STOP(equal(b, c)), [c](char x) { return x == c; });
+}
+
+size_t skip_spaces(std::string_view s, size_t from) {
+    return scan(s, from, HERLANG_BLOCK_STOP(space_mask(b) ^ all_bytes), [](char x) { return !is_space(x); });
+}
+
+size_t skip_ident(std::string_view s, size_t from) {
+    return scan(s, from, HERLANG_BLOCK_STOP(ident_mask(b) ^ all_bytes), [](char x) { return !is_ident_char(x); });
+}
+
+const char* scan_isa() {
+#if HERLANG_SCAN_AVX2
+    return "avx2";
+#elif HERLANG_SCAN_SSE2
+    return "sse2";
+#elif HERLANG_SCAN_NEON
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
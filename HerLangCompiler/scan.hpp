@@ -0,0 +1,52 @@
+// scan.hpp - Byte classification and vectorized scanning for the lexer
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Classes follow the "C" locale, which hcp never changes: only ASCII bytes
+// are letters, digits or spaces, and UTF-8 sequences (bytes >= 0x80) belong
+// to no class. A table lookup replaces the <cctype> calls.
+enum CharClass : uint8_t {
+    CharSpace = 1,  // ' ' \t \n \v \f \r
+    CharDigit = 2,
+    CharIdentStart = 4,  // letters and '_'
+};
+
+constexpr std::array<uint8_t, 256> make_char_classes() {
+    std::array<uint8_t, 256> classes{};
+    for (int c = 0; c < 256; ++c) {
+        uint8_t bits = 0;
+        if (c == ' ' || (c >= '\t' && c <= '\r')) bits |= CharSpace;
+        if (c >= '0' && c <= '9') bits |= CharDigit;
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_') bits |= CharIdentStart;
+        classes[c] = bits;
+    }
+    return classes;
+}
+
+inline constexpr std::array<uint8_t, 256> char_classes = make_char_classes();
+
+inline bool is_space(char c) { return char_classes[static_cast<unsigned char>(c)] & CharSpace; }
+inline bool is_digit(char c) { return char_classes[static_cast<unsigned char>(c)] & CharDigit; }
+inline bool is_ident_start(char c) { return char_classes[static_cast<unsigned char>(c)] & CharIdentStart; }
+inline bool is_ident_char(char c) {
+    return char_classes[static_cast<unsigned char>(c)] & (CharIdentStart | CharDigit);
+}
+
+// Each scan starts at `from` and returns the index of the first byte that
+// stops it, or s.size(). They test 32 bytes at a time with AVX2, 16 with SSE2
+// or NEON, and fall back to the table above for the tail or on other targets.
+
+// First `c`, e.g. the closing quote of a string literal or the next newline.
+size_t find_byte(std::string_view s, size_t from, char c);
+
+// First byte that is not a space.
+size_t skip_spaces(std::string_view s, size_t from);
+
+// First byte that cannot continue an identifier.
+size_t skip_ident(std::string_view s, size_t from);
+
+// "avx2", "sse2", "neon" or "scalar": the path the scans above were built with.
+const char* scan_isa();
@@ -0,0 +1,280 @@
+// sema.cpp - Semantic analysis over a parsed AST
+#include "sema.hpp"
+#include "diagnostics.hpp"
+#include <charconv>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+// Indexed by SymbolId, so every variable of the compilation has a slot. One
+// table serves every body analyzed on a thread: it only grows with the
+// interner, and each body clears just the slots it wrote, so analysis costs
+// what the body holds rather than what the whole file names.
+class TypeTable {
+public:
+    void prepare(size_t symbols) {
+        if (types.size() < symbols + 1) types.resize(symbols + 1, ValueType::Unknown);
+    }
+
+    ValueType operator[](SymbolId id) const { return types[id]; }
+
+    void set(SymbolId id, ValueType type) {
+        if (types[id] == ValueType::Unknown) written.push_back(id);
+        types[id] = type;
+    }
+
+    void clear() {
+        for (SymbolId id : written) types[id] = ValueType::Unknown;
+        written.clear();
+    }
+
+private:
+    std::vector<ValueType> types;
+    std::vector<SymbolId> written;
+};
+
+}
+
+static ValueType join(ValueType a, ValueType b) {
+    if (a == ValueType::Float || b == ValueType::Float) return ValueType::Float;
+    if (a == ValueType::Int || b == ValueType::Int) return ValueType::Int;
+    return ValueType::Unknown;
+}
+
+static ValueType literal_type(std::string_view text) {
+    return text.find('.') != std::string_view::npos ? ValueType::Float : ValueType::Int;
+}
+
+static bool is_comparison(BinaryOp op) {
+    return op >= BinaryOp::Less;
+}
+
+// Annotates `expr` with types from `vars` and returns its type.
+static ValueType infer(Expr* expr, const TypeTable& vars) {
+    switch (expr->kind) {
+    case ExprKind::Number:
+        expr->type = literal_type(static_cast<NumberLiteral*>(expr)->text);
+        break;
+    case ExprKind::Variable:
+        expr->type = vars[static_cast<VariableRef*>(expr)->name];
+        break;
+    case ExprKind::Binary: {
+        auto bin = static_cast<BinaryExpr*>(expr);
+        ValueType operands = join(infer(bin->lhs, vars), infer(bin->rhs, vars));
+        expr->type = is_comparison(bin->op) ? ValueType::Int : operands;
+        break;
+    }
+    }
+    return expr->type;
+}
+
+namespace {
+
+// Block scopes of one function or start block, innermost last.
+struct Scopes {
+    const Interner& symbols;  // for naming variables in errors
+    std::vector<std::unordered_set<SymbolId>> stack;
+    SymbolId param = NoSymbol; // untyped, so only say may name it
+    std::vector<SymbolId> counters;  // of the repeat loops around the statement
+
+    bool is_counter(SymbolId name) const {
+        for (SymbolId counter : counters) {
+            if (counter == name) return true;
+        }
+        return false;
+    }
+
+    bool declared(SymbolId name) const {
+        for (const auto& scope : stack) {
+            if (scope.count(name)) return true;
+        }
+        return false;
+    }
+};
+
+}
+
+// Every variable in `expr` must be declared, and every integer literal fit
+// in a long long, which is what each backend computes in.
+static void check_expr(const Expr* expr, const Scopes& scopes, int line) {
+    if (auto num = expr_cast<NumberLiteral>(expr)) {
+        long long value;
+        std::string_view text = num->text;
+        if (num->type == ValueType::Int &&
+            std::from_chars(text.data(), text.data() + text.size(), value).ec != std::errc()) {
+            throw CompileError(DiagCode::Syntax, line,
+                "Integer literal '" + std::string(text) + "' does not fit in 64 bits");
+        }
+    }
+    else if (auto var = expr_cast<VariableRef>(expr)) {
+        if (!scopes.declared(var->name)) {
+            throw CompileError(DiagCode::UnknownVariable, line,
+                "Unknown numeric variable '" + std::string(scopes.symbols.name(var->name)) + "'");
+        }
+    }
+    else if (auto bin = expr_cast<BinaryExpr>(expr)) {
+        check_expr(bin->lhs, scopes, line);
+        check_expr(bin->rhs, scopes, line);
+    }
+}
+
+// Widens `var` to cover `type`; true if its type changed.
+static bool widen(TypeTable& vars, SymbolId var, ValueType type) {
+    ValueType slot = vars[var];
+    ValueType joined = join(join(slot, type), ValueType::Int);
+    if (joined == slot) return false;
+    vars.set(var, joined);
+    return true;
+}
+
+// One round of type propagation over `body` and everything nested in it.
+static bool infer_body(Span<Statement*> body, TypeTable& vars) {
+    bool changed = false;
+    for (auto stmt : body) {
+        if (auto set = node_cast<SetStatement>(stmt)) {
+            ValueType type = set->value ? infer(set->value, vars) : ValueType::Int;
+            changed |= widen(vars, set->var, type);
+        }
+        else if (auto arith = node_cast<ArithmeticStatement>(stmt)) {
+            changed |= widen(vars, arith->var, infer(arith->operand, vars));
+        }
+        else if (auto branch_if = node_cast<IfStatement>(stmt)) {
+            for (auto& branch : branch_if->branches) infer(branch.condition, vars);
+        }
+        else if (auto loop = node_cast<RepeatStatement>(stmt)) {
+            infer(loop->count, vars);
+            if (loop->counter != NoSymbol) changed |= widen(vars, loop->counter, ValueType::Int);
+        }
+
+        for_each_body(stmt, [&](Span<Statement*> inner) { changed |= infer_body(inner, vars); });
+    }
+    return changed;
+}
+
+// In source order: uses must follow a set in an enclosing block, and the
+// first set in scope declares.
+static void resolve_body(Span<Statement*> body, TypeTable& vars, Scopes& scopes) {
+    scopes.stack.emplace_back();
+    for (auto stmt : body) {
+        if (stmt->kind == NodeKind::Set || stmt->kind == NodeKind::Arithmetic) {
+            // The parameter is untyped, and a set of it would declare a
+            // local of the same name, which C++ rejects.
+            SymbolId var = stmt->kind == NodeKind::Set ? static_cast<SetStatement*>(stmt)->var
+                                                       : static_cast<ArithmeticStatement*>(stmt)->var;
+            if (var != NoSymbol && var == scopes.param) {
+                throw CompileError(DiagCode::Syntax, stmt->line,
+                    "Parameter '" + std::string(scopes.symbols.name(var)) + "' cannot be assigned");
+            }
+            // Every backend keeps a counter as an integer that only the loop
+            // steps, so its body may read it but not change it.
+            if (scopes.is_counter(var)) {
+                throw CompileError(DiagCode::Syntax, stmt->line,
+                    "Loop counter '" + std::string(scopes.symbols.name(var)) + "' cannot be assigned");
+            }
+        }
+
+        if (auto set = node_cast<SetStatement>(stmt)) {
+            if (set->value) check_expr(set->value, scopes, set->line);
+            set->type = vars[set->var];
+            set->declares = !scopes.declared(set->var);
+            scopes.stack.back().insert(set->var);
+        }
+        else if (auto arith = node_cast<ArithmeticStatement>(stmt)) {
+            if (!scopes.declared(arith->var)) {
+                throw CompileError(DiagCode::UnknownVariable, arith->line,
+                    "Variable '" + std::string(scopes.symbols.name(arith->var)) + "' is used before 'set'");
+            }
+            check_expr(arith->operand, scopes, arith->line);
+            arith->type = vars[arith->var];
+        }
+        else if (auto say = node_cast<SayStatement>(stmt)) {
+            for (const Argument& arg : say->args) {
+                if (arg.is_var() && arg.var != scopes.param && !scopes.declared(arg.var)) {
+                    throw CompileError(DiagCode::UnknownVariable, say->line,
+                        "Unknown variable '" + std::string(scopes.symbols.name(arg.var)) + "'");
+                }
+            }
+        }
+        else if (auto branch_if = node_cast<IfStatement>(stmt)) {
+            for (auto& branch : branch_if->branches) check_expr(branch.condition, scopes, stmt->line);
+        }
+        else if (auto loop = node_cast<RepeatStatement>(stmt)) {
+            check_expr(loop->count, scopes, stmt->line);
+            if (loop->count->type == ValueType::Float) {
+                throw CompileError(DiagCode::Syntax, stmt->line, "The count of 'repeat' must be an integer");
+            }
+            if (loop->counter != NoSymbol) {
+                // The counter lives in the loop's own scope, around the body.
+                scopes.stack.emplace_back();
+                scopes.stack.back().insert(loop->counter);
+                scopes.counters.push_back(loop->counter);
+                resolve_body(loop->body, vars, scopes);
+                scopes.counters.pop_back();
+                scopes.stack.pop_back();
+                continue;
+            }
+        }
+
+        for_each_body(stmt, [&](Span<Statement*> inner) { resolve_body(inner, vars, scopes); });
+    }
+    scopes.stack.pop_back();
+}
+
+static void analyze_body(Span<Statement*> body, const Interner& symbols, SymbolId param = NoSymbol) {
+    // Types only ever widen (Int -> Float), so this reaches a fixpoint quickly.
+    static thread_local TypeTable vars;
+    vars.prepare(symbols.size());
+    struct Reset {
+        ~Reset() { vars.clear(); }  // on errors too
+    } reset;
+    while (infer_body(body, vars)) {}
+
+    Scopes scopes{ symbols, {}, param };
+    resolve_body(body, vars, scopes);
+}
+
+void analyze_statement(AST& ast, Statement* stmt) {
+    if (auto func = node_cast<FunctionDef>(stmt)) analyze_body(func->body, ast.symbols, func->param);
+    else if (auto start = node_cast<StartBlock>(stmt)) analyze_body(start->body, ast.symbols);
+}
+
+void analyze(AST& ast) {
+    for (auto stmt : ast.statements) analyze_statement(ast, stmt);
+}
+
+namespace {
+
+enum class Arity : unsigned char { Undefined, None, One };
+
+}
+
+static void check_calls(Span<Statement*> body, const std::vector<Arity>& arity, const Interner& symbols,
+    Diagnostics& diag) {
+    for (auto stmt : body) {
+        if (auto call = node_cast<FunctionCall>(stmt)) {
+            Arity takes = arity[call->name];
+            if (takes != Arity::Undefined && (takes == Arity::One) != call->has_arg()) {
+                diag.error(DiagCode::WrongArguments, call->line, 0,
+                    "Wrong number of arguments to '" + std::string(symbols.name(call->name)) + "'");
+            }
+        }
+        for_each_body(stmt, [&](Span<Statement*> inner) { check_calls(inner, arity, symbols, diag); });
+    }
+}
+
+bool check_calls(const AST& ast, Diagnostics& diag) {
+    size_t errors = diag.errors();
+    std::vector<Arity> arity(ast.symbols.size() + 1, Arity::Undefined);
+    auto define = [&](SymbolId name, bool has_param) { arity[name] = has_param ? Arity::One : Arity::None; };
+    for (const ExternFunction& func : ast.externs) define(func.name, func.has_param);
+    for (auto stmt : ast.statements) {
+        if (auto func = node_cast<FunctionDef>(stmt)) define(func->name, func->param != NoSymbol);
+    }
+    for (auto stmt : ast.statements) {
+        if (auto func = node_cast<FunctionDef>(stmt)) check_calls(func->body, arity, ast.symbols, diag);
+        else if (auto start = node_cast<StartBlock>(stmt)) check_calls(start->body, arity, ast.symbols, diag);
+    }
+    return diag.errors() == errors;
+}
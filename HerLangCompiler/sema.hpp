@@ -0,0 +1,24 @@
+// sema.hpp - Semantic analysis over a parsed AST
+#pragma once
+#include "ast.hpp"
+#include "diagnostics.hpp"
+
+// Infers the static type of every numeric variable and expression, and marks
+// which `set` declares its variable. Variables are block scoped, as in C++:
+// one set inside an if arm or loop body is not visible after it. A name that
+// is ever assigned a float is a float throughout its function. Throws
+// CompileError for a variable used before it is set, and for an integer
+// literal that does not fit in a long long. A function's parameter may only be
+// said, and a loop counter inside its loop only read; neither may be set or
+// changed by arithmetic. A repeat count must be an integer.
+void analyze(AST& ast);
+
+// Analyzes one top-level statement of `ast`, exactly as analyze() does each
+// of them: function and start bodies are checked independently.
+void analyze_statement(AST& ast, Statement* stmt);
+
+// Reports to `diag` every call that passes an argument to a function taking
+// none, or none to one taking one, as every backend requires; false if there
+// was one. Functions are those defined in `ast` and its externs, so this runs
+// once imports are linked; calls to unknown names are left to the backend.
+bool check_calls(const AST& ast, Diagnostics& diag);
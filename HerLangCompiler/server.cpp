@@ -0,0 +1,244 @@
+// server.cpp - hcp --server: a long-running compiler for build systems and editors
+#include "server.hpp"
+#include "cache.hpp"
+#include "incremental.hpp"
+#include "output.hpp"
+#include "source.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <system_error>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct FileStamp {
+    uintmax_t size = 0;
+    fs::file_time_type mtime{};
+    bool valid = false;
+
+    bool operator==(const FileStamp& other) const {
+        return valid && other.valid && size == other.size && mtime == other.mtime;
+    }
+    bool operator!=(const FileStamp& other) const { return !(*this == other); }
+};
+
+FileStamp stamp_of(const std::string& path) {
+    FileStamp stamp;
+    std::error_code ec;
+    stamp.size = fs::file_size(path, ec);
+    if (ec) return stamp;
+    stamp.mtime = fs::last_write_time(path, ec);
+    stamp.valid = !ec;
+    return stamp;
+}
+
+// A file modified this recently could change again within the same mtime
+// tick without its stamp changing, so it is not trusted to mean "unchanged".
+bool racy(const FileStamp& stamp) {
+    return fs::file_time_type::clock::now() - stamp.mtime < std::chrono::seconds(2);
+}
+
+bool read_file(const std::string& path, std::string& text) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    text.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return !in.bad();
+}
+
+// Leaves `path` untouched when it already holds `bytes`.
+bool write_if_changed(const std::string& path, const std::string& bytes) {
+    {
+        SourceBuffer existing;
+        if (existing.open(path) && existing.view() == bytes) return true;
+    }
+    FileSink out;
+    if (!out.open(path)) return false;
+    out << bytes;
+    return out.close();
+}
+
+}
+
+struct CompileServer::Document {
+    Document(const CompileOptions& options, const std::string& input) : compiler(options, input) {}
+
+    FileStamp input;
+    uint64_t source_key = 0;  // content hash seeded with the options, as in the disk cache
+    uint64_t key = 0;         // that, with the import digest when there are imports
+    std::vector<ModuleImport> imports;
+    bool built = false;
+
+    // Two buffers so the compiler can diff the new text against the old
+    // one; they live in the heap-allocated Document and never move.
+    std::string texts[2];
+    int current = 0;
+    IncrementalCompiler compiler;
+
+    // As found, before -Werror and -Wno-, which apply per request.
+    bool ok = false;
+    std::string generated;
+    Diagnostics diagnostics;
+
+    std::string output_path;
+    FileStamp output;
+};
+
+CompileServer::CompileServer(CompileOptions options)
+    : options(std::move(options)), options_seed(hash_bytes(options_fingerprint(this->options))) {}
+
+CompileServer::~CompileServer() = default;
+
+void CompileServer::forget(const std::string& input) {
+    documents.erase(input);
+}
+
+// Regenerates doc from texts[current], whose hash is `key`.
+void CompileServer::rebuild(Document& doc, const std::string& input, uint64_t key) {
+    const std::string& text = doc.texts[doc.current];
+    doc.source_key = key;
+    doc.key = key;
+    doc.imports.clear();
+    doc.built = true;
+    doc.generated.clear();
+    doc.diagnostics.clear();
+    doc.output = FileStamp();
+
+    CompileCache cache(options.cache_dir);
+    std::string cached;
+    uint64_t entry;
+    if (!options.cache_dir.empty() && cached_entry_key(options.cache_dir, input, key, entry, &doc.imports) &&
+        cache.lookup(entry, cached) && doc.diagnostics.load(cached)) {
+        // The compiler's state views the previous text, which may be overwritten next.
+        doc.compiler.reset();
+        doc.key = entry;
+        doc.ok = read_file(cache.entry_path(entry), doc.generated);
+        if (doc.ok) return;
+        doc.diagnostics.clear();
+    }
+
+    StringSink out;
+    doc.ok = doc.compiler.compile(text, out, doc.diagnostics);
+    doc.imports = doc.compiler.imports().imports;
+    if (!doc.ok) return;
+    doc.generated = out.str();
+    doc.key = doc.imports.empty() ? key : with_imports(key, doc.compiler.imports().digest);
+
+    if (options.cache_dir.empty()) return;
+    std::string temp = cache.temp_path(key);
+    FileSink entry_file;
+    bool written = entry_file.open(temp);
+    if (written) {
+        entry_file << doc.generated;
+        written = entry_file.close();
+    }
+    if (!written || !cache.store(store_imports(options.cache_dir, key, doc.compiler.imports()), temp,
+        doc.diagnostics.save())) {
+        std::error_code ec;
+        fs::remove(temp, ec);
+    }
+}
+
+// Whether what doc imports still has the interfaces it was generated against.
+bool CompileServer::imports_current(const Document& doc, const std::string& input) const {
+    if (doc.imports.empty()) return true;
+    uint64_t digest;
+    return import_digest(doc.imports, input, options.cache_dir, digest) &&
+        with_imports(doc.source_key, digest) == doc.key;
+}
+
+bool CompileServer::compile(const CompileJob& job, Diagnostics& diag) {
+    diag.set_file(job.input);
+    if (job.output == "-") {
+        // stdout carries the protocol.
+        diag.error(DiagCode::Io, 0, 0, "Cannot write to output file: " + job.output);
+        return false;
+    }
+
+    FileStamp stamp = stamp_of(job.input);
+    if (!stamp.valid) {
+        forget(job.input);
+        diag.error(DiagCode::Io, 0, 0, "Cannot open input file: " + job.input);
+        return false;
+    }
+
+    std::unique_ptr<Document>& slot = documents[job.input];
+    if (!slot) slot = std::make_unique<Document>(options, job.input);
+    Document& doc = *slot;
+
+    bool rebuilt = false;
+    if (!doc.built || stamp != doc.input) {
+        int next = doc.built ? 1 - doc.current : doc.current;
+        if (!read_file(job.input, doc.texts[next])) {
+            forget(job.input);
+            diag.error(DiagCode::Io, 0, 0, "Cannot open input file: " + job.input);
+            return false;
+        }
+        uint64_t key = hash_bytes(doc.texts[next], options_seed);
+        if (!doc.built || key != doc.source_key) {
+            doc.current = next;
+            rebuild(doc, job.input, key);
+            rebuilt = true;
+        }
+        doc.input = racy(stamp) ? FileStamp() : stamp;
+    }
+    // The file may be unchanged while a module it imports is not.
+    if (!rebuilt && !imports_current(doc, job.input)) rebuild(doc, job.input, doc.source_key);
+
+    size_t errors = diag.errors();
+    diag.append(doc.diagnostics);
+    if (!doc.ok || diag.errors() != errors) return false;
+
+    if (job.output != doc.output_path || stamp_of(job.output) != doc.output) {
+        if (!write_if_changed(job.output, doc.generated)) {
+            doc.output = FileStamp();
+            diag.error(DiagCode::Io, 0, 0, "Cannot write to output file: " + job.output);
+            return false;
+        }
+        doc.output_path = job.output;
+        doc.output = stamp_of(job.output);
+    }
+    return true;
+}
+
+void CompileServer::serve(std::istream& in, std::ostream& out) {
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(trim(line));
+        std::string command;
+        fields >> command;
+        if (command.empty()) continue;
+        if (command == "quit") break;
+
+        Diagnostics diag(options.diagnostics);
+        bool ok = false;
+        std::string input;
+        fields >> input;
+        if (command == "compile" && !input.empty()) {
+            CompileJob job{ input, "" };
+            fields >> job.output;
+            if (job.output.empty()) job.output = default_output_path(input, output_extension(options));
+            ok = compile(job, diag);
+        }
+        else if (command == "forget" && !input.empty()) {
+            forget(input);
+            ok = true;
+        }
+        else {
+            diag.error(DiagCode::Request, 0, 0, "Unknown request: " + trim(line));
+        }
+
+        std::ostringstream rendered;
+        diag.print(rendered);
+        std::string diagnostics = rendered.str();
+        if (!diagnostics.empty() && diagnostics.back() != '\n') diagnostics += '\n';
+        out << (ok ? "ok " : "error ") << std::count(diagnostics.begin(), diagnostics.end(), '\n') << "\n"
+            << diagnostics << std::flush;
+    }
+}
@@ -0,0 +1,51 @@
+// server.hpp - hcp --server: a long-running compiler for build systems and editors
+#pragma once
+#include "driver.hpp"
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+// Compiles files on request and keeps what it learned about each one warm:
+// its size and mtime, content hash and generated code, and an
+// IncrementalCompiler. An unchanged file is answered from memory without
+// being read, a touched but identical one without being lexed, and an
+// edited one only recompiles the definitions the edit touched. The output
+// is only rewritten when its content would differ, or when something else
+// changed or removed it.
+//
+// Results and diagnostics are the same as compile_file() with the same
+// options, including the on-disk cache when options.cache_dir is set.
+class CompileServer {
+public:
+    explicit CompileServer(CompileOptions options);
+    ~CompileServer();
+
+    bool compile(const CompileJob& job, Diagnostics& diag);
+
+    // Drops everything kept for `input`.
+    void forget(const std::string& input);
+
+    // Answers requests read from `in`, one per line, until "quit" or end of
+    // input:
+    //
+    //   compile in.herc [out]   compile, to out or the default output path
+    //   forget in.herc          drop the state kept for in.herc
+    //   quit
+    //
+    // Each request gets "ok N" or "error N" on `out`, followed by the N lines
+    // of diagnostics it produced, as text or JSON as the options say, and
+    // `out` is flushed.
+    void serve(std::istream& in, std::ostream& out);
+
+private:
+    struct Document;
+
+    void rebuild(Document& doc, const std::string& input, uint64_t key);
+    bool imports_current(const Document& doc, const std::string& input) const;
+
+    CompileOptions options;
+    uint64_t options_seed;
+    std::unordered_map<std::string, std::unique_ptr<Document>> documents;
+};
@@ -0,0 +1,31 @@
+// source.hpp - Read-only, memory-mapped view of a source file
+#pragma once
+#include <string>
+#include <string_view>
+
+// Maps the whole input file once so the lexer can scan it in place instead of
+// copying it into strings. Falls back to reading into memory when the file
+// cannot be mapped (empty files, pipes).
+class SourceBuffer {
+public:
+    SourceBuffer() = default;
+    ~SourceBuffer();
+
+    SourceBuffer(const SourceBuffer&) = delete;
+    SourceBuffer& operator=(const SourceBuffer&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+
+    std::string_view view() const { return std::string_view(data_, size_); }
+    size_t size() const { return size_; }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    bool mapped_ = false;
+    std::string fallback_;
+#ifdef _WIN32
+    void* mapping_ = nullptr;
+#endif
+};
@@ -0,0 +1,101 @@
+// stats.cpp - Per-phase timing and allocation instrumentation
+#include "stats.hpp"
+#include "utils.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <ostream>
+
+static thread_local AllocationCounters allocations;
+
+void* operator new(std::size_t size) {
+    void* p = std::malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    allocations.count++;
+    allocations.bytes += size;
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+AllocationCounters thread_allocations() {
+    return allocations;
+}
+
+PhaseTimer::PhaseTimer(CompileStats* stats, const char* name)
+    : stats(stats), name(name) {
+    if (!stats) return;
+    start_allocations = thread_allocations();
+    start = std::chrono::steady_clock::now();
+}
+
+PhaseTimer::~PhaseTimer() {
+    if (!stats) return;
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    AllocationCounters now = thread_allocations();
+    stats->phases.push_back({
+        name,
+        std::chrono::duration<double, std::milli>(elapsed).count(),
+        now.count - start_allocations.count,
+        now.bytes - start_allocations.bytes
+    });
+}
+
+static double total_ms(const CompileStats& file) {
+    double ms = 0;
+    for (const auto& phase : file.phases) ms += phase.ms;
+    return ms;
+}
+
+void print_time_report(std::ostream& out, const std::vector<CompileStats>& files) {
+    char row[128];
+    for (const auto& file : files) {
+        out << "Time report: " << file.file << " (" << file.source_bytes << " bytes, "
+            << file.tokens << " tokens, " << file.ast_nodes << " AST nodes, "
+            << file.output_bytes << " output bytes" << (file.cache_hit ? ", cache hit" : "") << ")\n";
+        std::snprintf(row, sizeof(row), "  %-10s %10s %10s %12s\n", "phase", "wall ms", "allocs", "alloc bytes");
+        out << row;
+
+        size_t count = 0, bytes = 0;
+        for (const auto& phase : file.phases) {
+            std::snprintf(row, sizeof(row), "  %-10s %10.3f %10zu %12zu\n",
+                phase.name, phase.ms, phase.allocations, phase.allocated_bytes);
+            out << row;
+            count += phase.allocations;
+            bytes += phase.allocated_bytes;
+        }
+        std::snprintf(row, sizeof(row), "  %-10s %10.3f %10zu %12zu\n", "total", total_ms(file), count, bytes);
+        out << row;
+    }
+}
+
+void print_time_report_json(std::ostream& out, const std::vector<CompileStats>& files) {
+    out << "{\"files\":[";
+    for (size_t i = 0; i < files.size(); ++i) {
+        const auto& file = files[i];
+        if (i) out << ",";
+        out << "{\"file\":\"" << json_escape(file.file) << "\""
+            << ",\"source_bytes\":" << file.source_bytes
+            << ",\"tokens\":" << file.tokens
+            << ",\"ast_nodes\":" << file.ast_nodes
+            << ",\"output_bytes\":" << file.output_bytes
+            << ",\"cache_hit\":" << (file.cache_hit ? "true" : "false")
+            << ",\"total_ms\":" << total_ms(file)
+            << ",\"phases\":[";
+        for (size_t p = 0; p < file.phases.size(); ++p) {
+            const auto& phase = file.phases[p];
+            if (p) out << ",";
+            out << "{\"name\":\"" << phase.name << "\",\"ms\":" << phase.ms
+                << ",\"allocations\":" << phase.allocations
+                << ",\"bytes\":" << phase.allocated_bytes << "}";
+        }
+        out << "]}";
+    }
+    out << "]}\n";
+}
@@ -0,0 +1,54 @@
+// stats.hpp - Per-phase timing and allocation instrumentation
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// Heap activity of the calling thread since it started. Every operator new
+// in the process is counted; a compilation runs on a single thread, so the
+// difference between two snapshots is what that pipeline allocated.
+struct AllocationCounters {
+    size_t count = 0;
+    size_t bytes = 0;
+};
+
+AllocationCounters thread_allocations();
+
+struct PhaseStats {
+    const char* name;
+    double ms;
+    size_t allocations;
+    size_t allocated_bytes;
+};
+
+struct CompileStats {
+    std::string file;
+    size_t source_bytes = 0;
+    size_t tokens = 0;
+    size_t ast_nodes = 0;
+    size_t output_bytes = 0;
+    bool cache_hit = false;
+    std::vector<PhaseStats> phases;
+};
+
+// Records one phase into `stats` when it goes out of scope; does nothing when
+// `stats` is null, so the pipeline can be instrumented unconditionally.
+class PhaseTimer {
+public:
+    PhaseTimer(CompileStats* stats, const char* name);
+    ~PhaseTimer();
+
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+private:
+    CompileStats* stats;
+    const char* name;
+    std::chrono::steady_clock::time_point start;
+    AllocationCounters start_allocations;
+};
+
+void print_time_report(std::ostream& out, const std::vector<CompileStats>& files);
+void print_time_report_json(std::ostream& out, const std::vector<CompileStats>& files);
@@ -1,23 +1,25 @@
 // utils.cpp
 #include "utils.hpp"
+#include "scan.hpp"
 #include <algorithm>
 #include <sstream>
 
 
 std::string trim(const std::string& s) {
-    if (s.empty()) return "";
+    return std::string(trim_view(s));
+}
 
-    size_t start = 0;
-    size_t end = s.size() - 1;
 
-    while (start < s.size() && std::isspace(static_cast<unsigned char>(s[start]))) {
-        ++start;
-    }
-    while (end >= start && std::isspace(static_cast<unsigned char>(s[end]))) {
+std::string_view trim_view(std::string_view s) {
+    size_t start = skip_spaces(s, 0);
+    size_t end = s.size();
+
+    // Trailing whitespace is rarely more than a '\r', so this stays scalar.
+    while (end > start && is_space(s[end - 1])) {
         --end;
     }
 
-    return s.substr(start, end - start + 1);
+    return s.substr(start, end - start);
 }
 
 
@@ -29,4 +31,26 @@ std::vector<std::string> split_lines(const std::string& text) {
         lines.push_back(line);
     }
     return lines;
+}
+
+
+std::string json_escape(std::string_view s) {
+    static const char hex[] = "0123456789abcdef";
+    std::string out;
+    out.reserve(s.size());
+    for (char c : s) {
+        unsigned char u = static_cast<unsigned char>(c);
+        if (c == '"') out += "\\\"";
+        else if (c == '\\') out += "\\\\";
+        else if (c == '\n') out += "\\n";
+        else if (c == '\t') out += "\\t";
+        else if (c == '\r') out += "\\r";
+        else if (u < 0x20) {
+            out += "\\u00";
+            out += hex[u >> 4];
+            out += hex[u & 0xf];
+        }
+        else out += c;
+    }
+    return out;
 }
\ No newline at end of file
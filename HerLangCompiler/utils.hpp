@@ -1,9 +1,14 @@
 // utils.hpp
 #pragma once
 #include <string>
+#include <string_view>
 #include <vector>
 #include <cctype>
 
 
 std::string trim(const std::string& s);
-std::vector<std::string> split_lines(const std::string& text);
\ No newline at end of file
+std::string_view trim_view(std::string_view s);
+std::vector<std::string> split_lines(const std::string& text);
+
+// Escapes `s` for use inside a JSON string literal.
+std::string json_escape(std::string_view s);
\ No newline at end of file
@@ -0,0 +1,6 @@
+// version.hpp - Compiler version
+#pragma once
+
+// Part of every cache key: bump it whenever generated code changes for the
+// same input and flags.
+#define HCP_VERSION "0.6.7"
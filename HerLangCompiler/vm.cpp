@@ -0,0 +1,555 @@
+// vm.cpp - Bytecode compiler and interpreter for `hcp run`
+#include "vm.hpp"
+#include "diagnostics.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+// Computed goto gives every instruction its own indirect branch, which
+// predicts far better than one shared switch. MSVC lacks it and gets the
+// switch.
+#if defined(__GNUC__) || defined(__clang__)
+#define HERLANG_THREADED_DISPATCH 1
+#else
+#define HERLANG_THREADED_DISPATCH 0
+#endif
+
+namespace {
+
+enum class ParamType : uint8_t {
+    None,
+    String,
+    Int,
+    Float
+};
+
+struct Local {
+    int32_t slot;
+    ValueType type;
+};
+
+ValueType join(ValueType a, ValueType b) {
+    return a == ValueType::Float || b == ValueType::Float ? ValueType::Float : ValueType::Int;
+}
+
+bool is_comparison(BinaryOp op) {
+    return op >= BinaryOp::Less;
+}
+
+class BytecodeCompiler {
+public:
+    explicit BytecodeCompiler(const AST& ast) : ast(ast) {}
+
+    Bytecode run();
+
+private:
+    struct Pending {
+        const FunctionDef* func;
+        ParamType param;
+    };
+
+    uint32_t function_index(const FunctionDef* func, ParamType param);
+    void compile_function(Span<Statement*> body, SymbolId param_name, ParamType param);
+
+    int32_t emit(Op op, int32_t a = 0, int32_t b = 0, int32_t c = 0);
+    int32_t temp();
+    int32_t constant(Cell value);
+    uint32_t string_index(std::string_view text);
+    const Local* lookup(SymbolId name) const;
+    std::string name(SymbolId id) const { return std::string(ast.symbols.name(id)); }
+
+    int32_t compile_expr(const Expr* expr, ValueType type);
+    void compile_into(const Expr* expr, ValueType type, int32_t dst);
+
+    void compile_body(Span<Statement*> body);
+    void compile_stmt(const Statement* stmt);
+    void compile_say(const SayStatement* say);
+    void compile_call(const FunctionCall* call);
+    void compile_if(const IfStatement* branch_if);
+    void compile_repeat(const RepeatStatement* loop);
+
+    const AST& ast;
+    Bytecode program;
+    std::unordered_map<SymbolId, const FunctionDef*> functions;
+    std::unordered_map<uint64_t, uint32_t> function_indices;  // by name and ParamType
+    std::vector<Pending> pending;
+    std::unordered_map<std::string, uint32_t> string_indices;
+
+    // State of the function being compiled. Slots are handed out as a stack:
+    // each statement releases its temporaries, and each block its locals.
+    std::vector<std::unordered_map<SymbolId, Local>> scopes;
+    int32_t next_slot = 0;
+    uint32_t frame_size = 0;
+    int line = 0;
+    SymbolId param_name = NoSymbol;
+    ParamType param = ParamType::None;
+};
+
+Bytecode BytecodeCompiler::run() {
+    const StartBlock* start = nullptr;
+    for (auto stmt : ast.statements) {
+        if (auto func = node_cast<FunctionDef>(stmt)) {
+            functions[func->name] = func;
+        }
+        else if (auto block = node_cast<StartBlock>(stmt)) {
+            if (start) throw CompileError(DiagCode::ProgramStructure, block->line, "More than one start block");
+            start = block;
+        }
+    }
+    if (!start) throw CompileError(DiagCode::ProgramStructure, 0, "Nothing to run: no start block");
+
+    program.functions.push_back({ 0, 0 });
+    compile_function(start->body, NoSymbol, ParamType::None);
+    program.functions[0].frame_size = frame_size;
+
+    // Compiling one function can request more; the list only grows.
+    for (size_t i = 0; i < pending.size(); ++i) {
+        Pending next = pending[i];
+        program.functions[i + 1].entry = static_cast<uint32_t>(program.code.size());
+        compile_function(next.func->body, next.func->param, next.param);
+        program.functions[i + 1].frame_size = frame_size;
+    }
+    return std::move(program);
+}
+
+uint32_t BytecodeCompiler::function_index(const FunctionDef* func, ParamType param) {
+    uint64_t key = static_cast<uint64_t>(func->name) << 8 | static_cast<uint8_t>(param);
+
+    auto [it, inserted] = function_indices.try_emplace(key, static_cast<uint32_t>(program.functions.size()));
+    if (inserted) {
+        program.functions.push_back({ 0, 0 });
+        pending.push_back({ func, param });
+    }
+    return it->second;
+}
+
+void BytecodeCompiler::compile_function(Span<Statement*> body, SymbolId name, ParamType type) {
+    scopes.assign(1, {});
+    param_name = name;
+    param = type;
+    // The argument, if any, arrives in slot 0.
+    next_slot = type == ParamType::None ? 0 : 1;
+    frame_size = static_cast<uint32_t>(next_slot);
+
+    compile_body(body);
+    emit(Op::Return);
+}
+
+int32_t BytecodeCompiler::emit(Op op, int32_t a, int32_t b, int32_t c) {
+    program.code.push_back({ op, a, b, c });
+    program.lines.push_back(line);
+    return static_cast<int32_t>(program.code.size() - 1);
+}
+
+int32_t BytecodeCompiler::temp() {
+    int32_t slot = next_slot++;
+    if (static_cast<uint32_t>(next_slot) > frame_size) frame_size = static_cast<uint32_t>(next_slot);
+    return slot;
+}
+
+int32_t BytecodeCompiler::constant(Cell value) {
+    program.constants.push_back(value);
+    return static_cast<int32_t>(program.constants.size() - 1);
+}
+
+uint32_t BytecodeCompiler::string_index(std::string_view text) {
+    auto [it, inserted] = string_indices.try_emplace(std::string(text), static_cast<uint32_t>(program.strings.size()));
+    if (inserted) program.strings.emplace_back(text);
+    return it->second;
+}
+
+const Local* BytecodeCompiler::lookup(SymbolId name) const {
+    for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+        auto it = scope->find(name);
+        if (it != scope->end()) return &it->second;
+    }
+    return nullptr;
+}
+
+// Returns the slot holding `expr` as `type`. A variable that already has
+// the type is used in place.
+int32_t BytecodeCompiler::compile_expr(const Expr* expr, ValueType type) {
+    if (auto var = expr_cast<VariableRef>(expr)) {
+        const Local* local = lookup(var->name);
+        if (local && local->type == join(type, ValueType::Int)) return local->slot;
+    }
+    int32_t dst = temp();
+    compile_into(expr, type, dst);
+    return dst;
+}
+
+void BytecodeCompiler::compile_into(const Expr* expr, ValueType type, int32_t dst) {
+    bool want_float = type == ValueType::Float;
+
+    if (auto num = expr_cast<NumberLiteral>(expr)) {
+        std::string text(num->text);
+        Cell value;
+        if (want_float) value.f = std::strtod(text.c_str(), nullptr);
+        else value.i = expr->type == ValueType::Float ? static_cast<long long>(std::strtod(text.c_str(), nullptr))
+                                                      : std::strtoll(text.c_str(), nullptr, 10);
+        emit(Op::Const, dst, constant(value));
+        return;
+    }
+
+    if (auto var = expr_cast<VariableRef>(expr)) {
+        const Local* local = lookup(var->name);
+        if (!local) {
+            throw CompileError(DiagCode::UnknownVariable, 0, "Unknown numeric variable '" + name(var->name) + "'");
+        }
+        if (local->type == ValueType::Float && !want_float) emit(Op::FloatToInt, dst, local->slot);
+        else if (local->type != ValueType::Float && want_float) emit(Op::IntToFloat, dst, local->slot);
+        else emit(Op::Move, dst, local->slot);
+        return;
+    }
+
+    auto bin = static_cast<const BinaryExpr*>(expr);
+    ValueType operands = join(bin->lhs->type, bin->rhs->type);
+    bool fp = operands == ValueType::Float;
+    int32_t mark = next_slot;
+    int32_t lhs = compile_expr(bin->lhs, operands);
+    int32_t rhs = compile_expr(bin->rhs, operands);
+    next_slot = mark;
+
+    // The float forms follow the integer ones in the same order, and the
+    // comparisons follow the arithmetic.
+    static constexpr Op int_ops[] = { Op::AddI, Op::SubI, Op::MulI, Op::DivI,
+        Op::LtI, Op::LeI, Op::GtI, Op::GeI, Op::EqI, Op::NeI };
+    static constexpr Op float_ops[] = { Op::AddF, Op::SubF, Op::MulF, Op::DivF,
+        Op::LtF, Op::LeF, Op::GtF, Op::GeF, Op::EqF, Op::NeF };
+    Op op = (fp ? float_ops : int_ops)[static_cast<size_t>(bin->op)];
+
+    ValueType result = is_comparison(bin->op) ? ValueType::Int : operands;
+    bool result_float = result == ValueType::Float;
+    if (result_float == want_float) {
+        emit(op, dst, lhs, rhs);
+        return;
+    }
+    int32_t raw = temp();
+    emit(op, raw, lhs, rhs);
+    emit(want_float ? Op::IntToFloat : Op::FloatToInt, dst, raw);
+    next_slot = mark;
+}
+
+void BytecodeCompiler::compile_body(Span<Statement*> body) {
+    scopes.emplace_back();
+    int32_t mark = next_slot;
+    for (auto stmt : body) compile_stmt(stmt);
+    next_slot = mark;
+    scopes.pop_back();
+}
+
+void BytecodeCompiler::compile_stmt(const Statement* stmt) {
+    line = stmt->line;
+    int32_t mark = next_slot;
+
+    switch (stmt->kind) {
+    case NodeKind::Say:
+        compile_say(static_cast<const SayStatement*>(stmt));
+        break;
+    case NodeKind::Set: {
+        auto set = static_cast<const SetStatement*>(stmt);
+        ValueType type = join(set->type, ValueType::Int);
+        const Local* target = set->declares ? nullptr : lookup(set->var);
+        int32_t slot = target ? target->slot : temp();
+        if (set->value) {
+            compile_into(set->value, target ? target->type : type, slot);
+        }
+        else {
+            Cell zero;
+            if (type == ValueType::Float) zero.f = 0;
+            else zero.i = 0;
+            emit(Op::Const, slot, constant(zero));
+        }
+        // Bound only now, so the value still sees any outer variable it shadows.
+        if (set->declares) {
+            scopes.back()[set->var] = { slot, type };
+            mark = slot + 1;
+        }
+        break;
+    }
+    case NodeKind::Arithmetic: {
+        auto arith = static_cast<const ArithmeticStatement*>(stmt);
+        const Local* local = lookup(arith->var);
+        bool fp = local->type == ValueType::Float;
+        int32_t operand = compile_expr(arith->operand, local->type);
+        static constexpr Op int_ops[] = { Op::AddI, Op::SubI, Op::MulI, Op::DivI };
+        static constexpr Op float_ops[] = { Op::AddF, Op::SubF, Op::MulF, Op::DivF };
+        emit((fp ? float_ops : int_ops)[static_cast<size_t>(arith->op)], local->slot, local->slot, operand);
+        break;
+    }
+    case NodeKind::FunctionCall:
+        compile_call(static_cast<const FunctionCall*>(stmt));
+        break;
+    case NodeKind::If:
+        compile_if(static_cast<const IfStatement*>(stmt));
+        break;
+    case NodeKind::Repeat:
+        compile_repeat(static_cast<const RepeatStatement*>(stmt));
+        break;
+    case NodeKind::FunctionDef:
+    case NodeKind::StartBlock:
+    case NodeKind::Import:
+        throw CompileError(DiagCode::ProgramStructure, stmt->line, "Nested function or start block");
+    }
+
+    next_slot = mark;
+}
+
+void BytecodeCompiler::compile_say(const SayStatement* say) {
+    // Adjacent literal pieces, the ending included, print as one string.
+    std::string run;
+    auto flush_run = [&]() {
+        if (run.empty()) return;
+        emit(Op::PrintLit, static_cast<int32_t>(string_index(run)));
+        run.clear();
+    };
+
+    for (const Argument& arg : say->args) {
+        if (!arg.is_var()) {
+            run += arg.text;
+            continue;
+        }
+
+        flush_run();
+        const Local* local = lookup(arg.var);
+        if (!local && arg.var == param_name && param != ParamType::None) {
+            emit(param == ParamType::String ? Op::PrintStr : param == ParamType::Float ? Op::PrintFloat : Op::PrintInt, 0);
+        }
+        else if (local) {
+            emit(local->type == ValueType::Float ? Op::PrintFloat : Op::PrintInt, local->slot);
+        }
+        else {
+            throw CompileError(DiagCode::UnknownVariable, say->line, "Unknown variable '" + name(arg.var) + "'");
+        }
+    }
+    run += say->end == "\\n" ? std::string_view("\n") : say->end;
+    flush_run();
+}
+
+void BytecodeCompiler::compile_call(const FunctionCall* call) {
+    auto it = functions.find(call->name);
+    if (it == functions.end()) {
+        throw CompileError(DiagCode::UnknownFunction, call->line, "Unknown function '" + name(call->name) + "'");
+    }
+    const FunctionDef* func = it->second;
+    if ((func->param != NoSymbol) != call->has_arg()) {
+        throw CompileError(DiagCode::WrongArguments, call->line,
+            "Wrong number of arguments to '" + name(call->name) + "'");
+    }
+
+    if (!call->has_arg()) {
+        emit(Op::Call, static_cast<int32_t>(function_index(func, ParamType::None)));
+        return;
+    }
+
+    ParamType type;
+    int32_t arg;
+    if (!call->arg.is_var()) {
+        Cell text;
+        text.str = string_index(call->arg.text);
+        type = ParamType::String;
+        arg = temp();
+        emit(Op::Const, arg, constant(text));
+    }
+    else if (const Local* local = lookup(call->arg.var)) {
+        type = local->type == ValueType::Float ? ParamType::Float : ParamType::Int;
+        arg = local->slot;
+    }
+    else if (call->arg.var == param_name && param != ParamType::None) {
+        type = param;
+        arg = 0;
+    }
+    else {
+        throw CompileError(DiagCode::UnknownVariable, call->line, "Unknown variable '" + name(call->arg.var) + "'");
+    }
+    emit(Op::Call, static_cast<int32_t>(function_index(func, type)), arg, 1);
+}
+
+void BytecodeCompiler::compile_if(const IfStatement* branch_if) {
+    std::vector<int32_t> exits;
+    for (auto& branch : branch_if->branches) {
+        int32_t mark = next_slot;
+        ValueType type = join(branch.condition->type, ValueType::Int);
+        int32_t cond = compile_expr(branch.condition, type);
+        next_slot = mark;
+        int32_t skip = emit(type == ValueType::Float ? Op::JumpIfFloatZero : Op::JumpIfZero, cond);
+
+        compile_body(branch.body);
+        exits.push_back(emit(Op::Jump));
+        program.code[skip].b = static_cast<int32_t>(program.code.size());
+    }
+    compile_body(branch_if->else_body);
+
+    for (int32_t exit : exits) program.code[exit].a = static_cast<int32_t>(program.code.size());
+}
+
+void BytecodeCompiler::compile_repeat(const RepeatStatement* loop) {
+    // The count is evaluated once; a float count truncates.
+    int32_t limit = temp();
+    compile_into(loop->count, ValueType::Int, limit);
+
+    int32_t counter = temp();
+    Cell zero;
+    zero.i = 0;
+    emit(Op::Const, counter, constant(zero));
+
+    scopes.emplace_back();
+    if (loop->counter != NoSymbol) scopes.back()[loop->counter] = { counter, ValueType::Int };
+
+    int32_t test = emit(Op::LoopTest, counter, limit);
+    compile_body(loop->body);
+    emit(Op::Increment, counter);
+    emit(Op::Jump, test);
+    program.code[test].c = static_cast<int32_t>(program.code.size());
+
+    scopes.pop_back();
+}
+
+void print_float(OutputSink& out, double value) {
+    // Six significant digits, like std::cout's default.
+    char buf[32];
+    int n = std::snprintf(buf, sizeof buf, "%g", value);
+    out << std::string_view(buf, static_cast<size_t>(n));
+}
+
+[[noreturn]] void runtime_error(const Bytecode& program, const Instr* pc, const char* what) {
+    size_t index = static_cast<size_t>(pc - program.code.data());
+    throw CompileError(DiagCode::Runtime, program.lines[index], what);
+}
+
+// Integer arithmetic wraps around on overflow, as DivI does, so it goes
+// through unsigned, where wrapping is defined.
+using Wrapping = unsigned long long;
+
+}
+
+Bytecode compile_bytecode(const AST& ast) {
+    return BytecodeCompiler(ast).run();
+}
+
+void run_bytecode(const Bytecode& program, OutputSink& out) {
+    struct ReturnAddress {
+        const Instr* pc;
+        size_t base;
+    };
+    static constexpr size_t max_depth = 1 << 16;
+
+    const Instr* code = program.code.data();
+    const Cell* constants = program.constants.data();
+    std::vector<Cell> stack(program.functions[0].frame_size + 1);
+    std::vector<ReturnAddress> calls;
+    size_t base = 0;
+    size_t frame_size = program.functions[0].frame_size;
+    Cell* frame = stack.data();
+    const Instr* pc = code + program.functions[0].entry;
+
+#define A frame[pc->a]
+#define B frame[pc->b]
+#define C frame[pc->c]
+
+#if HERLANG_THREADED_DISPATCH
+    static void* const dispatch[] = {
+#define HERLANG_VM_LABEL(name) &&op_##name,
+        HERLANG_VM_OPS(HERLANG_VM_LABEL)
+#undef HERLANG_VM_LABEL
+    };
+#define VM_CASE(name) op_##name:
+#define VM_DISPATCH() goto *dispatch[static_cast<size_t>(pc->op)]
+#define VM_NEXT() do { ++pc; VM_DISPATCH(); } while (0)
+    VM_DISPATCH();
+#else
+#define VM_CASE(name) case Op::name:
+#define VM_DISPATCH() continue
+#define VM_NEXT() do { ++pc; continue; } while (0)
+    for (;;) {
+        switch (pc->op) {
+#endif
+
+    VM_CASE(Const)      A = constants[pc->b]; VM_NEXT();
+    VM_CASE(Move)       A = B; VM_NEXT();
+    VM_CASE(AddI)       A.i = static_cast<long long>(Wrapping(B.i) + Wrapping(C.i)); VM_NEXT();
+    VM_CASE(SubI)       A.i = static_cast<long long>(Wrapping(B.i) - Wrapping(C.i)); VM_NEXT();
+    VM_CASE(MulI)       A.i = static_cast<long long>(Wrapping(B.i) * Wrapping(C.i)); VM_NEXT();
+    VM_CASE(DivI)
+        if (C.i == 0) runtime_error(program, pc, "Integer division by zero");
+        // Dividing LLONG_MIN by -1 overflows; negate with wraparound instead.
+        A.i = C.i == -1 ? static_cast<long long>(0ULL - static_cast<unsigned long long>(B.i)) : B.i / C.i;
+        VM_NEXT();
+    VM_CASE(AddF)       A.f = B.f + C.f; VM_NEXT();
+    VM_CASE(SubF)       A.f = B.f - C.f; VM_NEXT();
+    VM_CASE(MulF)       A.f = B.f * C.f; VM_NEXT();
+    VM_CASE(DivF)       A.f = B.f / C.f; VM_NEXT();
+    VM_CASE(LtI)        A.i = B.i < C.i; VM_NEXT();
+    VM_CASE(LeI)        A.i = B.i <= C.i; VM_NEXT();
+    VM_CASE(GtI)        A.i = B.i > C.i; VM_NEXT();
+    VM_CASE(GeI)        A.i = B.i >= C.i; VM_NEXT();
+    VM_CASE(EqI)        A.i = B.i == C.i; VM_NEXT();
+    VM_CASE(NeI)        A.i = B.i != C.i; VM_NEXT();
+    VM_CASE(LtF)        A.i = B.f < C.f; VM_NEXT();
+    VM_CASE(LeF)        A.i = B.f <= C.f; VM_NEXT();
+    VM_CASE(GtF)        A.i = B.f > C.f; VM_NEXT();
+    VM_CASE(GeF)        A.i = B.f >= C.f; VM_NEXT();
+    VM_CASE(EqF)        A.i = B.f == C.f; VM_NEXT();
+    VM_CASE(NeF)        A.i = B.f != C.f; VM_NEXT();
+    VM_CASE(IntToFloat) A.f = static_cast<double>(B.i); VM_NEXT();
+    VM_CASE(FloatToInt) A.i = static_cast<long long>(B.f); VM_NEXT();
+    VM_CASE(Jump)       pc = code + pc->a; VM_DISPATCH();
+    VM_CASE(JumpIfZero)
+        pc = A.i == 0 ? code + pc->b : pc + 1;
+        VM_DISPATCH();
+    VM_CASE(JumpIfFloatZero)
+        pc = A.f == 0 ? code + pc->b : pc + 1;
+        VM_DISPATCH();
+    VM_CASE(LoopTest)
+        pc = A.i < B.i ? pc + 1 : code + pc->c;
+        VM_DISPATCH();
+    VM_CASE(Increment)  ++A.i; VM_NEXT();
+    VM_CASE(PrintLit)   out << std::string_view(program.strings[static_cast<size_t>(pc->a)]); VM_NEXT();
+    VM_CASE(PrintStr)   out << std::string_view(program.strings[A.str]); VM_NEXT();
+    VM_CASE(PrintInt)   out << A.i; VM_NEXT();
+    VM_CASE(PrintFloat) print_float(out, A.f); VM_NEXT();
+    VM_CASE(Call) {
+        if (calls.size() == max_depth) runtime_error(program, pc, "Call stack overflow");
+        const Bytecode::Function& callee = program.functions[static_cast<size_t>(pc->a)];
+        size_t callee_base = base + frame_size;
+        if (stack.size() < callee_base + callee.frame_size + 1) {
+            stack.resize((callee_base + callee.frame_size + 1) * 2);
+        }
+        if (pc->c) stack[callee_base] = stack[base + static_cast<size_t>(pc->b)];
+
+        calls.push_back({ pc + 1, base });
+        base = callee_base;
+        frame_size = callee.frame_size;
+        frame = stack.data() + base;
+        pc = code + callee.entry;
+        VM_DISPATCH();
+    }
+    VM_CASE(Return) {
+        if (calls.empty()) {
+            out.flush();
+            return;
+        }
+        ReturnAddress back = calls.back();
+        calls.pop_back();
+        frame_size = base - back.base;
+        base = back.base;
+        frame = stack.data() + base;
+        pc = back.pc;
+        VM_DISPATCH();
+    }
+
+#if !HERLANG_THREADED_DISPATCH
+        }
+    }
+#endif
+
+#undef VM_NEXT
+#undef VM_DISPATCH
+#undef VM_CASE
+#undef C
+#undef B
+#undef A
+}
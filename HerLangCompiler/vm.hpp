@@ -0,0 +1,74 @@
+// vm.hpp - Bytecode compiler and interpreter for `hcp run`
+#pragma once
+#include "ast.hpp"
+#include "output.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Every instruction works on slots of the current frame: a is the
+// destination or sole operand, b and c the sources. Jump targets are
+// instruction indices.
+#define HERLANG_VM_OPS(X) \
+    X(Const)       /* a = constants[b] */ \
+    X(Move)        /* a = b */ \
+    X(AddI) X(SubI) X(MulI) X(DivI) \
+    X(AddF) X(SubF) X(MulF) X(DivF) \
+    X(LtI) X(LeI) X(GtI) X(GeI) X(EqI) X(NeI) \
+    X(LtF) X(LeF) X(GtF) X(GeF) X(EqF) X(NeF) \
+    X(IntToFloat)  /* a = double(b) */ \
+    X(FloatToInt)  /* a = long long(b) */ \
+    X(Jump)        /* goto a */ \
+    X(JumpIfZero)  /* if a == 0 goto b */ \
+    X(JumpIfFloatZero) \
+    X(LoopTest)    /* if !(a < b) goto c */ \
+    X(Increment)   /* ++a */ \
+    X(PrintLit)    /* print strings[a] */ \
+    X(PrintStr)    /* print strings[slot a] */ \
+    X(PrintInt) \
+    X(PrintFloat) \
+    X(Call)        /* functions[a], with slot b as its argument when c != 0 */ \
+    X(Return)
+
+enum class Op : uint8_t {
+#define HERLANG_VM_ENUM(name) name,
+    HERLANG_VM_OPS(HERLANG_VM_ENUM)
+#undef HERLANG_VM_ENUM
+};
+
+struct Instr {
+    Op op;
+    int32_t a = 0;
+    int32_t b = 0;
+    int32_t c = 0;
+};
+
+// One frame slot. Strings are indices into Bytecode::strings.
+union Cell {
+    long long i;
+    double f;
+    uint32_t str;
+};
+
+struct Bytecode {
+    struct Function {
+        uint32_t entry;
+        uint32_t frame_size;
+    };
+
+    std::vector<Instr> code;
+    std::vector<int> lines;  // source line of each instruction, for runtime errors
+    std::vector<Cell> constants;
+    std::vector<std::string> strings;
+    std::vector<Function> functions;  // functions[0] is the start block
+};
+
+// Lowers an analyzed AST to bytecode. As in generate_llvm_ir, a function gets
+// one body per parameter type it is called with, and only code reachable from
+// start is compiled. Throws CompileError for the same programs.
+Bytecode compile_bytecode(const AST& ast);
+
+// Runs `program`, writing everything it says to `out`, which is flushed on
+// return. Throws CompileError on integer division by zero or runaway
+// recursion.
+void run_bytecode(const Bytecode& program, OutputSink& out);
@@ -1,60 +1,51 @@
 // warnings.cpp - Indentation warning analyzer
 #include "warnings.hpp"
-#include "utils.hpp"
-#include <sstream>
-#include <iostream>
-#include <stack>
 
-void check_indentation(const std::string& source) {
-    std::istringstream in(source);
-    std::string line;
-    int lineno = 1;
+IndentationChecker::IndentationChecker(Diagnostics& diag) : diag(&diag) {}
 
-    std::stack<int> indent_stack;
-
-    while (std::getline(in, line)) {
-        std::string trimmed = trim(line);
-        if (trimmed.empty() || trimmed[0] == '#') {
-            lineno++;
-            continue;
-        }
-
-        int indent = 0;
-        for (char c : line) {
-            if (c == ' ') indent++;
-            else break;
+// Warnings point at the line's first character, just past its indentation.
+void IndentationChecker::line(int lineno, int indent, KeywordKind first) {
+    int column = indent + 1;
+    if (first == KeywordKind::End) {
+        if (indent_stack.empty()) {
+            diag->warning(DiagCode::UnmatchedEnd, lineno, column);
         }
-
-        if (trimmed == "end") {
-            if (indent_stack.empty()) {
-                std::cerr << "[Warning] Line " << lineno << ": 'end' without matching block start.\n";
-            }
-            else {
-                int expected_indent = indent_stack.top();
-                if (indent != expected_indent) {
-                    std::cerr << "[Warning] Line " << lineno << ": 'end' indentation mismatch. Expected "
-                        << expected_indent << " spaces but got " << indent << ".\n";
-                }
-                indent_stack.pop();
+        else {
+            int expected_indent = indent_stack.back();
+            if (indent != expected_indent) {
+                diag->warning(DiagCode::EndIndent, lineno, column, expected_indent, indent);
             }
+            indent_stack.pop_back();
         }
-        else if (trimmed.find("function") == 0 || trimmed.find("start:") == 0 ||
-            trimmed.find("if") == 0 || trimmed.find("elif") == 0 || trimmed.find("else") == 0) {
-            indent_stack.push(indent);
+    }
+    else if (first == KeywordKind::Elif || first == KeywordKind::Else) {
+        // Continues the open if rather than opening a block of its own.
+        const char* keyword = first == KeywordKind::Elif ? "elif" : "else";
+        if (indent_stack.empty()) {
+            diag->warning(DiagCode::UnmatchedBranch, lineno, column, 0, 0, keyword);
+            indent_stack.push_back(indent);
         }
-        else {
-            if (!indent_stack.empty()) {
-                int expected_indent = indent_stack.top();
-                if (indent <= expected_indent) {
-                    std::cerr << "[Warning] Line " << lineno << ": Inconsistent indentation. Expected greater than "
-                        << expected_indent << " spaces but got " << indent << ".\n";
-                }
+        else if (indent != indent_stack.back()) {
+            diag->warning(DiagCode::BranchIndent, lineno, column, indent_stack.back(), indent, keyword);
+        }
+    }
+    else if (first == KeywordKind::Function || first == KeywordKind::Start ||
+        first == KeywordKind::If || first == KeywordKind::Repeat) {
+        indent_stack.push_back(indent);
+    }
+    else {
+        if (!indent_stack.empty()) {
+            int expected_indent = indent_stack.back();
+            if (indent <= expected_indent) {
+                diag->warning(DiagCode::BodyIndent, lineno, column, expected_indent, indent);
             }
         }
-        lineno++;
     }
+}
 
+void IndentationChecker::finish() {
     if (!indent_stack.empty()) {
-        std::cerr << "[Warning] EOF: Some blocks not closed properly (missing 'end').\n";
+        diag->warning(DiagCode::UnclosedBlock, 0, 0);
     }
+    indent_stack.clear();
 }
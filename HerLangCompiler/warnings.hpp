@@ -1,5 +1,21 @@
 // warnings.hpp
 #pragma once
-#include <string>
+#include "diagnostics.hpp"
+#include "keywords.hpp"
+#include <vector>
 
-void check_indentation(const std::string& source);
\ No newline at end of file
+// Incremental indentation analyzer. The lexer feeds it the indentation and
+// leading keyword of each non-blank, non-comment line, the same data its
+// Indent/Dedent tokens come from, so the source is only scanned once.
+// Warnings are recorded into `diag`, which must outlive the checker.
+class IndentationChecker {
+public:
+    explicit IndentationChecker(Diagnostics& diag);
+
+    void line(int lineno, int indent, KeywordKind first);
+    void finish();
+
+private:
+    Diagnostics* diag;
+    std::vector<int> indent_stack;
+};
@@ -0,0 +1,196 @@
+// bench.cpp - hcp_bench: per-phase throughput on synthetic programs
+#include "corpus.hpp"
+#include "driver.hpp"
+#include "generator.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "scan.hpp"
+#include "warnings.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace {
+
+// Discards generated code but keeps the chunked write path realistic.
+class NullSink : public OutputSink {
+public:
+    ~NullSink() override { flush(); }
+
+protected:
+    void write_chunk(const char*, size_t) override {}
+};
+
+struct BenchConfig {
+    CorpusShape shape;
+    int iterations = 5;
+    std::string emit_path;
+};
+
+}
+
+static void usage() {
+    std::cerr << "Usage: hcp_bench [--functions N] [--statements N] [--say-args N]\n"
+                 "                 [--string-length N] [--seed N] [--iterations N] [--emit out.herc]\n";
+}
+
+static bool parse_args(int argc, char* argv[], BenchConfig& config) {
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (i + 1 >= argc) return false;
+        size_t value = std::strtoul(argv[i + 1], nullptr, 10);
+        if (arg == "--functions") config.shape.functions = value;
+        else if (arg == "--statements") config.shape.statements = value;
+        else if (arg == "--say-args") config.shape.say_args = value;
+        else if (arg == "--string-length") config.shape.string_length = value;
+        else if (arg == "--seed") config.shape.seed = static_cast<uint32_t>(value);
+        else if (arg == "--iterations") config.iterations = std::max(1, static_cast<int>(value));
+        else if (arg == "--emit") config.emit_path = argv[i + 1];
+        else return false;
+        ++i;
+    }
+    return true;
+}
+
+// Best-of-N wall time in seconds.
+static double measure(int iterations, const std::function<void()>& body) {
+    double best = 1e30;
+    for (int i = 0; i < iterations; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, std::chrono::duration<double>(elapsed).count());
+    }
+    return best;
+}
+
+// lex_parallel must produce exactly what lex does; reports the first token
+// that differs.
+static bool same_tokens(const std::vector<Token>& serial, const std::vector<Token>& parallel) {
+    size_t count = std::min(serial.size(), parallel.size());
+    for (size_t i = 0; i < count; ++i) {
+        const Token& a = serial[i];
+        const Token& b = parallel[i];
+        if (a.type != b.type || a.value != b.value || a.line != b.line || a.column != b.column ||
+            a.symbol != b.symbol || a.keyword != b.keyword) {
+            std::cerr << "lex_parallel token " << i << " is '" << b.value << "' at line " << b.line << ":"
+                      << b.column << ", lex has '" << a.value << "' at line " << a.line << ":" << a.column << "\n";
+            return false;
+        }
+    }
+    if (serial.size() != parallel.size()) {
+        std::cerr << "lex_parallel produced " << parallel.size() << " tokens, lex " << serial.size() << "\n";
+        return false;
+    }
+    return true;
+}
+
+// Same for what the two recorded, in order.
+static bool same_diagnostics(const Diagnostics& serial, const Diagnostics& parallel) {
+    const std::vector<Diagnostic>& a = serial.all();
+    const std::vector<Diagnostic>& b = parallel.all();
+    bool same = a.size() == b.size();
+    for (size_t i = 0; same && i < a.size(); ++i) {
+        same = a[i].code == b[i].code && a[i].severity == b[i].severity && a[i].line == b[i].line &&
+            a[i].column == b[i].column && a[i].expected == b[i].expected && a[i].got == b[i].got &&
+            serial.text(a[i]) == parallel.text(b[i]);
+    }
+    if (!same) std::cerr << "lex_parallel diagnostics differ from lex\n";
+    return same;
+}
+
+static void print_row(const char* phase, double seconds, size_t lines, size_t bytes) {
+    std::printf("%-12s %10.3f %14.0f %10.1f\n", phase, seconds * 1e3,
+        lines / seconds, bytes / seconds / (1024.0 * 1024.0));
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+    if (!parse_args(argc, argv, config)) {
+        usage();
+        return 1;
+    }
+
+    std::string source = generate_corpus(config.shape);
+    size_t lines = static_cast<size_t>(std::count(source.begin(), source.end(), '\n'));
+
+    if (!config.emit_path.empty()) {
+        std::ofstream out(config.emit_path, std::ios::binary);
+        out << source;
+        if (!out) {
+            std::cerr << "Cannot write corpus: " << config.emit_path << "\n";
+            return 1;
+        }
+    }
+
+    Diagnostics diag;
+    std::vector<Token> tokens;
+    Interner symbols;
+    AST ast;
+
+    Diagnostics lex_diag;
+    double lex_s = measure(config.iterations, [&] {
+        lex_diag.clear();
+        IndentationChecker indentation(lex_diag);
+        symbols = Interner();
+        tokens = lex(source, &indentation, &symbols, &lex_diag);
+        indentation.finish();
+    });
+    // At least two chunks, so the merge is what gets checked on any machine.
+    unsigned threads = std::max(2u, std::thread::hardware_concurrency());
+    std::vector<Token> parallel_tokens;
+    Diagnostics parallel_diag;
+    double lex_parallel_s = measure(config.iterations, [&] {
+        parallel_diag.clear();
+        IndentationChecker indentation(parallel_diag);
+        Interner parallel_symbols;
+        parallel_tokens = lex_parallel(source, threads, &indentation, &parallel_symbols, &parallel_diag);
+        indentation.finish();
+    });
+    if (!same_tokens(tokens, parallel_tokens) || !same_diagnostics(lex_diag, parallel_diag)) return 1;
+    double parse_s = measure(config.iterations, [&] { ast = parse(tokens, symbols); });
+    size_t output_bytes = 0;
+    double generate_s = measure(config.iterations, [&] {
+        NullSink sink;
+        generate_cpp(ast, sink);
+        output_bytes = sink.bytes_written();
+    });
+
+    // End to end goes through the real driver, including file I/O.
+    std::string input_path = "hcp_bench_input.herc";
+    std::string output_path = "hcp_bench_output.cpp";
+    {
+        std::ofstream out(input_path, std::ios::binary);
+        out << source;
+    }
+    bool ok = true;
+    double total_s = measure(config.iterations, [&] {
+        ok = compile_file({ input_path, output_path }, CompileOptions(), diag) && ok;
+    });
+    std::remove(input_path.c_str());
+    std::remove(output_path.c_str());
+
+    if (!ok || !diag.empty()) {
+        std::cerr << "Corpus did not compile cleanly:\n";
+        diag.print(std::cerr);
+        return 1;
+    }
+
+    std::printf("corpus: %zu lines, %zu bytes, %zu tokens, %zu AST nodes, %zu output bytes (%s scanner)\n",
+        lines, source.size(), tokens.size(), ast.node_count, output_bytes, scan_isa());
+    std::printf("%-12s %10s %14s %10s\n", "phase", "best ms", "lines/sec", "MB/sec");
+    print_row("lex", lex_s, lines, source.size());
+    print_row("lex -j", lex_parallel_s, lines, source.size());
+    print_row("parse", parse_s, lines, source.size());
+    print_row("generate", generate_s, lines, source.size());
+    print_row("end-to-end", total_s, lines, source.size());
+    return 0;
+}
@@ -0,0 +1,96 @@
+// corpus.cpp - Synthetic HerLang program generator for benchmarks
+#include "corpus.hpp"
+
+namespace {
+
+// xorshift32: deterministic across platforms, unlike <random> distributions.
+struct Rng {
+    uint32_t state;
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+    size_t below(size_t n) { return n ? next() % n : 0; }
+};
+
+}
+
+static void append_literal(std::string& out, Rng& rng, size_t length) {
+    static const char* const words[] = { "her", "world", "code", "is", "beautiful", "编程", "你", "lang" };
+    out += '"';
+    size_t start = out.size();
+    while (out.size() - start < length) {
+        if (out.size() > start) out += ' ';
+        out += words[rng.below(sizeof(words) / sizeof(words[0]))];
+    }
+    out += '"';
+}
+
+static void append_function_name(std::string& out, size_t index) {
+    out += "helper_";
+    out += std::to_string(index);
+}
+
+// Functions 4k and 4k+1 never call other functions.
+static bool is_leaf(size_t index) {
+    return index % 4 < 2;
+}
+
+std::string generate_corpus(const CorpusShape& shape) {
+    Rng rng{ shape.seed ? shape.seed : 1 };
+    std::string out;
+    out.reserve(shape.functions * shape.statements * (shape.say_args * (shape.string_length + 3) + 16));
+
+    out += "# synthetic benchmark corpus\n";
+    for (size_t f = 0; f < shape.functions; ++f) {
+        bool has_param = f % 2 == 1;
+        out += "function ";
+        append_function_name(out, f);
+        out += has_param ? " value:\n" : ":\n";
+
+        for (size_t s = 0; s < shape.statements; ++s) {
+            out += "    ";
+            size_t pick = rng.below(10);
+            if (pick < 6) {
+                out += "say";
+                for (size_t a = 0; a < shape.say_args; ++a) {
+                    out += ' ';
+                    if (has_param && a % 3 == 1) out += "value";
+                    else append_literal(out, rng, shape.string_length);
+                }
+                if (pick == 0) out += " end=\"\"";
+            }
+            else if (pick < 8) {
+                out += "set counter_";
+                out += std::to_string(s);
+            }
+            else if (f > 0 && !is_leaf(f)) {
+                // Only leaves are called, so running the program stays linear in its size.
+                size_t pick = rng.below(f);
+                size_t callee = (pick & ~size_t(3)) | (pick & 1);
+                append_function_name(out, callee);
+                if (callee % 2 == 1) {
+                    out += ' ';
+                    append_literal(out, rng, shape.string_length);
+                }
+            }
+            else {
+                out += "say \"first\"";
+            }
+            out += '\n';
+        }
+        out += "end\n\n";
+    }
+
+    out += "start:\n";
+    for (size_t f = 0; f < shape.functions; ++f) {
+        out += "    ";
+        append_function_name(out, f);
+        if (f % 2 == 1) out += " \"arg\"";
+        out += '\n';
+    }
+    out += "end\n";
+    return out;
+}
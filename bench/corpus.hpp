@@ -0,0 +1,18 @@
+// corpus.hpp - Synthetic HerLang program generator for benchmarks
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+struct CorpusShape {
+    size_t functions = 2000;     // top-level function definitions
+    size_t statements = 24;      // statements per function body
+    size_t say_args = 4;         // arguments per say statement
+    size_t string_length = 24;   // characters per string literal
+    uint32_t seed = 1;
+};
+
+// Produces a well-formed, correctly indented program: every function body
+// mixes say/set/call statements, and the start block calls all functions.
+// The generated program also runs, in time linear in its size.
+std::string generate_corpus(const CorpusShape& shape);